@@ -41,12 +41,24 @@ class AudioBuffer
   void Init(short* buffer, uint32_t buffer_size) {
     buffer_ = buffer;
     buffer_size_ = buffer_size;
+    cursor_ = 0;
+    valid_ = 0;
   }
 
   void Clear() {
     std::fill(buffer_, buffer_ + buffer_size_, 0);
+    valid_ = buffer_size_;
   }
 
+  /* For a buffer cleared in the background: the first [size] values
+   * are zero or written, the others read as zero. The write cursor
+   * must stay below it. */
+  void set_valid(uint32_t size) { valid_ = size; }
+
+  /* Once true, the readers can be instantiated with [cleared]: they
+   * then skip the check of the cleared part. Checked once per block */
+  bool cleared() { return valid_ >= buffer_size_; }
+
   uint32_t size() { return buffer_size_; }
 
   /* Write one value at cursor and increment it */
@@ -75,6 +87,7 @@ class AudioBuffer
   }
 
   /* Reads the value from [pos] writes ago */
+  template<bool cleared>
   inline short ReadShort(uint32_t pos) {
     uint32_t index;// = cursor_ - pos;
     if (cursor_ < pos) {
@@ -82,26 +95,28 @@ class AudioBuffer
     } else {
       index = cursor_ - pos;
     }
-    return buffer_[index];
+    return at<cleared>(index);
   }
 
   /* Assumes that buffer_size_ is 2^n */
+  template<bool cleared>
   inline float ReadLinear(float pos) {
     MAKE_INTEGRAL_FRACTIONAL(pos);
     int32_t x = cursor_ - pos_integral;
-    float a = buffer_[x & (buffer_size_-1)];
-    float b = buffer_[(x - 1) & (buffer_size_-1)];
+    float a = at<cleared>(x & (buffer_size_-1));
+    float b = at<cleared>((x - 1) & (buffer_size_-1));
     return (a + (b - a) * pos_fractional) / 32768.0f;
   }
 
   /* Assumes that buffer_size_ is 2^n */
+  template<bool cleared>
   inline float ReadHermite(float pos) {
     MAKE_INTEGRAL_FRACTIONAL(pos);
     int32_t x = cursor_ - pos_integral;
-    float xm1 = buffer_[x & (buffer_size_-1)];
-    float x0 = buffer_[(x - 1) & (buffer_size_-1)];
-    float x1 = buffer_[(x - 2) & (buffer_size_-1)];
-    float x2 = buffer_[(x - 3) & (buffer_size_-1)];
+    float xm1 = at<cleared>(x & (buffer_size_-1));
+    float x0 = at<cleared>((x - 1) & (buffer_size_-1));
+    float x1 = at<cleared>((x - 2) & (buffer_size_-1));
+    float x2 = at<cleared>((x - 3) & (buffer_size_-1));
     float c = (x1 - xm1) * 0.5f;
     float v = x0 - x1;
     float w = c + v;
@@ -112,10 +127,11 @@ class AudioBuffer
   }
 
   /* Assumes that buffer_size_ is 2^n */
+  template<bool cleared>
   inline float Read(float pos) {
     int32_t pos_integral = static_cast<uint32_t>(pos); \
     int32_t x = cursor_ - pos_integral;
-    float a = buffer_[x & (buffer_size_-1)];
+    float a = at<cleared>(x & (buffer_size_-1));
     return a / 32768.0f;
   }
 
@@ -134,13 +150,25 @@ class AudioBuffer
       index = cursor_ - pos - size;
     }
     std::copy(buffer_ + index, buffer_ + index + read, dest);
+    if (valid_ < buffer_size_) {
+      for (size_t i=0; i<size; i++) {
+        uint32_t j = i < read ? index + i : i - read;
+        if (j >= valid_) dest[i] = 0;
+      }
+    }
   }
 
  private:
 
+  template<bool cleared>
+  inline short at(uint32_t index) {
+    return cleared || index < valid_ ? buffer_[index] : 0;
+  }
+
   short* buffer_;
   uint32_t cursor_;
   uint32_t buffer_size_;
+  uint32_t valid_;
 };
 
 #endif
@@ -0,0 +1,88 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Startup sequence and its profile. The sequence is a template over
+// the board, so that the same code runs on the hardware and, with
+// simulated peripherals, on the host (test/boot_test.cc).
+
+#ifndef BOOT_H_
+#define BOOT_H_
+
+#include "stmlib/stmlib.h"
+
+enum BootPhase {
+  BOOT_SYSTEM,                  // clocks, cycle counter
+  BOOT_TESTER,                  // hardware tester check
+  BOOT_CODEC_CLOCK,             // I2S clock running, codec out of reset
+  BOOT_SDRAM,                   // SDRAM up, background clear started
+  BOOT_DELAY,                   // DAC and delay line
+  BOOT_UI,                      // settings and slots loaded
+  BOOT_CODEC,                   // codec configured, audio DMA running
+  BOOT_FIRST_BLOCK,             // first audio block out
+  BOOT_BUFFER_CLEARED,          // delay buffer background clear done
+  BOOT_PHASE_LAST
+};
+
+// Kept in RAM, to be read with a debugger
+struct BootProfile {
+  // CPU cycles at the end of each phase, 0 if not reached yet
+  uint32_t cycles[BOOT_PHASE_LAST];
+
+  void Init() {
+    for (int i=0; i<BOOT_PHASE_LAST; i++) {
+      cycles[i] = 0;
+    }
+  }
+
+  void Mark(BootPhase phase, uint32_t now) {
+    if (cycles[phase] == 0) cycles[phase] = now;
+  }
+
+  bool reached(BootPhase phase) const { return cycles[phase] != 0; }
+};
+
+// Independent work overlaps: the codec settles out of reset and the
+// delay buffer is cleared by DMA while the presets load from flash
+template<class Board>
+void Boot(Board* board, BootProfile* profile) {
+  profile->Init();
+  board->InitSystem();
+  profile->Mark(BOOT_SYSTEM, board->cycles());
+  board->RunTesterIfRequested();
+  profile->Mark(BOOT_TESTER, board->cycles());
+  board->InitCodecClock();
+  profile->Mark(BOOT_CODEC_CLOCK, board->cycles());
+  board->InitSdram();
+  profile->Mark(BOOT_SDRAM, board->cycles());
+  board->InitDelay();
+  profile->Mark(BOOT_DELAY, board->cycles());
+  board->InitUi();
+  profile->Mark(BOOT_UI, board->cycles());
+  board->StartCodec();
+  profile->Mark(BOOT_CODEC, board->cycles());
+}
+
+#endif
@@ -33,10 +33,13 @@
 #include "drivers/adc.hh"
 #include "drivers/buttons.hh"
 #include "drivers/codec.hh"
+#include "drivers/flash_writer.hh"
 #include "drivers/leds.hh"
 #include "drivers/system.hh"
 
+#include "bootloader/decompressor.hh"
 #include "bootloader/meter.hh"
+#include "bootloader/page_pipeline.hh"
 
 #include "stm_audio_bootloader/qpsk/demodulator.h"
 #include "stm_audio_bootloader/qpsk/packet_decoder.h"
@@ -54,9 +57,12 @@ const uint32_t kStartAddress = 0x08008000;
 Adc adc;
 Codec codec;
 Demodulator demodulator;
+FlashWriter flash_writer;
 Leds leds;
 Meter meter;
 PacketDecoder decoder;
+PagePipeline<FlashWriter> pipeline;
+Decompressor<FlashWriter> decompressor;
 Buttons buttons;
 
 // Default interrupt handlers.
@@ -90,7 +96,7 @@ enum UiState {
   UI_STATE_WAITING,
   UI_STATE_RECEIVING,
   UI_STATE_ERROR,
-  UI_STATE_WRITING
+  UI_STATE_WRITING              // erasing, or reception held back by the flash
 };
 
 volatile bool button_released = false;
@@ -152,7 +158,6 @@ void UpdateLeds() {
 
 void SysTick_Handler() {
   system_clock.Tick();
-  adc.Convert();
   int32_t gain_raw = adc.value(ADC_GAIN_POT) >> 1;
   gain = (gain_raw * gain_raw) >> 14;
   buttons.Debounce();
@@ -185,31 +190,12 @@ void FillBuffer(Frame *input, Frame *output) {
   }
 }
 
-static size_t current_address;
 static uint16_t packet_index;
-static uint32_t kSectorBaseAddress[] = {
-    0x08000000, 0x08004000, 0x08008000, 0x0800C000, 0x08010000, 0x08020000,
-    0x08040000, 0x08060000, 0x08080000, 0x080A0000, 0x080C0000, 0x080E0000};
-const uint32_t kBlockSize = 16384;
-const uint16_t kPacketsPerBlock = kBlockSize / kPacketSize;
-uint8_t buffer[kBlockSize];
-
-void ProgramPage(const uint8_t *data, size_t size) {
-  FLASH_Unlock();
-  FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR |
-                  FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
-  for (int32_t i = 0; i < 12; ++i) {
-    if (current_address == kSectorBaseAddress[i]) {
-      FLASH_EraseSector(i * 8, VoltageRange_3);
-    }
-  }
-  const uint32_t *words =
-      static_cast<const uint32_t *>(static_cast<const void *>(data));
-  for (size_t written = 0; written < size; written += 4) {
-    FLASH_ProgramWord(current_address, *words++);
-    current_address += 4;
-  }
-}
+static bool compressed;
+const uint16_t kPacketsPerBlock = kPageSize / kPacketSize;
+
+static_assert(kPageSize % kPacketSize == 0, "packets straddle pages");
+static_assert(kPacketSize <= kDecompressorInputSize, "packets too large");
 
 void Init() {
   System sys;
@@ -228,8 +214,12 @@ void InitializeReception() {
                    kSampleRate / kModulationRate, 2.0 * kSampleRate / kBitRate);
   demodulator.SyncCarrier(true);
   decoder.Reset();
-  current_address = kStartAddress;
+  // a page being written is abandoned, the transfer restarts anyway
+  flash_writer.Init();
+  pipeline.Init(&flash_writer, kStartAddress);
+  decompressor.Init(&pipeline);
   packet_index = 0;
+  compressed = false;
   ui_state = UI_STATE_WAITING;
 }
 
@@ -248,22 +238,53 @@ int main(void) {
       demodulator.ProcessAtLeast(32);
     }
 
-    while (demodulator.available() && !error && !exit_updater) {
+    // program and decompress between the demodulations
+    pipeline.Poll();
+    decompressor.Process();
+    if (decompressor.error() || pipeline.error()) {
+      error = true;
+    }
+
+    // both pages are still to be written: the symbols wait in the
+    // demodulator until one is free
+    bool ready = compressed ? decompressor.idle() : pipeline.writeable();
+    if (!ready) {
+      ui_state = UI_STATE_WRITING;
+    }
+
+    while (demodulator.available() && ready && !error && !exit_updater) {
       uint8_t symbol = demodulator.NextSymbol();
       PacketDecoderState state = decoder.ProcessSymbol(symbol);
       switch (state) {
       case PACKET_DECODER_STATE_OK: {
         ui_state = UI_STATE_RECEIVING;
-        memcpy(buffer + (packet_index % kPacketsPerBlock) * kPacketSize,
-               decoder.packet_data(), kPacketSize);
+        if (packet_index == 0) {
+          compressed = IsCompressed(decoder.packet_data());
+          // its pages wait for the erase of their sector
+          if (compressed) pipeline.Hold();
+        }
+        if (compressed) {
+          decompressor.Feed(decoder.packet_data(), kPacketSize);
+          ready = decompressor.idle();
+          error = decompressor.error();
+          uint32_t block = packet_index / kPacketsPerBlock;
+          if ((packet_index + 1) % kPacketsPerBlock == 0 && !error &&
+              StartsSector(kStartAddress + block * kPageSize)) {
+            // in the long pause after the block, the next sectors of
+            // the image, as compress.py expects
+            pipeline.EraseTo(kStartAddress + decompressor.image_size(),
+                             kSectorPauseEraseTime);
+          }
+        } else {
+          pipeline.Append(decoder.packet_data(), kPacketSize);
+          ready = pipeline.writeable();
+        }
         ++packet_index;
+        decoder.Reset();
         if ((packet_index % kPacketsPerBlock) == 0) {
-          ui_state = UI_STATE_WRITING;
-          ProgramPage(buffer, kBlockSize);
-          decoder.Reset();
+          // the encoder pauses after each block
           demodulator.SyncCarrier(false);
         } else {
-          decoder.Reset();
           demodulator.SyncDecision();
         }
       } break;
@@ -272,7 +293,17 @@ int main(void) {
         error = true;
         break;
       case PACKET_DECODER_STATE_END_OF_TRANSMISSION:
-        exit_updater = true;
+        if (compressed) {
+          // the rest of the image, there is no signal left to lose
+          pipeline.EraseTo(kStartAddress + decompressor.image_size());
+        }
+        pipeline.Flush();
+        if (compressed && !decompressor.Verify(
+                reinterpret_cast<const uint8_t*>(kStartAddress))) {
+          error = true;
+        } else {
+          exit_updater = true;
+        }
         break;
       default:
         break;
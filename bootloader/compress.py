@@ -0,0 +1,189 @@
+#!/usr/bin/python
+#
+# Copyright 2017 Matthias Puech.
+#
+# Author: Matthias Puech (matthias.puech@gmail.com)
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+# 
+# See http://creativecommons.org/licenses/MIT/ for more information.
+#
+# -----------------------------------------------------------------------------
+#
+# Compressed firmware updates, for the bootloader's decompressor
+# (bootloader/decompressor.hh): a header, then each 16kB page of the
+# image as an independent LZ4 block. The blocks are laid out for the
+# encoder's pauses, where the bootloader erases the sectors: a page
+# which would otherwise wait for an erase, or for the page before to be
+# programmed, is pushed back by compressing less.
+
+from __future__ import print_function
+
+import optparse
+import struct
+import sys
+import zlib
+
+MAGIC = b'TAPZ'
+HEADER_SIZE = 16
+PAGE_SIZE = 16384
+# of the encoder, followed by a pause
+BLOCK_SIZE = 16384
+# of the flash, as bootloader/page_pipeline.hh
+START_ADDRESS = 0x08008000
+SECTOR_BASE_ADDRESSES = [
+    0x08000000, 0x08004000, 0x08008000, 0x0800C000, 0x08010000, 0x08020000,
+    0x08040000, 0x08060000, 0x08080000, 0x080A0000, 0x080C0000, 0x080E0000]
+SECTOR_PAUSE_ERASE_TIME = 2000
+# each page lasts longer than the programming of the one before, 4096
+# words of 100us at worst, up to 48 kbit/s
+MIN_BLOCK_SIZE = 4096
+MIN_MATCH = 4
+MAX_OFFSET = 65535
+# as LZ4: the last match starts 12 bytes before the end of the block,
+# and the last 5 bytes are literals
+MATCH_LIMIT = 12
+LAST_LITERALS = 5
+
+
+def write_length(out, length):
+  while length >= 255:
+    out.append(255)
+    length -= 255
+  out.append(length)
+
+
+def write_sequence(out, literals, match_length=0, offset=0):
+  literal_length = len(literals)
+  match_code = match_length - MIN_MATCH if match_length else 0
+  out.append(min(literal_length, 15) << 4 | min(match_code, 15))
+  if literal_length >= 15:
+    write_length(out, literal_length - 15)
+  out.extend(literals)
+  if match_length:
+    out.extend(struct.pack('<H', offset))
+    if match_code >= 15:
+      write_length(out, match_code - 15)
+
+
+def compress_block(data, literals=0):
+  """Greedy LZ4 block compression, with the latest occurrence of each
+  4-byte sequence as the only candidate, after [literals] bytes left
+  as they are."""
+  out = bytearray()
+  size = len(data)
+  table = {}
+  anchor = 0
+  i = literals
+  while i < size - MATCH_LIMIT:
+    key = bytes(data[i:i + MIN_MATCH])
+    candidate = table.get(key)
+    table[key] = i
+    if candidate is None or i - candidate > MAX_OFFSET:
+      i += 1
+      continue
+    length = MIN_MATCH
+    max_length = size - LAST_LITERALS - i
+    while length < max_length and data[candidate + length] == data[i + length]:
+      length += 1
+    write_sequence(out, data[anchor:i], length, i - candidate)
+    i += length
+    anchor = i
+  write_sequence(out, data[anchor:])
+  return out
+
+
+def store_block(data):
+  out = bytearray()
+  write_sequence(out, data)
+  return out
+
+
+def sector(address):
+  return max(i for i, base in enumerate(SECTOR_BASE_ADDRESSES)
+             if base <= address)
+
+
+def sector_erase_time(index):
+  """Maximum erase time in ms, as FlashSectorEraseTime."""
+  end = SECTOR_BASE_ADDRESSES[index + 1] \
+      if index + 1 < len(SECTOR_BASE_ADDRESSES) else 0x08100000
+  size = end - SECTOR_BASE_ADDRESSES[index]
+  return 500 if size <= 0x4000 else 1100 if size <= 0x10000 else 2000
+
+
+def erase_blocks(image_size):
+  """Block of the encoder after which bootloader.cc erases each sector
+  of the image: in the long pauses, after the blocks which start a
+  sector, as many sectors as fit."""
+  sectors = sorted(set(sector(START_ADDRESS + offset)
+                       for offset in range(0, image_size, PAGE_SIZE)))
+  blocks = {}
+  block = 0
+  while sectors:
+    if START_ADDRESS + block * BLOCK_SIZE in SECTOR_BASE_ADDRESSES:
+      time = SECTOR_PAUSE_ERASE_TIME
+      while sectors and sector_erase_time(sectors[0]) <= time:
+        time -= sector_erase_time(sectors[0])
+        blocks[sectors.pop(0)] = block
+    block += 1
+  return blocks
+
+
+def compress(image):
+  pages = [image[offset:offset + PAGE_SIZE]
+           for offset in range(0, len(image), PAGE_SIZE)]
+  erased = erase_blocks(len(image))
+  blocks = []
+  for index, page in enumerate(pages):
+    if index >= 2:
+      # the pipeline holds two pages: this one can only start once the
+      # page before the last is written, past the pause where its
+      # sector is erased. Until then, the pages before are stored as
+      # they are.
+      held = erased[sector(START_ADDRESS + (index - 2) * PAGE_SIZE)]
+      stored = index - 1
+      while HEADER_SIZE + sum(len(block) for block in blocks) < \
+          (held + 1) * BLOCK_SIZE and stored >= 0:
+        blocks[stored] = store_block(pages[stored])
+        stored -= 1
+    block = compress_block(page)
+    if len(block) < MIN_BLOCK_SIZE:
+      block = compress_block(page, MIN_BLOCK_SIZE)
+    blocks.append(block)
+  out = bytearray(struct.pack(
+      '<4sIII', MAGIC, len(image), zlib.crc32(bytes(image)) & 0xffffffff,
+      PAGE_SIZE))
+  for block in blocks:
+    out.extend(block)
+  return out
+
+
+if __name__ == '__main__':
+  parser = optparse.OptionParser(usage='%prog input.bin output.bin')
+  options, args = parser.parse_args()
+  if len(args) != 2:
+    parser.print_help()
+    sys.exit(1)
+  image = bytearray(open(args[0], 'rb').read())
+  compressed = compress(image)
+  open(args[1], 'wb').write(compressed)
+  print('%s: %d bytes, compressed to %d (%.0f%%)' % (
+      args[1], len(image), len(compressed),
+      100.0 * len(compressed) / max(len(image), 1)))
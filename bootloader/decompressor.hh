@@ -0,0 +1,272 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+//
+// -----------------------------------------------------------------------------
+//
+// Streaming decompressor of the compressed updates written by
+// bootloader/compress.py. The stream starts with a header of four
+// little-endian words: magic, image size, CRC-32 of the image (as
+// zlib's) and page size. Then each page of the image is an LZ4 block,
+// the last one possibly shorter. Blocks are independent: matches only
+// refer to the page being decompressed, which is the page buffer of
+// the pipeline. Packets are decompressed as they are received; while
+// the pipeline has no free page, the rest of the packet waits for the
+// next call to Process().
+//
+// The bootloader holds each page back until its sector is erased. The
+// sectors covered by the image size of the header are erased a few at
+// a time, in the long pauses of the encoder after the blocks which
+// start a sector. compress.py makes sure that no page then waits with
+// the pipeline full while the signal goes on.
+
+#ifndef DECOMPRESSOR_H_
+#define DECOMPRESSOR_H_
+
+#include "stmlib/stmlib.h"
+
+#include <cstring>
+
+#include "bootloader/page_pipeline.hh"
+
+const uint32_t kCompressedMagic = 0x5A504154; // "TAPZ"
+const size_t kCompressedHeaderSize = 16;
+const size_t kDecompressorInputSize = 256;
+const uint8_t kMinMatch = 4;
+
+inline uint32_t ReadLe32(const uint8_t* p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+// Raw images start with the initial stack pointer instead
+inline bool IsCompressed(const uint8_t* data) {
+  return ReadLe32(data) == kCompressedMagic;
+}
+
+// CRC-32 of zlib, a nibble at a time
+inline uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+  static const uint32_t table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C };
+  crc = ~crc;
+  while (size--) {
+    crc ^= *data++;
+    crc = (crc >> 4) ^ table[crc & 15];
+    crc = (crc >> 4) ^ table[crc & 15];
+  }
+  return ~crc;
+}
+
+enum DecompressorState {
+  DECOMPRESSOR_STATE_HEADER,
+  DECOMPRESSOR_STATE_TOKEN,
+  DECOMPRESSOR_STATE_LITERAL_LENGTH,
+  DECOMPRESSOR_STATE_LITERALS,
+  DECOMPRESSOR_STATE_OFFSET,
+  DECOMPRESSOR_STATE_MATCH_LENGTH,
+  DECOMPRESSOR_STATE_DONE,
+  DECOMPRESSOR_STATE_ERROR
+};
+
+template<class Flash>
+class Decompressor {
+ public:
+  void Init(PagePipeline<Flash>* pipeline) {
+    pipeline_ = pipeline;
+    state_ = DECOMPRESSOR_STATE_HEADER;
+    input_size_ = 0;
+    position_ = 0;
+    header_size_ = 0;
+    written_ = 0;
+    image_size_ = 0;
+    crc_ = 0;
+  }
+
+  // The previous packet has been consumed
+  bool idle() { return position_ == input_size_; }
+
+  // Queues a packet and decompresses it; only when idle()
+  void Feed(const uint8_t* data, size_t size) {
+    memcpy(input_, data, size);
+    input_size_ = size;
+    position_ = 0;
+    Process();
+  }
+
+  // Called from the main loop, to resume a packet held back by the
+  // pipeline
+  void Process() {
+    while (position_ < input_size_ &&
+           state_ < DECOMPRESSOR_STATE_DONE &&
+           pipeline_->writeable()) {
+      if (state_ == DECOMPRESSOR_STATE_LITERALS) {
+        CopyLiterals();
+      } else {
+        Parse(input_[position_++]);
+      }
+    }
+    // past the image, the rest is padding
+    if (state_ >= DECOMPRESSOR_STATE_DONE) position_ = input_size_;
+  }
+
+  bool done() { return state_ == DECOMPRESSOR_STATE_DONE; }
+  bool error() { return state_ == DECOMPRESSOR_STATE_ERROR; }
+  uint32_t image_size() { return image_size_; }
+
+  // Checks the image as written in flash
+  bool Verify(const uint8_t* image) {
+    return done() && Crc32(image, image_size_) == crc_;
+  }
+
+ private:
+  void Parse(uint8_t byte) {
+    switch (state_) {
+    case DECOMPRESSOR_STATE_HEADER:
+      header_[header_size_++] = byte;
+      if (header_size_ == kCompressedHeaderSize) ParseHeader();
+      break;
+
+    case DECOMPRESSOR_STATE_TOKEN:
+      literals_ = byte >> 4;
+      match_length_ = byte & 15;
+      offset_ = 0;
+      offset_size_ = 0;
+      state_ = literals_ == 15 ?
+        DECOMPRESSOR_STATE_LITERAL_LENGTH : DECOMPRESSOR_STATE_LITERALS;
+      if (!literals_) EndLiterals(false);
+      break;
+
+    case DECOMPRESSOR_STATE_LITERAL_LENGTH:
+      literals_ += byte;
+      if (byte != 255) state_ = DECOMPRESSOR_STATE_LITERALS;
+      break;
+
+    case DECOMPRESSOR_STATE_OFFSET:
+      offset_ |= byte << (8 * offset_size_++);
+      if (offset_size_ < 2) break;
+      if (!offset_ || offset_ > pipeline_->size()) {
+        state_ = DECOMPRESSOR_STATE_ERROR;
+      } else if (match_length_ == 15) {
+        state_ = DECOMPRESSOR_STATE_MATCH_LENGTH;
+      } else {
+        CopyMatch();
+      }
+      break;
+
+    case DECOMPRESSOR_STATE_MATCH_LENGTH:
+      match_length_ += byte;
+      if (byte != 255) CopyMatch();
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  void ParseHeader() {
+    image_size_ = ReadLe32(header_ + 4);
+    crc_ = ReadLe32(header_ + 8);
+    bool valid = IsCompressed(header_) &&
+      ReadLe32(header_ + 12) == kPageSize &&
+      image_size_ <= kApplicationEndAddress - kFlashSectorBaseAddress[2];
+    state_ = valid ? DECOMPRESSOR_STATE_TOKEN : DECOMPRESSOR_STATE_ERROR;
+    if (valid && !image_size_) state_ = DECOMPRESSOR_STATE_DONE;
+  }
+
+  // Literals never span pages: they end the block of a page
+  void CopyLiterals() {
+    size_t size = input_size_ - position_;
+    if (size > literals_) size = literals_;
+    if (size > kPageSize - pipeline_->size() ||
+        size > image_size_ - written_) {
+      state_ = DECOMPRESSOR_STATE_ERROR;
+      return;
+    }
+    memcpy(pipeline_->page() + pipeline_->size(), input_ + position_, size);
+    position_ += size;
+    literals_ -= size;
+    written_ += size;
+    bool end_of_page = pipeline_->Commit(size);
+    if (!literals_) EndLiterals(end_of_page);
+  }
+
+  // A match follows, unless the block or the image ends
+  void EndLiterals(bool end_of_page) {
+    if (written_ == image_size_) {
+      Finish();
+    } else if (end_of_page) {
+      state_ = DECOMPRESSOR_STATE_TOKEN;
+    } else {
+      state_ = DECOMPRESSOR_STATE_OFFSET;
+    }
+  }
+
+  // Byte by byte, as the match can overlap its own output
+  void CopyMatch() {
+    size_t size = match_length_ + kMinMatch;
+    if (size > kPageSize - pipeline_->size() ||
+        size > image_size_ - written_) {
+      state_ = DECOMPRESSOR_STATE_ERROR;
+      return;
+    }
+    uint8_t* destination = pipeline_->page() + pipeline_->size();
+    const uint8_t* source = destination - offset_;
+    for (size_t i = 0; i < size; i++) {
+      destination[i] = source[i];
+    }
+    written_ += size;
+    pipeline_->Commit(size);
+    state_ = DECOMPRESSOR_STATE_TOKEN;
+    if (written_ == image_size_) Finish();
+  }
+
+  // Pads the last page with erased flash
+  void Finish() {
+    size_t size = pipeline_->size();
+    if (size) {
+      memset(pipeline_->page() + size, 0xff, kPageSize - size);
+      pipeline_->Commit(kPageSize - size);
+    }
+    state_ = DECOMPRESSOR_STATE_DONE;
+  }
+
+  PagePipeline<Flash>* pipeline_;
+  DecompressorState state_;
+  uint8_t input_[kDecompressorInputSize];
+  size_t input_size_;
+  size_t position_;
+  uint8_t header_[kCompressedHeaderSize];
+  size_t header_size_;
+  uint32_t image_size_;
+  uint32_t crc_;
+  uint32_t written_;
+  uint32_t literals_;
+  uint32_t match_length_;
+  uint32_t offset_;
+  uint8_t offset_size_;
+};
+
+#endif
@@ -0,0 +1,209 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+//
+// -----------------------------------------------------------------------------
+//
+// Double-buffered staging of the pages received by the bootloader.
+// While a page is programmed from the main loop, a few words per call,
+// the next one is decoded into the other buffer. When both are taken,
+// the decoder has to wait: see writeable().
+//
+// Erases stall the flash bus, hence the codec interrupt, for up to two
+// seconds per sector. By default a sector is erased when the first
+// page it holds is written, which is in the pause the encoder leaves
+// after the block of that page. When the size of the image is known in
+// advance, the pages can instead be held back until EraseTo() has
+// erased their sector, a few sectors in each long pause of the
+// encoder. Nothing is ever written from kApplicationEndAddress on:
+// sector 7 holds the settings, sectors 8 to 11 the slots.
+//
+// [Flash] is FlashWriter on the hardware, or a model on the host.
+
+#ifndef PAGE_PIPELINE_H_
+#define PAGE_PIPELINE_H_
+
+#include "stmlib/stmlib.h"
+
+#include <cstring>
+
+const uint32_t kPageSize = 16384;
+const size_t kPageWords = kPageSize / 4;
+const int32_t kNumFlashSectors = 12;
+const uint32_t kFlashSectorBaseAddress[kNumFlashSectors] = {
+    0x08000000, 0x08004000, 0x08008000, 0x0800C000, 0x08010000, 0x08020000,
+    0x08040000, 0x08060000, 0x08080000, 0x080A0000, 0x080C0000, 0x080E0000};
+const uint32_t kFlashEndAddress = 0x08100000;
+const uint32_t kApplicationEndAddress = 0x08060000;
+
+inline int32_t FlashSector(uint32_t address) {
+  int32_t sector = kNumFlashSectors - 1;
+  while (address < kFlashSectorBaseAddress[sector]) --sector;
+  return sector;
+}
+
+inline uint32_t FlashSectorEnd(int32_t sector) {
+  return sector + 1 < kNumFlashSectors ?
+    kFlashSectorBaseAddress[sector + 1] : kFlashEndAddress;
+}
+
+// The encoder pauses longer after the blocks which start a sector
+inline bool StartsSector(uint32_t address) {
+  return kFlashSectorBaseAddress[FlashSector(address)] == address;
+}
+
+// Maximum erase time of a sector in ms, at 2.7-3.6V with x32
+// parallelism
+inline uint32_t FlashSectorEraseTime(int32_t sector) {
+  uint32_t size = FlashSectorEnd(sector) - kFlashSectorBaseAddress[sector];
+  return size <= 0x4000 ? 500 : size <= 0x10000 ? 1100 : 2000;
+}
+
+// Erase time which fits in the pause after a block starting a sector:
+// the largest sector, as erased there by a raw update
+const uint32_t kSectorPauseEraseTime = 2000;
+
+template<class Flash>
+class PagePipeline {
+ public:
+  void Init(Flash* flash, uint32_t address) {
+    flash_ = flash;
+    address_ = address;
+    filling_ = 0;
+    writing_ = 0;
+    size_ = 0;
+    ready_[0] = ready_[1] = false;
+    pages_written_ = 0;
+    erased_ = address;
+    hold_ = false;
+    error_ = false;
+  }
+
+  // Holds the pages back until EraseTo() reaches their sector, instead
+  // of erasing the sectors as the pages reach them
+  void Hold() { hold_ = true; }
+
+  // Erases the sectors from the next page up to [end], as many as fit
+  // in [time] ms at worst, and releases the pages held once all are.
+  // Blocking: only in a pause of the encoder.
+  void EraseTo(uint32_t end, uint32_t time = 0xffffffff) {
+    if (end > kApplicationEndAddress) end = kApplicationEndAddress;
+    // the erase would finish the page being written behind our back
+    while (flash_->busy()) Step();
+    while (erased_ < end) {
+      int32_t sector = FlashSector(erased_);
+      if (FlashSectorEraseTime(sector) > time) return;
+      time -= FlashSectorEraseTime(sector);
+      flash_->Erase(sector);
+      erased_ = FlashSectorEnd(sector);
+    }
+    hold_ = false;
+  }
+
+  // The next page to write waits for EraseTo()
+  bool held() { return hold_ && ready_[writing_] && address_ >= erased_; }
+
+  // Room for the next packet: the page being received is not still
+  // waiting to be written
+  bool writeable() { return !ready_[filling_]; }
+
+  // Pages received and not written yet
+  bool busy() { return ready_[0] || ready_[1]; }
+
+  // Appends a packet to the page being received; true if it completes
+  // the page, which is then queued for writing
+  bool Append(const uint8_t* data, size_t size) {
+    memcpy(page() + size_, data, size);
+    return Commit(size);
+  }
+
+  // The page being received and its size, for the decompressor to
+  // write into directly
+  uint8_t* page() { return reinterpret_cast<uint8_t*>(pages_[filling_]); }
+  size_t size() { return size_; }
+
+  // Adds [size] bytes written to page(); true if they complete it
+  bool Commit(size_t size) {
+    size_ += size;
+    if (size_ < kPageSize) return false;
+    ready_[filling_] = true;
+    filling_ ^= 1;
+    size_ = 0;
+    Poll();
+    return true;
+  }
+
+  // Called from the main loop: programs a few words, or starts writing
+  // the next page
+  void Poll() {
+    if (flash_->busy() && !Step()) return;
+    if (ready_[writing_] && !error_) {
+      if (address_ + kPageSize > kApplicationEndAddress) {
+        error_ = true;
+        return;
+      }
+      if (address_ >= erased_) {
+        if (hold_) return;
+        // pages never straddle sectors
+        EraseTo(address_ + kPageSize);
+      }
+      flash_->StartFrom(address_, pages_[writing_], kPageWords);
+    }
+  }
+
+  // Blocking, before leaving the bootloader
+  void Flush() {
+    while (busy() && !hold_ && !error_) Poll();
+  }
+
+  size_t pages_written() { return pages_written_; }
+
+  // The image does not fit below kApplicationEndAddress
+  bool error() { return error_; }
+
+ private:
+  // Programs a few words of the page being written; true once it is
+  bool Step() {
+    if (!flash_->Step()) return false;
+    ready_[writing_] = false;
+    writing_ ^= 1;
+    address_ += kPageSize;
+    pages_written_++;
+    return true;
+  }
+
+  Flash* flash_;
+  uint32_t pages_[2][kPageWords];
+  uint32_t address_;            // of the page being written
+  uint8_t filling_;
+  uint8_t writing_;
+  size_t size_;                 // received in the page being filled
+  bool ready_[2];
+  size_t pages_written_;
+  uint32_t erased_;             // up to which the sectors are erased
+  bool hold_;
+  bool error_;
+};
+
+#endif
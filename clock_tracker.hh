@@ -0,0 +1,142 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech <matthias.puech@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Tracks the period and phase of an external clock from the sample
+// times of its edges. A second-order digital PLL predicts the next
+// edge; edges too far from the prediction are ignored as outliers,
+// unless they keep coming, in which case the tracker relocks.
+
+#ifndef CLOCK_TRACKER_H_
+#define CLOCK_TRACKER_H_
+
+#include "stmlib/stmlib.h"
+
+#include <cmath>
+
+// loop gains: about critically damped, settles in a few edges
+const float kClockTrackerPhaseGain = 0.25f;
+const float kClockTrackerPeriodGain = 0.0625f;
+// edges further than this from prediction (in periods) are outliers
+const float kClockTrackerOutlier = 0.25f;
+// phase error below which the loop is considered locked (in periods)
+const float kClockTrackerLockError = 0.02f;
+const uint8_t kClockTrackerRelock = 2;
+
+class ClockTracker {
+ public:
+  void Init(float default_period) {
+    period_ = default_period;
+    edges_ = 0;
+    outliers_ = 0;
+    locked_ = false;
+    last_tick_ = 0;
+    next_edge_ = 0;
+    next_edge_fraction_ = 0.0f;
+  }
+
+  /* Feeds the sample time of a new edge. Returns false if the edge
+   * was rejected as an outlier */
+  bool Tick(uint32_t time) {
+    uint32_t interval = time - last_tick_;
+    last_tick_ = time;
+
+    if (edges_ < 2) {
+      // first edges: no prediction yet
+      if (edges_++ == 1) {
+        Restart(time, static_cast<float>(interval));
+      }
+      return true;
+    }
+
+    float error = static_cast<float>(static_cast<int32_t>(time - next_edge_))
+      - next_edge_fraction_;
+
+    float missed = floorf(error / period_ + 0.5f);
+    bool outlier = fabsf(error) > kClockTrackerOutlier * period_;
+    bool skipped = missed >= 1.0f &&
+      fabsf(error - missed * period_) < kClockTrackerOutlier * period_;
+
+    if (outlier && ++outliers_ >= kClockTrackerRelock) {
+      // the tempo changed: start over from the last interval
+      Restart(time, static_cast<float>(interval));
+      return true;
+    }
+
+    if (skipped) {
+      // some edges were missed, jump over them
+      Advance(missed * period_);
+      error -= missed * period_;
+    } else if (outlier) {
+      return false;
+    } else {
+      outliers_ = 0;
+    }
+
+    locked_ = fabsf(error) < kClockTrackerLockError * period_;
+    period_ += kClockTrackerPeriodGain * error;
+    Advance(kClockTrackerPhaseGain * error + period_);
+    return true;
+  }
+
+  float period() const { return period_; }
+  bool locked() const { return locked_; }
+
+  /* Filtered estimate of the time of the last edge */
+  uint32_t last_edge() const {
+    return next_edge_ - static_cast<uint32_t>(period_ - next_edge_fraction_);
+  }
+
+  /* Sample time of the last accepted or rejected edge */
+  uint32_t last_tick() const { return last_tick_; }
+
+ private:
+  void Restart(uint32_t time, float period) {
+    period_ = period;
+    outliers_ = 0;
+    locked_ = false;
+    next_edge_ = time;
+    next_edge_fraction_ = 0.0f;
+    Advance(period_);
+  }
+
+  // moves the predicted edge forward, keeping sub-sample precision
+  void Advance(float delta) {
+    delta += next_edge_fraction_;
+    float whole = floorf(delta);
+    next_edge_ += static_cast<int32_t>(whole);
+    next_edge_fraction_ = delta - whole;
+  }
+
+  float period_;
+  uint8_t edges_;
+  uint8_t outliers_;
+  bool locked_;
+  uint32_t last_tick_;
+  uint32_t next_edge_;          // integer part of the prediction
+  float next_edge_fraction_;
+};
+
+#endif
@@ -0,0 +1,175 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Commands sent to the delay from outside the audio interrupt
+
+#ifndef COMMAND_QUEUE_H_
+#define COMMAND_QUEUE_H_
+
+#include "parameters.hh"
+#include "packed_slot.hh"
+#include "spsc_queue.hh"
+
+// Large enough for the worst-case burst of either producer between
+// two blocks (see the static_asserts in ui.cc and control.cc): a full
+// queue would drop the command
+const size_t kCommandQueueSize = 32;
+
+enum CommandType {
+  COMMAND_ADD_TAP,
+  COMMAND_REMOVE_LAST_TAP,
+  COMMAND_CLEAR,
+  COMMAND_LOAD,
+  COMMAND_LOAD_PACKED,
+  COMMAND_REPAN_TAPS,
+  COMMAND_SET_REPEAT,
+  COMMAND_TOGGLE_REPEAT,
+  COMMAND_SET_SYNC,
+  COMMAND_SET_MUTE,
+  COMMAND_CLOCK_TICK,
+};
+
+struct TapCommand {
+  float velocity;
+  EditMode edit_mode;
+  VelocityType velocity_type;
+  PanningMode panning_mode;
+};
+
+struct Command {
+  CommandType type;
+  uint32_t timestamp;           // sample clock of the event
+  uint32_t posted;              // sample clock when it was queued
+  union {
+    TapCommand tap;
+    Slot* slot;
+    const PackedSlot* packed_slot;
+    PanningMode panning_mode;
+    bool state;
+  };
+};
+
+// Each producer context (main loop, control) owns one queue; the
+// audio interrupt is the only consumer and drains all of them at the
+// beginning of a block.
+class CommandQueue {
+ public:
+  void Init(const volatile uint32_t* clock) {
+    clock_ = clock;
+    queue_.Init();
+    max_latency_ = 0;
+  }
+
+  /* Taps and clock ticks carry the sample time of the edge that
+   * caused them, which may be older than the current clock */
+  void AddTap(Parameters* params, uint32_t timestamp) {
+    Command c;
+    c.type = COMMAND_ADD_TAP;
+    c.tap.velocity = params->velocity;
+    c.tap.edit_mode = params->edit_mode;
+    c.tap.velocity_type = params->velocity_type;
+    c.tap.panning_mode = params->panning_mode;
+    Post(&c, timestamp);
+  }
+
+  void RemoveLastTap() { Post(COMMAND_REMOVE_LAST_TAP); }
+  void Clear() { Post(COMMAND_CLEAR); }
+  void AddTap(Parameters* params) { AddTap(params, *clock_); }
+
+  void ClockTick(uint32_t timestamp) {
+    Command c;
+    c.type = COMMAND_CLOCK_TICK;
+    Post(&c, timestamp);
+  }
+
+  void Load(Slot* slot) {
+    Command c;
+    c.type = COMMAND_LOAD;
+    c.slot = slot;
+    Post(&c);
+  }
+
+  void Load(const PackedSlot* slot) {
+    Command c;
+    c.type = COMMAND_LOAD_PACKED;
+    c.packed_slot = slot;
+    Post(&c);
+  }
+
+  void RepanTaps(PanningMode panning_mode) {
+    Command c;
+    c.type = COMMAND_REPAN_TAPS;
+    c.panning_mode = panning_mode;
+    Post(&c);
+  }
+
+  void set_repeat(bool state) { Post(COMMAND_SET_REPEAT, state); }
+  void set_sync(bool state) { Post(COMMAND_SET_SYNC, state); }
+  void set_mute(bool state) { Post(COMMAND_SET_MUTE, state); }
+  // toggles against the state of the delay when it is executed, so
+  // that toggles from both queues never cancel on stale state
+  void ToggleRepeat() { Post(COMMAND_TOGGLE_REPEAT); }
+
+  /* Consumer side: pops the next command, if any, and updates the
+   * queueing latency statistics */
+  bool Next(Command* c) {
+    if (!queue_.Read(c)) {
+      return false;
+    }
+    uint32_t latency = *clock_ - c->posted;
+    if (latency > max_latency_) {
+      max_latency_ = latency;
+    }
+    return true;
+  }
+
+  // statistics
+  uint32_t overflows() const { return queue_.overflows(); }
+  // samples between Post and execution, not counting the edge age
+  uint32_t max_latency() const { return max_latency_; }
+
+ private:
+  void Post(CommandType type, bool state = false) {
+    Command c;
+    c.type = type;
+    c.state = state;
+    Post(&c);
+  }
+
+  void Post(Command* c) { Post(c, *clock_); }
+
+  void Post(Command* c, uint32_t timestamp) {
+    c->timestamp = timestamp;
+    c->posted = *clock_;
+    queue_.Write(*c);
+  }
+
+  const volatile uint32_t* clock_;
+  SpscQueue<Command, kCommandQueueSize> queue_;
+  uint32_t max_latency_;
+};
+
+#endif
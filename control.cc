@@ -42,17 +42,44 @@ const float kSyncRatios[16] = {
   1.0f/8.0f, 1.0f/7.0f, 1.0f/6.0f, 1.0f/5.0f, 1.0f/4.0f, 1.0f/3.0f, 1.0f/2.0f,
   1.0f, 1.0f,
   2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 8.0f, 16.0f };
+// longest delay between the onset of an edge and its detection as a tap
+const uint32_t kMaxEdgeAge = SAMPLE_RATE / 16;
+// per block: a clock tick at most every other frame, a tap, a repeat
+// toggle
+static_assert(kBlockSize / kAdcDecimation / 2 + 2 <= kCommandQueueSize,
+              "control commands could overflow the command queue");
+// CV range within a block above which it is streamed at audio rate
+const float kCvStreamThreshold = 0.01f;
+// how long a CV keeps streaming after it stopped moving (in blocks)
+const uint32_t kCvStreamHold = SAMPLE_RATE / kBlockSize / 2;
+// crossfade between the block-rate value and the stream when it starts
+// or stops, so that the smoothing of the block-rate value (e.g. the
+// averaging and hysteresis of the scale) does not make it jump
+const float kCvStreamFade = 1.0f / (SAMPLE_RATE / kBlockSize / 20);
+
+const AdcChannel kStreamPots[CV_STREAM_LAST] = {
+  ADC_SCALE_POT, ADC_FEEDBACK_POT, ADC_DRYWET_POT };
+const AdcChannel kStreamCvs[CV_STREAM_LAST] = {
+  ADC_SCALE_CV, ADC_FEEDBACK_CV, ADC_DRYWET_CV };
 
 void Control::Init(MultitapDelay* delay, CalibrationData* calibration_data) {
   delay_ = delay;
   calibration_data_ = calibration_data;
   adc_.Init();
+  trigger_index_ = adc_.write_index();
   gate_input_.Init();
-  for (size_t i = 0; i < ADC_CHANNEL_LAST; ++i) {
-    average_[i].Init();
-  }
+  average_.Init();
+  average_taptrig_.Init();
   fsr_filter_.Init();
   fsr_filter_.set_f<FREQUENCY_FAST>(0.01f);
+  taptrig_edge_.Init(0.02f, kMaxEdgeAge);
+  fsr_edge_.Init(0.01f, kMaxEdgeAge);
+  for (size_t c = 0; c < CV_STREAM_LAST; c++) {
+    stream_hold_[c] = 0;
+    stream_last_[c] = 0.0f;
+    stream_mix_[c] = 0.0f;
+    stream_block_[c] = 0.0f;
+  }
   average_scale_.Init();
   average_sync_ratio_.Init();
   scale_lp_ = 1.0f;
@@ -65,8 +92,12 @@ void Control::Calibrate() {
   float offset_value[ADC_CHANNEL_LAST] = {0};
 
   for (int c=0; c<kCalibrationCycles; c++) {
-    adc_.Convert();
-    adc_.Wait();
+    // this runs before the codec and the control task are started:
+    // wait for a block's worth of frames and decimate them here
+    size_t start = adc_.write_index();
+    while ((adc_.write_index() + kAdcRingSize - start) % kAdcRingSize <
+           kBlockSize / kAdcDecimation) { }
+    adc_.Process();
     for(size_t i=0; i<ADC_CHANNEL_LAST; i++) {
       offset_value[i] += adc_.float_value(i);
     }
@@ -83,11 +114,143 @@ inline float CropDeadZone(float x) {
   return x;
 }
 
+// flat zone at noon
+inline float ScaleNotch(float x) {
+  if (x < 1.0f - kScalePotNotchSize) {
+    x += kScalePotNotchSize;
+  } else if (x > 1.0f + kScalePotNotchSize) {
+    x -= kScalePotNotchSize;
+  } else {
+    x = 1.0f;
+  }
+  return x;
+}
+
+/* Same laws as the block-rate parameters, minus the smoothing */
+inline float StreamLaw(size_t channel, float x) {
+  x = CropDeadZone(x);
+  switch (channel) {
+  case CV_STREAM_SCALE:
+    return ScaleNotch(x * x * 4.0f);
+  case CV_STREAM_FEEDBACK:
+    return x * 1.4f;
+  default:
+    return x;
+  }
+}
+
+/* Scans the frames acquired since the last call, posting clock ticks,
+ * remembering tap onsets with the sample time at which they happened,
+ * and keeping the modulation CVs for the stream */
+void Control::ReadFrames() {
+  uint32_t now = delay_->clock();
+  size_t write_index = adc_.write_index();
+  size_t age = (write_index + kAdcRingSize - trigger_index_) % kAdcRingSize;
+  stream_size_ = 0;
+
+  while (trigger_index_ != write_index) {
+    age--;
+    uint32_t time = now - age * kAdcDecimation;
+
+    // clock
+    float clock = adc_.frame_value(trigger_index_, ADC_CLOCK_CV);
+    if (clock > 0.2f && clock_armed_) {
+      delay_->control_commands_.ClockTick(time);
+      clock_armed_ = false;
+    }
+
+    if (clock < 0.1f) {
+      clock_armed_ = true;
+    }
+
+    // tap onsets
+    taptrig_edge_.Process(adc_.frame_value(trigger_index_, ADC_TAPTRIG_CV), time);
+    fsr_edge_.Process(adc_.frame_value(trigger_index_, ADC_FSR_CV), time);
+
+    // modulation CVs
+    for (size_t c = 0; c < CV_STREAM_LAST; c++) {
+      size_t i = kStreamCvs[c];
+      stream_frames_[c][stream_size_] =
+        (calibration_data_->offset[i-ADC_SCALE_CV] -
+         adc_.frame_value(trigger_index_, i)) * 1.05f;
+    }
+    stream_size_++;
 
-void Control::Read(Parameters* parameters, bool sequencer_mode) {
+    trigger_index_ = (trigger_index_ + 1) % kAdcRingSize;
+  }
+}
+
+/* Upsamples the CV frames of the last block to one value per sample,
+ * for the CVs that move, crossfaded with the block-rate [parameters]
+ * when the stream starts or stops */
+void Control::WriteStream(CvStream* stream, const Parameters* parameters) {
+  size_t n = stream_size_;
+  const float block[CV_STREAM_LAST] = {
+    parameters->scale, parameters->feedback, parameters->drywet };
+
+  for (size_t c = 0; c < CV_STREAM_LAST; c++) {
+    float* frames = stream_frames_[c];
+    float block_start = stream_block_[c];
+    stream_block_[c] = block[c];
+    if (n == 0) {
+      stream->active[c] = false;
+      stream_mix_[c] = 0.0f;
+      continue;
+    }
+
+    float minimum = frames[0], maximum = frames[0];
+    float pot = average_.value(kStreamPots[c]);
+    for (size_t k = 0; k < n; k++) {
+      if (frames[k] < minimum) minimum = frames[k];
+      if (frames[k] > maximum) maximum = frames[k];
+      frames[k] = StreamLaw(c, pot + frames[k]);
+    }
+
+    if (maximum - minimum > kCvStreamThreshold) {
+      stream_hold_[c] = kCvStreamHold;
+    } else if (stream_hold_[c]) {
+      stream_hold_[c]--;
+    }
+
+    float mix_start = stream_mix_[c];
+    float mix_end = stream_hold_[c] > 0 ?
+      std::min(mix_start + kCvStreamFade, 1.0f) :
+      std::max(mix_start - kCvStreamFade, 0.0f);
+    stream_mix_[c] = mix_end;
+    stream->active[c] = mix_start > 0.0f || mix_end > 0.0f;
+
+    if (stream->active[c]) {
+      // frame k falls at the end of the (k+1)-th nth of the block
+      float* out = stream->values[c];
+      float step = static_cast<float>(n) / kBlockSize;
+      float x = 0.0f;
+      // the block-rate value ramps like the delay would ramp it
+      float value = block_start;
+      float value_increment = (block[c] - block_start) / kBlockSize;
+      float mix = mix_start;
+      float mix_increment = (mix_end - mix_start) / kBlockSize;
+      for (size_t i = 0; i < kBlockSize; i++) {
+        x += step;
+        size_t k = static_cast<size_t>(x);
+        float a = k ? frames[k-1] : stream_last_[c];
+        float b = k < n ? frames[k] : frames[n-1];
+        value += value_increment;
+        mix += mix_increment;
+        out[i] = value + (a + (b - a) * (x - k) - value) * mix;
+      }
+    }
+    stream_last_[c] = frames[n-1];
+  }
+}
+
+void Control::Read(Parameters* parameters, CvStream* stream,
+                   bool sequencer_mode) {
 
   float scaled_values[ADC_CHANNEL_LAST];
 
+  adc_.Process();
+  ReadFrames();
+
   /* 1. Apply pot laws */
   float val;
 
@@ -137,25 +300,22 @@ void Control::Read(Parameters* parameters, bool sequencer_mode) {
 
   /* 3. Filter pots and CVs */
 
-  for (size_t i=0; i<ADC_CHANNEL_LAST; i++) {
-    float value = scaled_values[i];
-    average_[i].Process(value);
-  }
+  average_.Process(scaled_values);
 
   average_sync_ratio_.Process(scaled_sync_ratio);
 
   /* 4. Add CV and pot, constrain, and write to parameters */
 
   // gain
-  val = average_[ADC_GAIN_POT].value();
+  val = average_.value(ADC_GAIN_POT);
   val = CropDeadZone(val);
   val *= 3.0f;
   parameters->gain = val;
 
   // scale
   val =
-    average_[ADC_SCALE_POT].value() +
-    average_[ADC_SCALE_CV].value();
+    average_.value(ADC_SCALE_POT) +
+    average_.value(ADC_SCALE_CV);
   val = CropDeadZone(val);
   val *= val;
   val *= 4.0f;
@@ -166,15 +326,7 @@ void Control::Read(Parameters* parameters, bool sequencer_mode) {
     scale_hy_ = val + kScaleHysteresis;
   }
   val = scale_hy_;
-
-  // flat zone at noon
-  if (val < 1.0f - kScalePotNotchSize) {
-    val += kScalePotNotchSize;
-  } else if (val > 1.0f + kScalePotNotchSize) {
-    val -= kScalePotNotchSize;
-  } else {
-    val = 1.0f;
-  }
+  val = ScaleNotch(val);
 
   average_scale_.Process(val);
   val = average_scale_.value();
@@ -184,16 +336,16 @@ void Control::Read(Parameters* parameters, bool sequencer_mode) {
 
   // feedback
   val =
-    average_[ADC_FEEDBACK_POT].value() +
-    average_[ADC_FEEDBACK_CV].value();
+    average_.value(ADC_FEEDBACK_POT) +
+    average_.value(ADC_FEEDBACK_CV);
   val = CropDeadZone(val);
   val *= 1.4f;
   parameters->feedback = val;
 
   // modulation
   val =
-    average_[ADC_MODULATION_POT].value() +
-    average_[ADC_MODULATION_CV].value();
+    average_.value(ADC_MODULATION_POT) +
+    average_.value(ADC_MODULATION_CV);
   val = CropDeadZone(val);
   float amount = val;
   amount *= amount * amount;
@@ -209,40 +361,30 @@ void Control::Read(Parameters* parameters, bool sequencer_mode) {
 
   // drywet
   val =
-    average_[ADC_DRYWET_POT].value() +
-    average_[ADC_DRYWET_CV].value();
+    average_.value(ADC_DRYWET_POT) +
+    average_.value(ADC_DRYWET_CV);
   val = CropDeadZone(val);
   parameters->drywet = val;
 
   // morph
-  val = average_[ADC_MORPH_POT].value();
+  val = average_.value(ADC_MORPH_POT);
   val = CropDeadZone(val);
   val = (val + 0.1f) / 1.1f;
   val = val * val * val * val;
   val *= 600000.0f;
   parameters->morph = val;
 
-  // clock
-  float clock = scaled_values[ADC_CLOCK_CV];
-  if (clock > 0.2f && clock_armed_) {
-    delay_->ClockTick();
-    clock_armed_ = false;
-  }
-
-  if (clock < 0.1f) {
-    clock_armed_ = true;
-  }
-
   // clock ratio
   val =
     average_sync_ratio_.value() +
-    average_[ADC_SCALE_CV].value();
+    average_.value(ADC_SCALE_CV);
   val = CropDeadZone(val);
   val = val * 15.0f + 0.5f;
   parameters->sync_ratio = kSyncRatios[static_cast<int>(val)];
 
   // tap & velocity
   bool tap = false;
+  uint32_t tap_time = delay_->clock();
 
   // from external source:
   average_taptrig_.Process(scaled_values[ADC_TAPTRIG_CV]);
@@ -255,6 +397,7 @@ void Control::Read(Parameters* parameters, bool sequencer_mode) {
       taptrig_armed_) {
     tap = true;
     parameters->velocity = scaled_values[ADC_VEL_CV];
+    tap_time = taptrig_edge_.Consume(tap_time);
     taptrig_armed_ = false;
     taptrig_counter_ = 0;
   }
@@ -266,11 +409,12 @@ void Control::Read(Parameters* parameters, bool sequencer_mode) {
   }
 
   // from FSR:
-  float fsr_deriv = fsr_filter_.Process<FILTER_MODE_HIGH_PASS>(average_[ADC_FSR_CV].value());
+  float fsr_deriv = fsr_filter_.Process<FILTER_MODE_HIGH_PASS>(average_.value(ADC_FSR_CV));
 
   if (fsr_deriv > 0.01f && tapfsr_armed_) {
     tap = true;
     tapfsr_armed_ = false;
+    tap_time = fsr_edge_.Consume(tap_time);
     parameters->velocity = sequencer_mode ?
       0.6f - scaled_values[ADC_FSR_CV] :
       scaled_values[ADC_FSR_CV];
@@ -288,7 +432,7 @@ void Control::Read(Parameters* parameters, bool sequencer_mode) {
       val *= 300000.0f;
       delay_->sequencer_step(val + parameters->morph);
     } else {
-      delay_->AddTap(parameters);
+      delay_->control_commands_.AddTap(parameters, tap_time);
     }
   }
 
@@ -297,11 +441,12 @@ void Control::Read(Parameters* parameters, bool sequencer_mode) {
   // repeat
   if (gate_input_.rising_edge(GATE_INPUT_REPEAT) ||
       gate_input_.falling_edge(GATE_INPUT_REPEAT)) {
-    delay_->set_repeat(!delay_->repeat());
+    delay_->control_commands_.ToggleRepeat();
   }
 
   ///////////
 
   gate_input_.Read();
-  adc_.Convert();
+
+  WriteStream(stream, parameters);
 }
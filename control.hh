@@ -31,7 +31,8 @@
 
 #include "stmlib/stmlib.h"
 #include "stmlib/dsp/filter.h"
-#include "average.hh"
+#include "cv_filter_bank.hh"
+#include "edge_detector.hh"
 
 #include "drivers/adc.hh"
 #include "drivers/gate_input.hh"
@@ -44,27 +45,39 @@ using namespace stmlib;
 class Control {
  public:
   void Init(MultitapDelay* delay, CalibrationData* calibration_data);
-  void Read(Parameters* parameters, bool sequencer_mode);
+  void Read(Parameters* parameters, CvStream* stream, bool sequencer_mode);
   void Calibrate();
 
  private:
+  void ReadFrames();
+  void WriteStream(CvStream* stream, const Parameters* parameters);
 
   Adc adc_;
   GateInput gate_input_;
+  size_t trigger_index_;
   MultitapDelay* delay_;
   CalibrationData* calibration_data_;
 
-  FAverage<32> average_[ADC_CHANNEL_LAST];
-  FAverage<8> average_taptrig_;
-  FAverage<256> average_scale_;
-  FAverage<64> average_sync_ratio_;
+  CvFilterBank<ADC_CHANNEL_LAST, 32, 14> average_;
+  CvFilterBank<1, 8, 14> average_taptrig_;
+  CvFilterBank<1, 256, 12> average_scale_; // up to ~4
+  CvFilterBank<1, 64, 14> average_sync_ratio_;
   float scale_hy_, scale_lp_;
   OnePole fsr_filter_;
+  EdgeDetector taptrig_edge_;
+  EdgeDetector fsr_edge_;
   float previous_taptrig_;
   bool taptrig_armed_;
   uint32_t taptrig_counter_;
   bool tapfsr_armed_;
   bool clock_armed_;
+  // modulation CVs of the last block, for the stream
+  float stream_frames_[CV_STREAM_LAST][kAdcRingSize];
+  size_t stream_size_;
+  float stream_last_[CV_STREAM_LAST];
+  uint32_t stream_hold_[CV_STREAM_LAST];
+  float stream_mix_[CV_STREAM_LAST];   // 0: block-rate value, 1: stream
+  float stream_block_[CV_STREAM_LAST]; // block-rate value of the last block
   float freq_lp_;
   float amount_lp_;
 };
@@ -0,0 +1,94 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Lock-free double buffer to publish snapshots of a structure
+
+#ifndef DOUBLE_BUFFER_H_
+#define DOUBLE_BUFFER_H_
+
+#include "stmlib/stmlib.h"
+#include "spsc_queue.hh"
+
+// The writer fills the back buffer and then flips the sequence number,
+// which selects the front buffer. The reader retries if a write
+// completed while it was copying (seqlock), which cannot happen when
+// the reader has the higher priority.
+template<typename T>
+class DoubleBuffer {
+ public:
+  void Init(const T& value) {
+    buffers_[0] = value;
+    buffers_[1] = value;
+    sequence_ = 0;
+  }
+
+  void Write(const T& value) {
+    uint32_t s = sequence_;
+    buffers_[(s + 1) & 1] = value;
+    SPSC_BARRIER();
+    sequence_ = s + 1;
+  }
+
+  /* Returns the sequence number of the snapshot */
+  uint32_t Read(T* value) const {
+    uint32_t s;
+    do {
+      s = sequence_;
+      *value = buffers_[s & 1];
+      SPSC_BARRIER();
+    } while (s != sequence_);
+    return s;
+  }
+
+ private:
+  T buffers_[2];
+  volatile uint32_t sequence_;
+};
+
+// For snapshots too large to copy in the reader: the writer fills the
+// back buffer in place and publishes it by swapping the index, and the
+// reader uses the front buffer where it is. The reader must have the
+// higher priority and be done with the front buffer before the writer
+// resumes, which is the case of the codec interrupt and the control
+// task. Both buffers start zeroed, as globals.
+template<typename T>
+class SwapBuffer {
+ public:
+  T* back() { return &buffers_[front_ ^ 1]; }
+
+  void Publish() {
+    SPSC_BARRIER();
+    front_ ^= 1;
+  }
+
+  const T* front() const { return &buffers_[front_]; }
+
+ private:
+  T buffers_[2];
+  volatile uint32_t front_;
+};
+
+#endif
@@ -24,7 +24,10 @@
 //
 // -----------------------------------------------------------------------------
 //
-// Driver for ADC.
+// Driver for ADC. Pots and CVs are scanned continuously by ADC1 and
+// ADC3, triggered by TIM2, and DMA writes the frames into two circular
+// buffers. Process() averages the frames acquired since its last call
+// (decimation by one block).
 
 #ifndef ADC_H_
 #define ADC_H_
@@ -56,9 +59,20 @@ enum AdcChannel {
   ADC_CHANNEL_LAST
 };
 
+const size_t kNumPots = ADC_SCALE_CV;
+const size_t kNumCvs = ADC_CHANNEL_LAST - ADC_SCALE_CV;
+
+// one frame every kAdcDecimation audio samples
+const uint32_t kAdcDecimation = 4;
+const uint32_t kAdcSampleRate = SAMPLE_RATE / kAdcDecimation;
+const size_t kAdcRingSize = 64; // frames
+
 class Adc {
 public:
   void Deinit(void) {
+    TIM_Cmd(TIM2, DISABLE);
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM2, DISABLE);
+
     ADC_Cmd(ADC3, DISABLE);
     ADC_DMACmd(ADC3, DISABLE);
     ADC_DMARequestAfterLastTransferCmd(ADC3, DISABLE);
@@ -86,6 +100,7 @@ public:
                            RCC_AHB1Periph_GPIOF, ENABLE);
     RCC_APB2PeriphClockCmd(RCC_APB2Periph_ADC1 |
                            RCC_APB2Periph_ADC3, ENABLE);
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM2, ENABLE);
 
     // Configure analog input pins
     GPIO_InitTypeDef gpio_init;
@@ -107,7 +122,7 @@ public:
     gpio_init.GPIO_Pin = GPIO_Pin_6 | GPIO_Pin_7 | GPIO_Pin_8 | GPIO_Pin_9 | GPIO_Pin_10; //Channel 4, 5, 6, 7, 8
     GPIO_Init(GPIOF, &gpio_init);
 
-    // Use DMA to automatically copy ADC data register to values_ buffer.
+    // Use DMA to copy each scan of the ADC data registers into the rings.
     DMA_InitTypeDef dma_init;
 
     dma_init.DMA_DIR = DMA_DIR_PeripheralToMemory;
@@ -124,17 +139,17 @@ public:
 
     // DMA2 Stream 4 Channel 0 for pots
     dma_init.DMA_Channel = DMA_Channel_0;
-    dma_init.DMA_PeripheralBaseAddr = (uint32_t)&ADC1->DR;
-    dma_init.DMA_Memory0BaseAddr = (uint32_t)&values_[0];
-    dma_init.DMA_BufferSize = 6;
+    dma_init.DMA_PeripheralBaseAddr = reinterpret_cast<uintptr_t>(&ADC1->DR);
+    dma_init.DMA_Memory0BaseAddr = reinterpret_cast<uintptr_t>(&pots_[0][0]);
+    dma_init.DMA_BufferSize = kAdcRingSize * kNumPots;
 
     DMA_Init(DMA2_Stream4, &dma_init);
     DMA_Cmd(DMA2_Stream4, ENABLE);
 
     // DMA2 Stream 0 Channel 2 for CVs
-    dma_init.DMA_PeripheralBaseAddr = (uint32_t)&ADC3->DR;
-    dma_init.DMA_Memory0BaseAddr = (uint32_t)&values_[ADC_SCALE_CV];
-    dma_init.DMA_BufferSize = 8;
+    dma_init.DMA_PeripheralBaseAddr = reinterpret_cast<uintptr_t>(&ADC3->DR);
+    dma_init.DMA_Memory0BaseAddr = reinterpret_cast<uintptr_t>(&cvs_[0][0]);
+    dma_init.DMA_BufferSize = kAdcRingSize * kNumCvs;
     dma_init.DMA_Channel = DMA_Channel_2;
 
     DMA_Init(DMA2_Stream0, &dma_init);
@@ -148,40 +163,41 @@ public:
     adc_common_init.ADC_TwoSamplingDelay = ADC_TwoSamplingDelay_20Cycles;
     ADC_CommonInit(&adc_common_init);
 
-    // ADC init
+    // ADC init: one scan per TIM2 update
     ADC_InitTypeDef adc_init;
     adc_init.ADC_Resolution = ADC_Resolution_12b;
     adc_init.ADC_ScanConvMode = ENABLE;
     adc_init.ADC_ContinuousConvMode = DISABLE;
-    adc_init.ADC_ExternalTrigConvEdge = ADC_ExternalTrigConvEdge_None;
-    adc_init.ADC_ExternalTrigConv = ADC_ExternalTrigConv_T1_CC1;
+    adc_init.ADC_ExternalTrigConvEdge = ADC_ExternalTrigConvEdge_Rising;
+    adc_init.ADC_ExternalTrigConv = ADC_ExternalTrigConv_T2_TRGO;
     adc_init.ADC_DataAlign = ADC_DataAlign_Left;
 
     // ADC1 for pots
-    adc_init.ADC_NbrOfConversion = 6;
+    adc_init.ADC_NbrOfConversion = kNumPots;
     ADC_Init(ADC1, &adc_init);
 
     // ADC3 for CVs
-    adc_init.ADC_NbrOfConversion = 8;
+    adc_init.ADC_NbrOfConversion = kNumCvs;
     ADC_Init(ADC3, &adc_init);
 
+    // 8 conversions of (84+12) cycles at 11.25MHz fit in one frame
     // ADC1 channel configuration (pots)
-    ADC_RegularChannelConfig(ADC1, ADC_Channel_11, ADC_MORPH_POT+1, ADC_SampleTime_480Cycles); //PC1
-    ADC_RegularChannelConfig(ADC1, ADC_Channel_12, ADC_DRYWET_POT+1, ADC_SampleTime_480Cycles); //PC2
-    ADC_RegularChannelConfig(ADC1, ADC_Channel_13, ADC_MODULATION_POT+1, ADC_SampleTime_480Cycles); //PC3
-    ADC_RegularChannelConfig(ADC1, ADC_Channel_14, ADC_GAIN_POT+1, ADC_SampleTime_480Cycles); //PC4
-    ADC_RegularChannelConfig(ADC1, ADC_Channel_6, ADC_FEEDBACK_POT+1, ADC_SampleTime_480Cycles); //PA6
-    ADC_RegularChannelConfig(ADC1, ADC_Channel_7, ADC_SCALE_POT+1, ADC_SampleTime_480Cycles); //PA7
+    ADC_RegularChannelConfig(ADC1, ADC_Channel_11, ADC_MORPH_POT+1, ADC_SampleTime_84Cycles); //PC1
+    ADC_RegularChannelConfig(ADC1, ADC_Channel_12, ADC_DRYWET_POT+1, ADC_SampleTime_84Cycles); //PC2
+    ADC_RegularChannelConfig(ADC1, ADC_Channel_13, ADC_MODULATION_POT+1, ADC_SampleTime_84Cycles); //PC3
+    ADC_RegularChannelConfig(ADC1, ADC_Channel_14, ADC_GAIN_POT+1, ADC_SampleTime_84Cycles); //PC4
+    ADC_RegularChannelConfig(ADC1, ADC_Channel_6, ADC_FEEDBACK_POT+1, ADC_SampleTime_84Cycles); //PA6
+    ADC_RegularChannelConfig(ADC1, ADC_Channel_7, ADC_SCALE_POT+1, ADC_SampleTime_84Cycles); //PA7
 
     // ADC3 channel configuration (CVs)
-    ADC_RegularChannelConfig(ADC3, ADC_Channel_8, ADC_SCALE_CV-5, ADC_SampleTime_480Cycles); //PF10
-    ADC_RegularChannelConfig(ADC3, ADC_Channel_7, ADC_FEEDBACK_CV-5, ADC_SampleTime_480Cycles); //PF9
-    ADC_RegularChannelConfig(ADC3, ADC_Channel_6, ADC_MODULATION_CV-5, ADC_SampleTime_480Cycles); //PF8
-    ADC_RegularChannelConfig(ADC3, ADC_Channel_5, ADC_DRYWET_CV-5, ADC_SampleTime_480Cycles); //PF7
-    ADC_RegularChannelConfig(ADC3, ADC_Channel_1, ADC_CLOCK_CV-5, ADC_SampleTime_480Cycles); //PA1
-    ADC_RegularChannelConfig(ADC3, ADC_Channel_3, ADC_FSR_CV-5, ADC_SampleTime_480Cycles); //PA3
-    ADC_RegularChannelConfig(ADC3, ADC_Channel_4, ADC_VEL_CV-5, ADC_SampleTime_480Cycles); //PF6
-    ADC_RegularChannelConfig(ADC3, ADC_Channel_2, ADC_TAPTRIG_CV-5, ADC_SampleTime_480Cycles); //PA2
+    ADC_RegularChannelConfig(ADC3, ADC_Channel_8, ADC_SCALE_CV-5, ADC_SampleTime_84Cycles); //PF10
+    ADC_RegularChannelConfig(ADC3, ADC_Channel_7, ADC_FEEDBACK_CV-5, ADC_SampleTime_84Cycles); //PF9
+    ADC_RegularChannelConfig(ADC3, ADC_Channel_6, ADC_MODULATION_CV-5, ADC_SampleTime_84Cycles); //PF8
+    ADC_RegularChannelConfig(ADC3, ADC_Channel_5, ADC_DRYWET_CV-5, ADC_SampleTime_84Cycles); //PF7
+    ADC_RegularChannelConfig(ADC3, ADC_Channel_1, ADC_CLOCK_CV-5, ADC_SampleTime_84Cycles); //PA1
+    ADC_RegularChannelConfig(ADC3, ADC_Channel_3, ADC_FSR_CV-5, ADC_SampleTime_84Cycles); //PA3
+    ADC_RegularChannelConfig(ADC3, ADC_Channel_4, ADC_VEL_CV-5, ADC_SampleTime_84Cycles); //PF6
+    ADC_RegularChannelConfig(ADC3, ADC_Channel_2, ADC_TAPTRIG_CV-5, ADC_SampleTime_84Cycles); //PA2
 
     ADC_DMARequestAfterLastTransferCmd(ADC1, ENABLE);
     ADC_DMACmd(ADC1, ENABLE);
@@ -191,15 +207,32 @@ public:
     ADC_DMACmd(ADC3, ENABLE);
     ADC_Cmd(ADC3, ENABLE);
 
-    Convert();
+    // TIM2 (clocked at F_CPU/2) triggers the scans
+    TIM_TimeBaseInitTypeDef timer_init;
+    TIM_TimeBaseStructInit(&timer_init);
+    timer_init.TIM_Period = F_CPU / 2 / kAdcSampleRate - 1;
+    timer_init.TIM_Prescaler = 0;
+    timer_init.TIM_ClockDivision = TIM_CKD_DIV1;
+    timer_init.TIM_CounterMode = TIM_CounterMode_Up;
+    TIM_TimeBaseInit(TIM2, &timer_init);
+    TIM_SelectOutputTrigger(TIM2, TIM_TRGOSource_Update);
+    TIM_Cmd(TIM2, ENABLE);
 
     for(int i=0; i<1000000; i++) {
       __asm("nop");
 
     }
+
+    pots_read_ = 0;
+    cvs_read_ = 0;
+    for (size_t i = 0; i < ADC_CHANNEL_LAST; i++) {
+      values_[i] = 0.0f;
+    }
+    Process();
   }
 
   inline void DeInit() {
+    TIM_Cmd(TIM2, DISABLE);
     DMA_Cmd(DMA2_Stream0, DISABLE);
     DMA_Cmd(DMA2_Stream4, DISABLE);
     ADC_DMARequestAfterLastTransferCmd(ADC1, DISABLE);
@@ -211,25 +244,74 @@ public:
     ADC_DeInit();
   }
 
-  inline void Convert() {
-    ADC_SoftwareStartConv(ADC1);
-    ADC_SoftwareStartConv(ADC3);
+  /* Averages the frames acquired since the last call */
+  inline void Process() {
+    Decimate(&pots_[0][0], kNumPots, &pots_read_,
+             WriteIndex(DMA2_Stream4, kNumPots), &values_[0]);
+    Decimate(&cvs_[0][0], kNumCvs, &cvs_read_,
+             WriteIndex(DMA2_Stream0, kNumCvs), &values_[ADC_SCALE_CV]);
   }
 
-  inline void Wait() {
-   while (ADC_GetSoftwareStartConvStatus(ADC1) != RESET);
-   while (ADC_GetSoftwareStartConvStatus(ADC3) != RESET);
+  /* Index of the CV frame being written by the DMA */
+  inline size_t write_index() const {
+    return WriteIndex(DMA2_Stream0, kNumCvs);
   }
 
+  /* Raw CV value in a given frame of the ring */
+  inline float frame_value(size_t frame, uint8_t channel) const {
+    return static_cast<float>(cvs_[frame][channel - ADC_SCALE_CV]) / 65536.0f;
+  }
+
+  /* Last acquired raw value */
   inline uint16_t value(uint8_t channel) const {
-    return values_[channel];
+    if (channel < ADC_SCALE_CV) {
+      size_t frame = (WriteIndex(DMA2_Stream4, kNumPots) + kAdcRingSize - 1) % kAdcRingSize;
+      return pots_[frame][channel];
+    } else {
+      size_t frame = (write_index() + kAdcRingSize - 1) % kAdcRingSize;
+      return cvs_[frame][channel - ADC_SCALE_CV];
+    }
   }
+
+  /* Value averaged by the last call to Process() */
   inline float float_value(uint8_t channel) const {
-    return static_cast<float>(values_[channel]) / 65536.0f;
+    return values_[channel];
   }
 
  private:
-  uint16_t values_[ADC_CHANNEL_LAST];
+  static inline size_t WriteIndex(DMA_Stream_TypeDef* stream, size_t channels) {
+    size_t remaining = DMA_GetCurrDataCounter(stream);
+    return (kAdcRingSize * channels - remaining) / channels;
+  }
+
+  // boxcar over the new frames, all channels in one pass
+  static inline void Decimate(const volatile uint16_t* ring, size_t channels,
+                              size_t* read_index, size_t write_index,
+                              float* out) {
+    uint32_t sum[kNumCvs] = { 0 };
+    size_t count = 0;
+    for (size_t r = *read_index; r != write_index; r = (r + 1) % kAdcRingSize) {
+      const volatile uint16_t* frame = ring + r * channels;
+      for (size_t c = 0; c < channels; c++) {
+        sum[c] += frame[c];
+      }
+      count++;
+    }
+    *read_index = write_index;
+
+    if (count) {
+      float scale = 1.0f / (65536.0f * count);
+      for (size_t c = 0; c < channels; c++) {
+        out[c] = static_cast<float>(sum[c]) * scale;
+      }
+    }
+  }
+
+  volatile uint16_t pots_[kAdcRingSize][kNumPots];
+  volatile uint16_t cvs_[kAdcRingSize][kNumCvs];
+  size_t pots_read_;
+  size_t cvs_read_;
+  float values_[ADC_CHANNEL_LAST];
 };
 
 #endif
@@ -238,8 +238,12 @@ bool Codec::InitControlInterface(void)
 
   // Set codec pin
 	CODEC_RESET_HIGH;
-	DELAY_MS(2);
 
+	return true;
+}
+
+bool Codec::ConfigureRegisters(void)
+{
   // Set codec registers
   //Control Port Enable and Power Down Enable  
 	ASSERT(WriteRegister(CS4271_REG_MODECTRL2, CPEN | PDN));
@@ -369,16 +373,28 @@ void InitAudioDMA(void) {
   DMA_Cmd(AUDIO_I2S_EXT_DMA_STREAM, ENABLE);
 }
 
-bool Codec::Init(int32_t sample_rate, FillBufferCallback cb) {
+bool Codec::InitClock(int32_t sample_rate) {
+  InitGPIO();
+  InitAudioInterface(sample_rate);
+  ASSERT(InitControlInterface());
+
+  return true;
+}
+
+bool Codec::Start(FillBufferCallback cb) {
   callback_ = cb;
   instance_ = this;
 
-  InitGPIO();
-  InitAudioInterface(sample_rate);
   InitAudioDMA();
-  ASSERT(InitControlInterface());
+  ASSERT(ConfigureRegisters());
 
   return true;
+}
+
+bool Codec::Init(int32_t sample_rate, FillBufferCallback cb) {
+  ASSERT(InitClock(sample_rate));
+  DELAY_MS(2);
+  return Start(cb);
 };
 
 void Codec::Stop() {
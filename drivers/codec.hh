@@ -135,6 +135,11 @@ class Codec {
 
 public:
   bool Init(int32_t sample_rate, FillBufferCallback cb);
+  // Init() in two steps: the clocks and the codec's reset are
+  // released first, so that the codec settles (at least 2ms) while
+  // the rest boots, then Start() configures it and starts the DMA
+  bool InitClock(int32_t sample_rate);
+  bool Start(FillBufferCallback cb);
   void Stop();
 
   static Codec* instance_;
@@ -143,6 +148,7 @@ public:
 private:
   void InitGPIO();
   bool InitControlInterface();
+  bool ConfigureRegisters();
 
   FillBufferCallback callback_;
 
@@ -0,0 +1,133 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech <matthias.puech@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+//
+// Asynchronous flash writer. A write job is staged in RAM and
+// programmed a few words at a time from the main loop, so that the
+// flash bus is never stalled for more than a word program (~16us)
+// while the codec interrupt is running from it. Sector erases stall
+// it for a whole second, so they are never part of a job: Erase()
+// blocks, and is only called when the codec interrupt can be stalled:
+// before it is started, with the output muted, or in a pause of the
+// bootloader's signal.
+
+#ifndef FLASH_WRITER_H_
+#define FLASH_WRITER_H_
+
+#include "stmlib/stmlib.h"
+
+#include <stm32f4xx_conf.h>
+
+const uint32_t kFlashSectorSize = 0x20000; // sectors 5 to 11
+const size_t kFlashWriterBufferWords = 1024;
+const size_t kFlashWriterWordsPerStep = 8;
+
+inline uint32_t FlashSectorAddress(uint32_t sector) {
+  return 0x08020000 + (sector - 5) * kFlashSectorSize;
+}
+
+class FlashWriter {
+ public:
+  void Init() {
+    busy_ = false;
+  }
+
+  bool busy() { return busy_; }
+
+  // Flash geometry and read access, shared with the host simulator
+  const uint32_t* words(uint32_t address) {
+    return reinterpret_cast<const uint32_t*>(address);
+  }
+  uint32_t sector_address(uint32_t sector) {
+    return FlashSectorAddress(sector);
+  }
+  uint32_t sector_size(uint32_t sector) { return kFlashSectorSize; }
+
+  // Staging area for the next job; only valid while !busy()
+  uint32_t* buffer() { return buffer_; }
+
+  // Programs [size] words from the staging area at [address], which
+  // must be erased
+  void Start(uint32_t address, size_t size) {
+    StartFrom(address, buffer_, size);
+  }
+
+  // Same, from [source], which must stay valid until the job completes
+  void StartFrom(uint32_t address, const uint32_t* source, size_t size) {
+    address_ = address;
+    source_ = source;
+    size_ = size;
+    written_ = 0;
+    busy_ = true;
+    FLASH_Unlock();
+    FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR |
+                    FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+  }
+
+  // Called from the main loop; returns true when a job has completed
+  bool Step() {
+    if (!busy_) return false;
+
+    size_t end = written_ + kFlashWriterWordsPerStep;
+    if (end > size_) end = size_;
+    while (written_ < end) {
+      FLASH_ProgramWord(address_ + written_ * 4, source_[written_]);
+      written_++;
+    }
+
+    if (written_ < size_) return false;
+
+    FLASH_Lock();
+    busy_ = false;
+    return true;
+  }
+
+  // Blocking write, only to be used before the codec is started
+  void Flush() {
+    while (busy_) Step();
+  }
+
+  // Blocking erase of [sector], only to be used while the codec
+  // interrupt can be stalled
+  void Erase(uint32_t sector) {
+    Flush();
+    FLASH_Unlock();
+    FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR |
+                    FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+    FLASH_EraseSector(sector * 8, VoltageRange_3);
+    FLASH_Lock();
+  }
+
+ private:
+  uint32_t buffer_[kFlashWriterBufferWords];
+  const uint32_t* source_;
+  uint32_t address_;
+  size_t size_;
+  size_t written_;
+  bool busy_;
+};
+
+#endif
@@ -36,6 +36,8 @@
 
 #include <stm32f4xx_conf.h>
 
+#include <cstddef>
+
 const uint8_t kNumLeds = 26;
 
 enum LedColor {
@@ -165,6 +167,12 @@ static GPIO_TypeDef* const LED_GPIOs[kNumLeds] = {
     GPIOB,                      // vel norm
 };
 
+const uint8_t kNumLedPorts = 6;
+
+static GPIO_TypeDef* const LED_Ports[kNumLedPorts] = {
+  GPIOA, GPIOB, GPIOC, GPIOD, GPIOE, GPIOG,
+};
+
 class Leds {
  public:
   void Init() {
@@ -183,20 +191,38 @@ class Leds {
     gpio.GPIO_PuPd = GPIO_PuPd_NOPULL;
     gpio.GPIO_Speed = GPIO_Speed_2MHz;
 
+    for (int p=0; p<kNumLedPorts; p++) {
+      levels_[p] = 0;
+    }
+
     // LED pins configure
     for (int i=0; i<kNumLeds; i++) {
       gpio.GPIO_Pin = LED_Pins[i];
       GPIO_Init(LED_GPIOs[i], &gpio);
+      for (int p=0; p<kNumLedPorts; p++) {
+        if (LED_Ports[p] == LED_GPIOs[i]) port_[i] = p;
+      }
     }
 
     Clear();
+    // forces a write of every pin
+    for (int p=0; p<kNumLedPorts; p++) {
+      written_[p] = ~levels_[p];
+    }
     Write();
   }
 
+  // Only the pins that changed since the last write are touched, with
+  // one BSRR write per port
   void Write() {
-    for (int i=0; i<kNumLeds; i++) {
-      bool v = i<18 ? !values_[i] : values_[i];
-      GPIO_WriteBit(LED_GPIOs[i], LED_Pins[i], static_cast<BitAction>(v));
+    for (int p=0; p<kNumLedPorts; p++) {
+      uint16_t changed = levels_[p] ^ written_[p];
+      if (changed) {
+        uint32_t set = changed & levels_[p];
+        uint32_t reset = changed & written_[p];
+        *bsrr(LED_Ports[p]) = set | reset << 16;
+        written_[p] = levels_[p];
+      }
     }
   }
 
@@ -214,15 +240,19 @@ class Leds {
         channel == LED_DELETE_G ||
         channel == LED_DELETE_B)
       value = false;
-    values_[channel] = value;
 # else
     if (channel >= LED_DELETE_R &&
         channel <= LED_REPEAT_B) {
-      values_[channel] = !value;
-    } else {
-      values_[channel] = value;
+      value = !value;
     }
 #endif
+    // the button LEDs are active low
+    bool level = channel < 18 ? !value : value;
+    if (level) {
+      levels_[port_[channel]] |= LED_Pins[channel];
+    } else {
+      levels_[port_[channel]] &= ~LED_Pins[channel];
+    }
   }
 
   void set_rgb(uint8_t channel, uint8_t color) {
@@ -244,7 +274,15 @@ class Leds {
   }
 
  private:
-  bool values_[kNumLeds];
+  // BSRRL and BSRRH, written as one 32-bit register
+  static volatile uint32_t* bsrr(GPIO_TypeDef* port) {
+    return reinterpret_cast<volatile uint32_t*>(
+        reinterpret_cast<uintptr_t>(port) + offsetof(GPIO_TypeDef, BSRRL));
+  }
+
+  uint8_t port_[kNumLeds];         // index in LED_Ports
+  uint16_t levels_[kNumLedPorts];  // shadow of the pin levels
+  uint16_t written_[kNumLedPorts]; // last levels written to the port
 };
 
 #endif
@@ -38,6 +38,9 @@
 #define SDRAM_BASE 0xD0000000
 #define SDRAM_SIZE 0x02000000
 
+// words per memory-to-memory DMA transfer of the background clear
+const uint32_t kSdramClearChunk = 0x8000;
+
 class SDRAM {
  public:
   void Clear() {
@@ -70,6 +73,43 @@ class SDRAM {
     return true;
   }
 
+  /* Zeroes [size] bytes from [address] in the background, by
+   * memory-to-memory DMA transfers chained from ClearInterrupt() */
+  void StartClear(uint32_t address, uint32_t size) {
+    zero_ = 0;
+    clear_start_ = address;
+    clear_address_ = address;
+    cleared_ = 0;
+    clear_end_ = address + size;
+
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA2, ENABLE);
+    // below the codec interrupt, above the control task
+    NVIC_SetPriority(DMA2_Stream1_IRQn, 1);
+    NVIC_EnableIRQ(DMA2_Stream1_IRQn);
+    StartClearChunk();
+  }
+
+  /* Called from the DMA2 Stream1 interrupt; returns true when the
+   * clear is complete */
+  bool ClearInterrupt() {
+    if (DMA_GetITStatus(DMA2_Stream1, DMA_IT_TCIF1) == RESET)
+      return false;
+    DMA_ClearITPendingBit(DMA2_Stream1, DMA_IT_TCIF1);
+    clear_address_ += clear_chunk_ * 4;
+    // published in one word: the codec interrupt may read it at any
+    // point of this handler
+    cleared_ = clear_address_ - clear_start_;
+    if (clear_address_ < clear_end_) {
+      StartClearChunk();
+      return false;
+    }
+    return true;
+  }
+
+  /* Number of bytes from the start of the region known to be zero,
+   * in whole chunks; lags behind the DMA by less than a chunk */
+  uint32_t cleared() { return cleared_; }
+
   /* Wait until the SDRAM controller is ready */
   void Wait() {
     while(FMC_GetFlagStatus(FMC_Bank2_SDRAM, FMC_FLAG_Busy) != RESET);
@@ -257,6 +297,43 @@ class SDRAM {
     FMC_SetRefreshCount(683);
     while(FMC_GetFlagStatus(FMC_Bank2_SDRAM, FMC_FLAG_Busy) != RESET);
   }    
+
+ private:
+  void StartClearChunk() {
+    uint32_t words = (clear_end_ - clear_address_) / 4;
+    clear_chunk_ = words < kSdramClearChunk ? words : kSdramClearChunk;
+
+    DMA_Cmd(DMA2_Stream1, DISABLE);
+    while (DMA_GetCmdStatus(DMA2_Stream1) != DISABLE);
+
+    DMA_InitTypeDef dma_init;
+    dma_init.DMA_Channel = DMA_Channel_0;
+    dma_init.DMA_PeripheralBaseAddr = (uint32_t)&zero_;
+    dma_init.DMA_Memory0BaseAddr = clear_address_;
+    dma_init.DMA_DIR = DMA_DIR_MemoryToMemory;
+    dma_init.DMA_BufferSize = clear_chunk_;
+    dma_init.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    dma_init.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    dma_init.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+    dma_init.DMA_MemoryDataSize = DMA_MemoryDataSize_Word;
+    dma_init.DMA_Mode = DMA_Mode_Normal;
+    dma_init.DMA_Priority = DMA_Priority_Low;
+    dma_init.DMA_FIFOMode = DMA_FIFOMode_Enable;
+    dma_init.DMA_FIFOThreshold = DMA_FIFOThreshold_Full;
+    dma_init.DMA_MemoryBurst = DMA_MemoryBurst_INC4;
+    dma_init.DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
+    DMA_Init(DMA2_Stream1, &dma_init);
+    DMA_ClearITPendingBit(DMA2_Stream1, DMA_IT_TCIF1);
+    DMA_ITConfig(DMA2_Stream1, DMA_IT_TC, ENABLE);
+    DMA_Cmd(DMA2_Stream1, ENABLE);
+  }
+
+  uint32_t zero_;
+  uint32_t clear_start_;
+  uint32_t clear_address_;
+  uint32_t clear_end_;
+  uint32_t clear_chunk_;
+  volatile uint32_t cleared_;
 };
 
 #endif
@@ -34,6 +34,9 @@
 #include "stmlib/stmlib.h"
 #include "system_stm32f4xx.h"
 
+// flush-to-zero bit of FPSCR; CMSIS only names the one of FPDSCR
+const uint32_t kFpscrFz = 1 << 24;
+
 class System {
  public:
 
@@ -44,8 +47,28 @@ class System {
     }
   }
 
+  // DWT cycle counter, for profiling
+  void StartCycleCounter() {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  }
+
+  uint32_t cycles() { return DWT->CYCCNT; }
+
+  // Denormals flushed to zero, in thread mode and in the interrupts,
+  // whose FPSCR comes from FPDSCR; the host builds do the same
+  void FlushDenormals() {
+    FPU->FPDSCR |= FPU_FPDSCR_FZ_Msk;
+    __set_FPSCR(__get_FPSCR() | kFpscrFz);
+  }
+
   void StartTimers() {
+    // SysTick (the UI) gets the lowest priority; the control task
+    // (PendSV) preempts it but not the codec interrupt, so that the
+    // parameters of a block never wait for a whole UI tick
     SysTick_Config(F_CPU / 1000);
+    NVIC_SetPriority(PendSV_IRQn, (1 << __NVIC_PRIO_BITS) - 2);
   }
 
  
@@ -0,0 +1,83 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech <matthias.puech@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Finds the time of the onset of a rising edge on a fast-sampled
+// signal. The decision that the edge is a tap is taken elsewhere, on
+// the filtered signal; the detector only remembers when it started.
+
+#ifndef EDGE_DETECTOR_H_
+#define EDGE_DETECTOR_H_
+
+#include "stmlib/stmlib.h"
+
+class EdgeDetector {
+ public:
+  void Init(float threshold, uint32_t max_age) {
+    threshold_ = threshold;
+    max_age_ = max_age;
+    armed_ = true;
+    minimum_ = 1.0f;
+    last_ = 0.0f;
+    time_ = 0;
+  }
+
+  void Process(float value, uint32_t time) {
+    if (armed_) {
+      if (value < minimum_) minimum_ = value;
+      if (value - minimum_ > threshold_) {
+        armed_ = false;
+        time_ = time;
+      }
+    } else if (time - time_ > max_age_) {
+      // nobody claimed the edge, it was noise
+      Rearm(value);
+    }
+    last_ = value;
+  }
+
+  /* Returns the onset time of the last edge, or now if none was
+   * seen, and starts looking for the next one */
+  uint32_t Consume(uint32_t now) {
+    uint32_t time = armed_ ? now : time_;
+    Rearm(last_);
+    return time;
+  }
+
+ private:
+  void Rearm(float value) {
+    armed_ = true;
+    minimum_ = value;
+  }
+
+  float threshold_;
+  uint32_t max_age_;
+  bool armed_;
+  float minimum_;
+  float last_;
+  uint32_t time_;
+};
+
+#endif
@@ -43,13 +43,22 @@ class Fader {
 
   inline float volume() { return volume_; }
   inline bool active() { return volume_ > 0.0f || volume_increment_ > 0.0f; }
+  // fading in or fully in
+  inline bool on() {
+    return volume_increment_ > 0.0f ||
+      (volume_increment_ == 0.0f && volume_ > 0.0f);
+  }
 
+  // Fades last at least a block: the volume is only clamped by
+  // Prepare, at the start of each block
   inline void fade_in(float length) {
+    if (length < kBlockSize) length = kBlockSize;
     volume_increment_ = 1.0f / length;
     if (volume_ < 0.0f) volume_ = 0.0f;
   }
 
   inline void fade_out(float length) {
+    if (length < kBlockSize) length = kBlockSize;
     volume_increment_ = -1.0f / length;
     if (volume_ > 1.0f) volume_ = 1.0f;
   }
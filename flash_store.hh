@@ -0,0 +1,133 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech <matthias.puech@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+//
+// Append-only store of fixed-size records in one flash sector. Each
+// record is a header word (magic and version token), the data, and a
+// checksum written last, so that a record interrupted by a power loss
+// is never mistaken for a valid one. Once it is full, Save() fails
+// until Compact() erases the sector, which stalls the flash for a
+// second (see Persistent::Erase()).
+
+#ifndef FLASH_STORE_H_
+#define FLASH_STORE_H_
+
+#include "stmlib/stmlib.h"
+#include "drivers/flash_writer.hh"
+
+#include <cstring>
+
+const uint32_t kFlashStoreMagic = 0x7A90;
+
+template<uint32_t sector, size_t size>
+class FlashStore {
+ public:
+  enum {
+    kDataWords = (size + 3) / 4,
+    kRecordWords = kDataWords + 2,
+    kNumRecords = kFlashSectorSize / (kRecordWords * 4),
+  };
+
+  static_assert(kRecordWords <= kFlashWriterBufferWords,
+                "record does not fit the flash writer buffer");
+
+  // Reads the latest valid record into [data]
+  bool Load(void* data) {
+    int32_t latest = -1;
+    next_ = 0;
+    token_ = 0;
+    while (next_ < kNumRecords && !Blank(record(next_))) {
+      if (Valid(record(next_))) latest = next_;
+      next_++;
+    }
+    if (latest == -1) return false;
+    memcpy(data, record(latest) + 1, size);
+    token_ = record(latest)[0] & 0xffff;
+    return true;
+  }
+
+  // Stages [data] and starts writing it; false if the writer is busy
+  // or the sector is full
+  bool Save(const void* data, FlashWriter* writer) {
+    if (writer->busy() || next_ >= kNumRecords) return false;
+    uint32_t* words = writer->buffer();
+    token_++;
+    words[0] = kFlashStoreMagic << 16 | token_;
+    words[kDataWords] = 0;
+    memcpy(words + 1, data, size);
+    words[kRecordWords - 1] = Checksum(words);
+    writer->Start(address(next_), kRecordWords);
+    next_++;
+    return true;
+  }
+
+  // Erases the sector, unless the last Load() found it empty, and
+  // rewrites [data] as its only record. Blocks for the duration of the
+  // erase: only call it while the codec interrupt can be stalled
+  void Compact(const void* data, FlashWriter* writer) {
+    if (next_ > 0) writer->Erase(sector);
+    next_ = 0;
+    Save(data, writer);
+    writer->Flush();
+  }
+
+  size_t free_records() { return kNumRecords - next_; }
+  bool needs_compaction() { return free_records() < kNumRecords / 4; }
+
+ private:
+  static uint32_t address(size_t index) {
+    return FlashSectorAddress(sector) + index * kRecordWords * 4;
+  }
+
+  static const uint32_t* record(size_t index) {
+    return reinterpret_cast<const uint32_t*>(address(index));
+  }
+
+  static bool Blank(const uint32_t* words) {
+    for (size_t i=0; i<kRecordWords; i++) {
+      if (words[i] != 0xffffffff) return false;
+    }
+    return true;
+  }
+
+  static bool Valid(const uint32_t* words) {
+    return (words[0] >> 16) == kFlashStoreMagic &&
+      words[kRecordWords - 1] == Checksum(words);
+  }
+
+  static uint32_t Checksum(const uint32_t* words) {
+    uint32_t sum = 0;
+    for (size_t i=0; i<kRecordWords - 1; i++) {
+      sum = ((sum << 5) | (sum >> 27)) ^ words[i];
+    }
+    return ~sum;
+  }
+
+  size_t next_;
+  uint16_t token_;
+};
+
+#endif
@@ -144,7 +144,6 @@ private:
 					val = (float)val * FSR_ADJUSTMENT;
 			}
 		}
-		adc_.Convert();
 		return val;
 	}
 
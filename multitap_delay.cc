@@ -29,31 +29,105 @@
 #include "stmlib/dsp/dsp.h"
 #include "stmlib/dsp/parameter_interpolator.h"
 #include "stmlib/dsp/rsqrt.h"
+
+#include <algorithm>
+#include <cstring>
+
 #include "multitap_delay.hh"
 
 using namespace stmlib;
 
 const int32_t kClockDefaultPeriod = 1 * SAMPLE_RATE;
-const int32_t kMaxQuantizeClock = 2 * SAMPLE_RATE;
+const uint32_t kMaxQuantizeClock = 2 * SAMPLE_RATE;
+// the output mutes and unmutes in 4 blocks
+const float kMuteStep = 0.25f;
 
-void MultitapDelay::Init(short* buffer, int32_t buffer_size) {
+void MultitapDelay::Init(short* buffer, int32_t buffer_size, bool clear) {
   buffer_.Init(buffer, buffer_size);
   dc_blocker_.Init();
   dc_blocker_.set_f_q<FREQUENCY_FAST>(10.0f / SAMPLE_RATE, 0.6f);
   repeat_fader_.Init();
-  clock_period_.Init(kClockDefaultPeriod);
+  clock_tracker_.Init(kClockDefaultPeriod);
   clock_period_smoothed_ = kClockDefaultPeriod;
   sync_scale_ = kClockDefaultPeriod;
   quantize_ = false;
+  sync_ = false;
+  mute_ = false;
+  muted_ = false;
+  output_gain_ = 1.0f;
+  counter_ = 0;
+  counter_running_ = false;
+  repeat_time_ = 0;
+  pan_state_ = false;
+  feedback_compensation_ = 0.0f;
+  std::fill(feedback_buffer_, feedback_buffer_ + kBlockSize, 0.0f);
+  // the first block ramps from zero, as from a zeroed instance
+  memset(&prev_params_, 0, sizeof(prev_params_));
+  prev_max_time_ = 0;
+  random_.Init();
 
   for (size_t i=0; i<kMaxTaps; i++) {
-    taps_[i].Init();
+    taps_[i].Init(&random_);
   }
   tap_allocator_.Init(taps_);
 
-  buffer_.Clear();
+  clock_ = 0;
+  slot_modifications_ = 0;
+  gate_ = false;
+  ui_commands_.Init(&clock_);
+  control_commands_.Init(&clock_);
+  events_.Init();
+
+  if (clear) {
+    buffer_.Clear();
+  }
 };
 
+void MultitapDelay::Load(Slot* slot) {
+  tap_allocator_.Load(slot);
+  if (slot->size > 0) {
+    counter_running_ = true;
+  } else { // bank IR
+    counter_ = 0;
+    counter_running_ = false;
+  }
+}
+
+// slots are kept packed by Persistent, and validated at boot
+void MultitapDelay::Load(const PackedSlot* packed) {
+  Slot slot;
+  if (UnpackSlot(packed, &slot)) Load(&slot);
+}
+
+void MultitapDelay::PostEvent(DelayEventType type,
+                              TapType tap_type, float velocity) {
+  DelayEvent e;
+  e.type = type;
+  e.timestamp = clock_;
+  e.tap_type = tap_type;
+  e.velocity = velocity;
+  events_.Write(e);
+}
+
+void MultitapDelay::ExecuteCommands(CommandQueue* queue) {
+  Command c;
+  while (queue->Next(&c)) {
+    switch (c.type) {
+    case COMMAND_ADD_TAP: AddTap(&c.tap, c.timestamp); break;
+    case COMMAND_REMOVE_LAST_TAP: RemoveLastTap(); break;
+    case COMMAND_CLEAR: Clear(); break;
+    case COMMAND_LOAD: Load(c.slot); break;
+    case COMMAND_LOAD_PACKED: Load(c.packed_slot); break;
+    case COMMAND_REPAN_TAPS: RepanTaps(c.panning_mode); break;
+    case COMMAND_SET_REPEAT: set_repeat(c.state); break;
+    case COMMAND_TOGGLE_REPEAT: set_repeat(!repeat_on()); break;
+    case COMMAND_SET_SYNC: set_sync(c.state); break;
+    case COMMAND_SET_MUTE: mute_ = c.state; break;
+    case COMMAND_CLOCK_TICK: ClockTick(c.timestamp); break;
+    }
+  }
+}
+
 void MultitapDelay::set_repeat(bool state) {
   if (state) {
     repeat_fader_.fade_in(prev_params_.morph + 1.0f);
@@ -77,7 +151,7 @@ float MultitapDelay::ComputePanning(PanningMode panning_mode)
 {
     float panning = 1.0f;
     if (panning_mode == PANNING_RANDOM) {
-      panning = Random::GetFloat();
+      panning = random_.GetFloat();
     } else if (panning_mode == PANNING_ALTERNATE) {
       panning = pan_state_ ? 1.0f : 0.0f;
       pan_state_ = !pan_state_;
@@ -86,53 +160,92 @@ float MultitapDelay::ComputePanning(PanningMode panning_mode)
     return panning;
 }
 
-void MultitapDelay::ClockTick() {
-  if (clock_counter_ < kMaxQuantizeClock &&
+void MultitapDelay::ClockTick(uint32_t timestamp) {
+  if (timestamp - clock_tracker_.last_tick() < kMaxQuantizeClock &&
       !sync_) {
     quantize_ = true;
   }
 
-  clock_period_.Process(clock_counter_);
-  clock_counter_ = 0;
+  if (clock_tracker_.Tick(timestamp) && sync_) {
+    AlignCounter();
+  }
+}
+
+// moves the counter so that the IR (or each clock period of it)
+// starts on the filtered clock edge
+void MultitapDelay::AlignCounter() {
+  if (!counter_running_ ||
+      !clock_tracker_.locked() ||
+      prev_max_time_ == 0) {
+    return;
+  }
+
+  float period = clock_tracker_.period();
+  float grid = std::min(period, static_cast<float>(prev_max_time_));
+  int32_t age = clock_ - clock_tracker_.last_edge();
+  float counter = static_cast<float>(counter_) - age; // counter at the edge
+  float error = counter - grid * floorf(counter / grid + 0.5f);
+
+  float aligned = static_cast<float>(counter_) - error;
+  if (aligned < 0.0f) {
+    aligned += prev_max_time_;
+  }
+  counter_ = static_cast<uint32_t>(aligned);
 }
 
-void MultitapDelay::AddTap(Parameters *params) {
+void MultitapDelay::AddTap(TapCommand *tap, uint32_t timestamp) {
 
   // inhibit tap add completely
-  if (params->edit_mode == EDIT_OFF) {
+  if (tap->edit_mode == EDIT_OFF) {
     return;
   }
 
+  // how long ago the tap happened, in samples
+  uint32_t age = clock_ - timestamp;
+
   // first tap does not count, it just starts the counter
   if (!counter_running_) {
     counter_running_ = true;
-    tap_observable_.notify(TAP_DRY, 1.0f);
+    counter_ = age;
+    PostEvent(EVENT_TAP, TAP_DRY, 1.0f);
     return;
   }
 
-  float counter = static_cast<float>(counter_);
+  // counter value at the time of the tap
+  uint32_t tap_counter;
+  if (age <= counter_) {
+    tap_counter = counter_ - age;
+  } else if ((tap->edit_mode != EDIT_NORMAL || sync_) &&
+             counter_ + prev_max_time_ > age) {
+    // the counter wrapped around since the tap
+    tap_counter = counter_ + prev_max_time_ - age;
+  } else {
+    tap_counter = 0;
+  }
+
+  float counter = static_cast<float>(tap_counter);
 
   if (quantize_) {
-    float period = static_cast<float>(clock_period_.value());
+    float period = clock_tracker_.period();
     counter = floorf(counter / period + 0.5f) * period;
   }
 
   float time = counter / prev_params_.scale;
-  float pan = ComputePanning(params->panning_mode);
+  float pan = ComputePanning(tap->panning_mode);
 
   TapType type =
-    params->edit_mode == EDIT_NORMAL ||
+    tap->edit_mode == EDIT_NORMAL ||
     // if it's the first tap, then notify it as "normal"
     tap_allocator_.max_time() == 0.0f ? TAP_ADDED :
-    params->edit_mode == EDIT_OVERDUB ? TAP_ADDED_OVERDUB :
+    tap->edit_mode == EDIT_OVERDUB ? TAP_ADDED_OVERDUB :
     TAP_FAIL;
 
   // add tap
   bool success = false;
   if (time < buffer_.size()) {
     success = tap_allocator_.Add(time,
-                                 params->velocity,
-                                 params->velocity_type,
+                                 tap->velocity,
+                                 tap->velocity_type,
                                  pan);
   }
 
@@ -140,13 +253,13 @@ void MultitapDelay::AddTap(Parameters *params) {
   if (!success) type = TAP_ADDED_OVERWRITE;
 
   // UI feedback
-  tap_observable_.notify(type, params->velocity);
-  slot_modified_observable_.notify();
+  PostEvent(EVENT_TAP, type, tap->velocity);
+  slot_modifications_++;
 }
 
 void MultitapDelay::RemoveLastTap() {
   if (tap_allocator_.RemoveLast()) {
-    slot_modified_observable_.notify();
+    slot_modifications_++;
   }
 
   if(tap_allocator_.max_time() <= 0.0f) {
@@ -159,7 +272,7 @@ void MultitapDelay::Clear() {
   tap_allocator_.Clear();
   counter_running_ = false;
   counter_ = 0;
-  slot_modified_observable_.notify();
+  slot_modifications_++;
 }
 
 void MultitapDelay::RepanTaps(PanningMode panning_mode) {
@@ -169,26 +282,94 @@ void MultitapDelay::RepanTaps(PanningMode panning_mode) {
   }
 }
 
+// Fills [out] with the CV stream times [gain] if it is active, or else
+// with a linear ramp between the block values. Returns the value at
+// the end of the block.
+static inline float Modulate(const CvStream* cv, CvStreamChannel channel,
+                             float start, float end, float* out,
+                             float gain = 1.0f) {
+  if (cv && cv->active[channel]) {
+    const float* values = cv->values[channel];
+    for (size_t i=0; i<kBlockSize; i++) {
+      out[i] = values[i] * gain;
+    }
+    return out[kBlockSize-1];
+  }
+  float increment = (end - start) / kBlockSize;
+  for (size_t i=0; i<kBlockSize; i++) {
+    out[i] = start;
+    start += increment;
+  }
+  return end;
+}
+
 // Dispatch
-void MultitapDelay::Process(Parameters *params, ShortFrame* input, ShortFrame* output) {
-  return params->panning_mode == PANNING_LEFT ?
-     Process<true>(params, input, output) :
-     Process<false>(params, input, output);
+void MultitapDelay::Process(Parameters *params, const ShortFrame* input, ShortFrame* output,
+                            const CvStream* cv) {
+  // apply pending commands, at block boundary
+  ExecuteCommands(&ui_commands_);
+  ExecuteCommands(&control_commands_);
+  tap_allocator_.Poll();
+
+  // the reads of the delay buffer only check the part being cleared
+  // until it is done
+  bool cleared = buffer_.cleared();
+  if (params->panning_mode == PANNING_LEFT) {
+    if (cleared) Process<true, true>(params, input, output, cv);
+    else Process<true, false>(params, input, output, cv);
+  } else {
+    if (cleared) Process<false, true>(params, input, output, cv);
+    else Process<false, false>(params, input, output, cv);
+  }
+  Mute(output);
+}
+
+// Fades the output to silence and back, around flash erases: they stall
+// this interrupt, and the codec repeats the last block meanwhile
+void MultitapDelay::Mute(ShortFrame* output) {
+  if (!mute_ && output_gain_ == 1.0f) {
+    return;
+  }
+  float end = mute_ ?
+    std::max(output_gain_ - kMuteStep, 0.0f) :
+    std::min(output_gain_ + kMuteStep, 1.0f);
+  float increment = (end - output_gain_) / kBlockSize;
+  float gain = output_gain_;
+  for (size_t i=0; i<kBlockSize; i++) {
+    output[i].l = static_cast<short>(output[i].l * gain);
+    output[i].r = static_cast<short>(output[i].r * gain);
+    gain += increment;
+  }
+  output_gain_ = end;
+  muted_ = mute_ && end == 0.0f;
 }
 
-template<bool last_tap_on_output>
-void MultitapDelay::Process(Parameters *params, ShortFrame* input, ShortFrame* output) {
+template<bool last_tap_on_output, bool cleared>
+void MultitapDelay::Process(Parameters *params, const ShortFrame* input, ShortFrame* output,
+                            const CvStream* cv) {
 
   static const float buffer_headroom = 0.5f;
 
   // compute IR scale to fit into clock period
   if (sync_ && tap_allocator_.max_time() > 0.0f) {
-    ONE_POLE(clock_period_smoothed_, clock_period_.value(), 0.002f);
+    // the tracker is already free of jitter; only avoid zipper noise
+    ONE_POLE(clock_period_smoothed_, clock_tracker_.period(), 0.02f);
     params->scale = clock_period_smoothed_
       / tap_allocator_.max_time()
       * params->sync_ratio; // warning: overwriting a parameter
+    // a pattern much shorter than the clock
+    params->scale = std::min(params->scale, kMaxSyncScale);
+    // the clock sets the scale, not the CV
+    cv = NULL;
   }
 
+  // warning: overwriting parameters with the last streamed values
+  bool scale_streamed = cv && cv->active[CV_STREAM_SCALE];
+  params->scale = Modulate(cv, CV_STREAM_SCALE,
+                           prev_params_.scale, params->scale, scale_block_);
+  params->drywet = Modulate(cv, CV_STREAM_DRYWET,
+                            prev_params_.drywet, params->drywet, drywet_block_);
+
   uint32_t max_time = static_cast<uint32_t>(tap_allocator_.max_time() * params->scale);
 
   // increment sample counter
@@ -214,26 +395,26 @@ void MultitapDelay::Process(Parameters *params, ShortFrame* input, ShortFrame* o
   if (feedback_compensation < 1.0f) feedback_compensation = 1.0f;
   feedback_compensation = fast_rsqrt_carmack(feedback_compensation);
   ONE_POLE(feedback_compensation_, feedback_compensation, 0.05f);
-  params->feedback *= feedback_compensation_; // warning: overwrite params
+  params->feedback = Modulate(cv, CV_STREAM_FEEDBACK,
+                              prev_params_.feedback,
+                              params->feedback * feedback_compensation_,
+                              feedback_block_,
+                              feedback_compensation_); // warning: overwrite params
 
-  float feedback = prev_params_.feedback;
-  float feedback_end = params->feedback;
-  float feedback_increment = (feedback_end - feedback) / kBlockSize;
+  random_.Fill(dither_block_, kBlockSize, 0.5f / 8192.0f);
 
   for (size_t i=0; i<kBlockSize; i++) {
     float fb_sample = feedback_buffer_[i];
-    int16_t r = buffer_.ReadShort(repeat_time_);
+    int16_t r = buffer_.ReadShort<cleared>(repeat_time_);
     float repeat_sample =  static_cast<float>(r) / 32768.0f / buffer_headroom;
     repeat_fader_.Process(repeat_sample);
     float dry_sample = static_cast<float>(input[i].l) / 32768.0f;
-    float dither = (Random::GetFloat() - 0.5f) / 8192.0f;
-    float s = gain * dry_sample + feedback * fb_sample + repeat_sample + dither;
+    float s = gain * dry_sample + feedback_block_[i] * fb_sample + repeat_sample + dither_block_[i];
     s = SoftLimit(s * buffer_headroom);
     int16_t sample = Clip16(static_cast<int32_t>(s * 32768.0f));
     repeat_fader_.Prepare();
     buffer_.Write(sample);
     gain += gain_increment;
-    feedback += feedback_increment;
   }
 
   /* 2. Read and sum taps from buffer */
@@ -249,7 +430,8 @@ void MultitapDelay::Process(Parameters *params, ShortFrame* input, ShortFrame* o
   bool counter_modulo_on_tap = false;
 
   for (int i=0; i<kMaxTaps; i++) {
-    taps_[i].Process(&prev_params_, params, &buffer_, buf);
+    taps_[i].Process<cleared>(&prev_params_, params,
+                     scale_streamed ? scale_block_ : NULL, &buffer_, buf);
 
     float time = taps_[i].time() * params->scale;
     if (counter_running_ && taps_[i].active()) {
@@ -264,23 +446,20 @@ void MultitapDelay::Process(Parameters *params, ShortFrame* input, ShortFrame* o
 
   // notify UI of tap
   if (counter_modulo_reset) {
-    reset_observable_.notify();
+    PostEvent(EVENT_RESET);
   }
 
   if (counter_on_tap > 0.0f) {
-    tap_observable_.notify(TAP_CROSSED, counter_on_tap);
+    PostEvent(EVENT_TAP, TAP_CROSSED, counter_on_tap);
   }
 
   if (counter_modulo_on_tap) {
-    tap_modulo_observable_.notify();
+    PostEvent(EVENT_TAP_MODULO);
   }
+  gate_ = counter_modulo_on_tap;
 
   /* 3. Feed back, apply dry/wet, write to output */
 
-  float drywet = prev_params_.drywet;
-  float drywet_end = params->drywet;
-  float drywet_increment = (drywet_end - drywet) / kBlockSize;
-
   float max_time_index = prev_max_time_ + kBlockSize;
   float max_time_index_end = max_time;
   float max_time_index_increment = (max_time_index_end - max_time_index) / kBlockSize;
@@ -296,13 +475,17 @@ void MultitapDelay::Process(Parameters *params, ShortFrame* input, ShortFrame* o
 
     // add dry signal
     float dry = static_cast<float>(input[i].l) / 32768.0f;
+    float drywet = drywet_block_[i];
     float fade_in = Interpolate(lut_xfade_in, drywet, 16.0f);
     float fade_out = Interpolate(lut_xfade_out, drywet, 16.0f);
     sample.l = dry * fade_out + sample.l * fade_in;
 
     // write to output buffer
     if (last_tap_on_output) {
-      sample.r = buffer_.ReadHermite(max_time_index) / buffer_headroom;
+      float index = scale_streamed ?
+        tap_allocator_.max_time() * scale_block_[i] + kBlockSize - i :
+        max_time_index;
+      sample.r = buffer_.ReadHermite<cleared>(index) / buffer_headroom;
     } else {
       sample.r = dry * fade_out + sample.r * fade_in;
     }
@@ -310,15 +493,14 @@ void MultitapDelay::Process(Parameters *params, ShortFrame* input, ShortFrame* o
     output[i].l = SoftConvert(sample.l);
     output[i].r = SoftConvert(sample.r);
 
-    drywet += drywet_increment;
     max_time_index += max_time_index_increment;
   }
 
   prev_max_time_ = max_time;
   prev_params_ = *params;
-  clock_counter_ += kBlockSize;
+  clock_ += kBlockSize;
 
-  if (clock_counter_ > kMaxQuantizeClock) {
+  if (clock_ - clock_tracker_.last_tick() > kMaxQuantizeClock) {
     quantize_ = false;
   }
 };
@@ -31,8 +31,10 @@
 
 #include "parameters.hh"
 #include "tap_allocator.hh"
+#include "command_queue.hh"
 #include "stmlib/utils/observer.h"
-#include "average.hh"
+#include "clock_tracker.hh"
+#include "random_generator.hh"
 
 #include "stmlib/dsp/filter.h"
 
@@ -47,78 +49,142 @@ enum TapType {
   TAP_FAIL,
 };
 
-class MultitapDelay
-{
-public:
-  void Init(short* buffer, int32_t buffer_size);
-  void Process(Parameters *params, ShortFrame* input, ShortFrame* output);
+enum DelayEventType {
+  EVENT_RESET,
+  EVENT_TAP,
+  EVENT_TAP_MODULO,
+};
 
-  void AddTap(Parameters *params);
-  void Clear();
-  void RemoveLastTap();
-  void RepanTaps(PanningMode panning_mode);
-  void ClockTick();
+// Sent from the audio interrupt to the UI. These are only pings: when
+// the queue is full they are dropped, and counted by the queue
+struct DelayEvent {
+  DelayEventType type;
+  uint32_t timestamp;           // sample clock
+  TapType tap_type;
+  float velocity;
+};
 
-  void set_repeat(bool state);
-  void set_sync(bool state);
+const size_t kEventQueueSize = 16;
 
-  void Load(Slot* slot) {
-    tap_allocator_.Load(slot);
-    if (slot->size > 0) {
-      counter_running_ = true;
-    } else { // bank IR
-      counter_ = 0;
-      counter_running_ = false;
-    }
-  };
+// Bound of the scale set by the clock: tap times are shorter than the
+// buffer, and scaled they must still be valid read positions
+const float kMaxSyncScale = 64.0f;
+
+class MultitapDelay
+{
+public:
+  // without [clear], the buffer is cleared in the background and
+  // set_buffer_valid() reports the progress
+  void Init(short* buffer, int32_t buffer_size, bool clear = true);
+  void Process(Parameters *params, const ShortFrame* input, ShortFrame* output,
+               const CvStream* cv = NULL);
 
   void Save(Slot* slot) {
     tap_allocator_.Save(slot);
   };
 
-  void Poll() { tap_allocator_.Poll(); }
-
   bool counter_running() { return counter_running_; }
   float repeat() { return repeat_fader_.volume(); }
+  bool repeat_on() { return repeat_fader_.on(); }
   bool sync() { return sync_; }
   bool quantize() { return quantize_; }
+  bool gate() { return gate_; }
+  // the output has faded to silence after set_mute(true)
+  bool muted() { return muted_; }
+  uint32_t clock() { return clock_; }
+  // incremented by every change of the taps; a state rather than an
+  // event, so that the UI can never miss it
+  uint32_t slot_modifications() { return slot_modifications_; }
 
   void sequencer_step(float morph_time) {
     step_observable_.notify(morph_time);
   }
 
+#ifdef TEST
+  // the floating point state carried from block to block, with a
+  // bound for each
+  template<typename Visitor>
+  void VisitState(Visitor* v) {
+    v->Visit("feedback buffer", feedback_buffer_, kBlockSize, 1000.0f);
+    v->Visit("feedback compensation", &feedback_compensation_, 1, 1.0f);
+    v->Visit("clock period", &clock_period_smoothed_, 1, 1e8f);
+    v->Visit("scale", &prev_params_.scale, 1, kMaxSyncScale);
+    v->Visit("feedback", &prev_params_.feedback, 1, 100.0f);
+    v->Visit("gain", &prev_params_.gain, 1, 100.0f);
+    v->Visit("drywet", &prev_params_.drywet, 1, 100.0f);
+    float repeat = repeat_fader_.volume();
+    v->Visit("repeat volume", &repeat, 1, 2.0f);
+    for (size_t i=0; i<kMaxTaps; i++) {
+      taps_[i].VisitState(v);
+    }
+  }
+#endif
+
   size_t buffer_size() { return buffer_.size(); }
+  void set_buffer_valid(uint32_t size) { buffer_.set_valid(size); }
+
+  // All mutations of the taps go through these queues; they are
+  // executed at the beginning of the next block
+  CommandQueue ui_commands_;      // posted from the main loop
+  CommandQueue control_commands_; // posted from Control
+
+  // Only written by the audio interrupt, drained by the UI
+  SpscQueue<DelayEvent, kEventQueueSize> events_;
 
-  Observable0 reset_observable_;
-  Observable0 slot_modified_observable_;
-  Observable0 tap_modulo_observable_;
-  Observable2<TapType, float> tap_observable_;
   Observable1<float> step_observable_;
 
 private:
-  template<bool repeat_tap_on_output>
-  void Process(Parameters *params, ShortFrame* input, ShortFrame* output);
+  template<bool repeat_tap_on_output, bool cleared>
+  void Process(Parameters *params, const ShortFrame* input, ShortFrame* output,
+               const CvStream* cv);
   float ComputePanning(PanningMode panning_mode);
 
+  void ExecuteCommands(CommandQueue* queue);
+  void PostEvent(DelayEventType type,
+                 TapType tap_type = TAP_DRY,
+                 float velocity = 0.0f);
+  void AddTap(TapCommand* tap, uint32_t timestamp);
+  void Clear();
+  void RemoveLastTap();
+  void RepanTaps(PanningMode panning_mode);
+  void ClockTick(uint32_t timestamp);
+  void AlignCounter();
+  void set_repeat(bool state);
+  void set_sync(bool state);
+  void Mute(ShortFrame* output);
+  void Load(Slot* slot);
+  void Load(const PackedSlot* slot);
+
   TapAllocator tap_allocator_;
   Tap taps_[kMaxTaps];
+  RandomGenerator random_;
   AudioBuffer buffer_;
   float feedback_buffer_[kBlockSize];
+  // per-sample parameters, from the CV stream or ramped
+  float scale_block_[kBlockSize];
+  float feedback_block_[kBlockSize];
+  float drywet_block_[kBlockSize];
+  float dither_block_[kBlockSize];
   float feedback_compensation_;
   Svf dc_blocker_;
   Fader repeat_fader_;
   uint32_t counter_;
+  volatile uint32_t clock_;     // samples processed since Init
+  volatile uint32_t slot_modifications_;
 
   uint32_t repeat_time_;
-  uint32_t clock_counter_;
-  Average<4> clock_period_;
+  ClockTracker clock_tracker_;
   float clock_period_smoothed_;
   float sync_scale_;
 
   bool sync_;
   bool counter_running_;
+  bool mute_;
+  volatile bool muted_;
+  float output_gain_;
 
   bool quantize_;
+  bool gate_;
 
   bool pan_state_;
 
@@ -0,0 +1,117 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+//
+// Packed on-flash slot format: 5 bytes per tap instead of the 16 of
+// TapParameters, with a version byte and a CRC per slot.
+
+#ifndef PACKED_SLOT_H_
+#define PACKED_SLOT_H_
+
+#include "parameters.hh"
+
+const uint8_t kPackedSlotVersion = 1;
+const uint32_t kPackedTimeMax = (1 << 24) - 1;
+
+struct PackedTap {
+  uint32_t time : 24;           // samples
+  uint32_t velocity : 8;
+  uint8_t velocity_type : 2;
+  uint8_t panning : 6;
+} __attribute__((packed));
+
+static_assert(sizeof(PackedTap) == 5, "PackedTap must be 5 bytes");
+
+struct PackedSlot {
+  uint8_t version;
+  uint8_t size;
+  uint16_t crc;                 // of size and taps
+  PackedTap taps[kMaxTaps];
+};
+
+// CRC-16-CCITT
+inline uint16_t Crc16(const uint8_t* data, size_t size, uint16_t crc = 0xffff) {
+  while (size--) {
+    crc ^= *data++ << 8;
+    for (int i=0; i<8; i++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+inline uint16_t PackedSlotCrc(const PackedSlot* packed) {
+  uint16_t crc = Crc16(&packed->size, 1);
+  return Crc16(reinterpret_cast<const uint8_t*>(packed->taps),
+               packed->size * sizeof(PackedTap), crc);
+}
+
+// Rounds [x] to the nearest integer in [0, max]
+inline uint32_t Quantize(float x, uint32_t max) {
+  x += 0.5f;
+  return x < 0.0f ? 0 : x >= max ? max : static_cast<uint32_t>(x);
+}
+
+inline void PackSlot(const Slot* slot, PackedSlot* packed) {
+  uint8_t size = slot->size > kMaxTaps ? kMaxTaps : slot->size;
+  packed->version = kPackedSlotVersion;
+  packed->size = size;
+  for (int i=0; i<kMaxTaps; i++) {
+    const TapParameters* t = &slot->taps[i];
+    PackedTap* p = &packed->taps[i];
+    if (i >= size) {
+      p->time = p->velocity = p->velocity_type = p->panning = 0;
+      continue;
+    }
+    p->time = Quantize(t->time, kPackedTimeMax);
+    p->velocity = Quantize(t->velocity * 255.0f, 255);
+    p->velocity_type = t->velocity_type > VELOCITY_BP ?
+      VELOCITY_BP : t->velocity_type;
+    p->panning = Quantize(t->panning * 63.0f, 63);
+  }
+  packed->crc = PackedSlotCrc(packed);
+}
+
+// Returns false if the slot is corrupted or of an unknown version
+inline bool UnpackSlot(const PackedSlot* packed, Slot* slot) {
+  if (packed->version != kPackedSlotVersion ||
+      packed->size > kMaxTaps ||
+      packed->crc != PackedSlotCrc(packed)) {
+    return false;
+  }
+  slot->size = packed->size;
+  for (int i=0; i<packed->size; i++) {
+    const PackedTap* p = &packed->taps[i];
+    TapParameters* t = &slot->taps[i];
+    t->time = p->time;
+    t->velocity = p->velocity / 255.0f;
+    t->velocity_type = static_cast<VelocityType>(p->velocity_type);
+    t->panning = p->panning / 63.0f;
+  }
+  return true;
+}
+
+#endif
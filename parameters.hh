@@ -81,6 +81,21 @@ struct Parameters {
   PanningMode panning_mode;
 };
 
+enum CvStreamChannel {
+  CV_STREAM_SCALE,
+  CV_STREAM_FEEDBACK,
+  CV_STREAM_DRYWET,
+  CV_STREAM_LAST
+};
+
+// Per-sample values of the parameters modulated at audio rate. A
+// channel is only active while its CV moves; otherwise the DSP ramps
+// between block values.
+struct CvStream {
+  bool active[CV_STREAM_LAST];
+  float values[CV_STREAM_LAST][kBlockSize];
+};
+
 struct TapParameters {
   float time;
   float velocity;
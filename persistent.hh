@@ -31,9 +31,30 @@
 
 #include "parameters.hh"
 #include "resources.h"
+#include "flash_store.hh"
+#include "packed_slot.hh"
+#include "slot_store.hh"
+#include "drivers/flash_writer.hh"
 #include "stmlib/system/storage.h"
 
-const int kNumSlots = 6 * 4;    // 6 buttons, 4 banks
+const int kNumBanks = 16;
+const int kNumSlots = 6 * kNumBanks; // 6 buttons per bank
+const int kNumPresetSlots = 6 * 4;   // factory presets, repeated
+
+// the slot log spans sectors 8 to 11, which held one bank each in
+// earlier firmwares
+const uint32_t kFirstSlotSector = 8;
+const size_t kNumSlotSectors = 4;
+const int kNumLegacyBanks = 4;
+const size_t kPackedBankSize = 6 * sizeof(PackedSlot);
+const size_t kUnpackedBankSize = 6 * sizeof(Slot);
+
+enum SaveStatus {
+  SAVE_NONE,
+  SAVE_DONE,                    // a slot has been completely written
+  SAVE_FAILED,                  // a save cannot be written, the stores
+                                // are full and cannot be compacted
+};
 
 struct CalibrationData {
   float offset[4];
@@ -55,8 +76,12 @@ public:
   };
 
   void Init(size_t buffer_size) {
+    writer_.Init();
+    settings_dirty_ = false;
+    saving_slot_ = false;
+    for (int i=0; i<kNumSlots; i++) slot_dirty_[i] = false;
 
-    if (!settings_storage_.ParsimoniousLoad(&data_, &settings_token_)) {
+    if (!Load(&settings_store_, &data_)) {
       for (size_t i=0; i<4; i++) {
         data_.calibration_data.offset[i] = 0.5f;
       }
@@ -68,67 +93,135 @@ public:
       data_.current_slot = 0;
       data_.repeat = 0;
       data_.sync = 0;
-      SaveData();
+      settings_store_.Compact(&data_, &writer_);
     }
 
     // sanitize settings
     CONSTRAIN(data_.velocity_parameter, 0, 4);
-    CONSTRAIN(data_.current_bank, 0, 3);
+    CONSTRAIN(data_.current_bank, 0, kNumBanks - 1);
     CONSTRAIN(data_.panning_mode, 0, 2);
     CONSTRAIN(data_.sequencer_mode, 0, 1);
-    CONSTRAIN(data_.current_slot, 0, 6 * 4);
+    CONSTRAIN(data_.current_slot, 0, kNumSlots - 1);
     if (data_.repeat != 1) data_.repeat = 0;
     if (data_.sync != 1) data_.sync = 0;
 
-    if (!bank0_.ParsimoniousLoad(&slots_[6 * 0], 6 * sizeof(Slot), &token_[0]) ||
-        !bank1_.ParsimoniousLoad(&slots_[6 * 1], 6 * sizeof(Slot), &token_[1]) ||
-        !bank2_.ParsimoniousLoad(&slots_[6 * 2], 6 * sizeof(Slot), &token_[2]) ||
-        !bank3_.ParsimoniousLoad(&slots_[6 * 3], 6 * sizeof(Slot), &token_[3])) {
-      for (int i=0; i<4; i++)
-        ResetBank(i);
+    if (slot_store_.Init(&writer_, kFirstSlotSector, kNumSlotSectors)) {
+      for (int slot=0; slot<kNumSlots; slot++) {
+        if (!slot_store_.Read(slot, &slots_[slot]))
+          ResetSlot(slot);
+      }
+      // the log is compacted in the background, see Poll(), unless
+      // it is too full to move anything: then start again from the
+      // slots in RAM
+      if (slot_store_.jammed()) {
+        slot_store_.Format();
+        WriteSlots(kNumSlots);
+      }
+    } else {
+      // no slot log yet: read the banks of earlier firmwares, then
+      // start the log with them
+      for (int slot=0; slot<kNumSlots; slot++)
+        ResetSlot(slot);
+      LoadLegacyBank<8>(0);
+      LoadLegacyBank<9>(1);
+      LoadLegacyBank<10>(2);
+      LoadLegacyBank<11>(3);
+      slot_store_.Format();
+      WriteSlots(6 * kNumLegacyBanks);
     }
 
-    // sanitize slots
     for (int slot=0; slot<kNumSlots; slot++) {
-      CONSTRAIN(slots_[slot].size, 0, kMaxTaps);
-      for (int tap=0; tap<slots_[slot].size; tap++) {
-        TapParameters *t = &slots_[slot].taps[tap];
-        CONSTRAIN(t->velocity, 0.0f, 1.0f);
-        CONSTRAIN(t->time, 0.0f, buffer_size);
-        CONSTRAIN(t->velocity_type, VELOCITY_AMP, VELOCITY_BP);
-        CONSTRAIN(t->panning, 0.0f, 1.0f);
-      }
+      SanitizeSlot(slot, buffer_size);
     }
   }
 
+  // Saves are only scheduled here, and written by Poll()
   void SaveData() {
-    settings_storage_.ParsimoniousSave(data_, &settings_token_);
+    settings_dirty_ = true;
   }
 
   Data* mutable_data() { return &data_; }
 
   void SaveBank(int bank) {
-    if (bank == 0) bank0_.ParsimoniousSave(&slots_[6 * 0], 6 * sizeof(Slot), &token_[0]);
-    if (bank == 1) bank1_.ParsimoniousSave(&slots_[6 * 1], 6 * sizeof(Slot), &token_[1]);
-    if (bank == 2) bank2_.ParsimoniousSave(&slots_[6 * 2], 6 * sizeof(Slot), &token_[2]);
-    if (bank == 3) bank3_.ParsimoniousSave(&slots_[6 * 3], 6 * sizeof(Slot), &token_[3]);
+    for (int slot=bank*6; slot<(bank+1)*6; slot++)
+      slot_dirty_[slot] = true;
+  }
+
+  void SaveSlot(int slot_nr, const Slot* slot) {
+    PackSlot(slot, &slots_[slot_nr]);
+    slot_dirty_[slot_nr] = true;
+  }
+
+  // Called from the main loop: advances the write in progress by a
+  // few words, or starts the next pending one, or else the next move
+  // of the background compaction. A save that does not fit is kept in
+  // RAM until Erase() makes room.
+  SaveStatus Poll() {
+    if (writer_.busy()) {
+      return writer_.Step() && saving_slot_ ? SAVE_DONE : SAVE_NONE;
+    }
+
+    saving_slot_ = false;
+
+    bool pending = false;
+    if (settings_dirty_) {
+      if (settings_store_.Save(&data_, &writer_)) {
+        settings_dirty_ = false;
+        return SAVE_NONE;
+      }
+      pending = true;
+    }
+
+    for (int slot=0; slot<kNumSlots; slot++) {
+      if (slot_dirty_[slot]) {
+        if (slot_store_.Write(slot, &slots_[slot])) {
+          slot_dirty_[slot] = false;
+          saving_slot_ = true;
+          return SAVE_NONE;
+        }
+        pending = true;
+      }
+    }
+
+    if (slot_store_.Collect()) {
+      return SAVE_NONE;
+    }
+    return pending && !erase_pending() ? SAVE_FAILED : SAVE_NONE;
   }
 
-  void SaveSlot(int slot_nr) {
-    SaveBank(slot_nr / 6);
+  // A sector must be erased to make room for the next saves
+  bool erase_pending() {
+    return !writer_.busy() &&
+      (settings_store_.needs_compaction() || slot_store_.reclaimable());
+  }
+
+  // Erases one sector, if one is pending. This stalls the flash, and
+  // with it the codec interrupt, for about a second: the UI mutes the
+  // output first, so that the codec repeats a silent block meanwhile.
+  void Erase() {
+    writer_.Flush();
+    if (settings_store_.needs_compaction()) {
+      settings_store_.Compact(&data_, &writer_);
+      settings_dirty_ = false;
+    } else {
+      slot_store_.Reclaim();
+    }
   }
 
   void ResetSlot(int slot) {
-    slots_[slot].size = lut_preset_sizes[slot];
+    int preset = slot % kNumPresetSlots;
+    Slot unpacked;
+    unpacked.size = lut_preset_sizes[preset];
 
-    for (int tap=0; tap<slots_[slot].size; tap++) {
-      int index = tap + kMaxTaps * slot;
-      TapParameters *t = &slots_[slot].taps[tap];
+    for (int tap=0; tap<unpacked.size; tap++) {
+      int index = tap + kMaxTaps * preset;
+      TapParameters *t = &unpacked.taps[tap];
       t->time = lut_preset_times[index];
       t->velocity = lut_preset_velos[index];
       t->velocity_type = static_cast<VelocityType>(lut_preset_types[index]);
       t->panning = lut_preset_pans[index];
     }
+    PackSlot(&unpacked, &slots_[slot]);
   }
 
   void ResetBank(int bank) {
@@ -147,20 +240,83 @@ public:
 
   void ResetCurrentBank() { ResetBank(current_bank()); }
 
-  Slot* mutable_slot(int nr) { return &slots_[nr]; }
+  // Slots are unpacked by the delay when it loads them
+  const PackedSlot* slot(int nr) { return &slots_[nr]; }
 
 private:
+  // Loads the latest record of [store], falling back to the
+  // stmlib::Storage layout of earlier firmwares, which is converted once.
+  // A full store is compacted in the background, see Erase().
+  template<uint32_t sector, size_t size>
+  bool Load(FlashStore<sector, size>* store, void* data) {
+    if (store->Load(data)) {
+      return true;
+    }
+
+    stmlib::Storage<sector> legacy_storage;
+    uint16_t token;
+    if (legacy_storage.ParsimoniousLoad(data, size, &token)) {
+      store->Compact(data, &writer_);
+      return true;
+    }
+    return false;
+  }
+
+  // Loads a bank written by an earlier firmware, as packed or plain
+  // Slots with FlashStore, or with stmlib::Storage
+  template<uint32_t sector>
+  void LoadLegacyBank(int bank) {
+    PackedSlot* packed = &slots_[6 * bank];
+    FlashStore<sector, kPackedBankSize> packed_store;
+    if (packed_store.Load(packed)) return;
+
+    Slot slots[6];
+    FlashStore<sector, kUnpackedBankSize> unpacked_store;
+    bool loaded = unpacked_store.Load(slots);
+    stmlib::Storage<sector> legacy_storage;
+    uint16_t token;
+    loaded = loaded ||
+      legacy_storage.ParsimoniousLoad(slots, kUnpackedBankSize, &token);
+    for (int i=0; i<6; i++) {
+      if (loaded) PackSlot(&slots[i], &packed[i]);
+      else ResetSlot(6 * bank + i);
+    }
+  }
+
+  // Blocking, only before the codec is started
+  void WriteSlots(int num_slots) {
+    for (int slot=0; slot<num_slots; slot++) {
+      slot_store_.Write(slot, &slots_[slot]);
+      writer_.Flush();
+    }
+  }
+
+  // Resets the slots that are corrupted or of an unknown version, and
+  // keeps the taps of the others in range
+  void SanitizeSlot(int slot, size_t buffer_size) {
+    Slot unpacked;
+    if (!UnpackSlot(&slots_[slot], &unpacked)) {
+      ResetSlot(slot);
+      UnpackSlot(&slots_[slot], &unpacked);
+    }
+    for (int tap=0; tap<unpacked.size; tap++) {
+      TapParameters *t = &unpacked.taps[tap];
+      CONSTRAIN(t->time, 0.0f, buffer_size);
+    }
+    PackSlot(&unpacked, &slots_[slot]);
+  }
+
   Data data_;
-  uint16_t settings_token_;
-  stmlib::Storage<7> settings_storage_;
+  FlashStore<7, sizeof(Data)> settings_store_;
 
-  Slot slots_[kNumSlots];
+  // packed, 96 slots take 25KB of RAM instead of 50KB
+  PackedSlot slots_[kNumSlots];
+  SlotStore<FlashWriter, kNumSlots> slot_store_;
 
-  stmlib::Storage<8> bank0_;
-  stmlib::Storage<9> bank1_;
-  stmlib::Storage<10> bank2_;
-  stmlib::Storage<11> bank3_;
-  uint16_t token_[4];
+  FlashWriter writer_;
+  bool settings_dirty_;
+  bool slot_dirty_[kNumSlots];
+  bool saving_slot_;
 };
 
 #endif
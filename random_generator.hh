@@ -0,0 +1,93 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+//
+// -----------------------------------------------------------------------------
+//
+// Random number generator owned by each DSP instance, so that
+// several instances neither share nor disturb each other's sequence,
+// and a render is reproducible from its seed. Xorshift32 on a few
+// independent lanes: single draws come from the first, blocks are
+// filled by all of them in turn, which vectorises.
+
+#ifndef RANDOM_GENERATOR_H_
+#define RANDOM_GENERATOR_H_
+
+#include "stmlib/stmlib.h"
+
+const uint32_t kRandomDefaultSeed = 0x21;
+const size_t kRandomLanes = 4;
+
+class RandomGenerator {
+ public:
+  void Init(uint32_t seed = kRandomDefaultSeed) {
+    for (size_t i=0; i<kRandomLanes; i++) {
+      state_[i] = Mix(seed + i * 0x9e3779b9);
+    }
+  }
+
+  inline uint32_t GetWord() {
+    return state_[0] = Next(state_[0]);
+  }
+
+  // in [0..1)
+  inline float GetFloat() {
+    return static_cast<float>(GetWord() >> 8) / 16777216.0f;
+  }
+
+  // [size] values in [-amplitude..amplitude), size a multiple of
+  // kRandomLanes
+  void Fill(float* out, size_t size, float amplitude) {
+    float scale = amplitude / 2147483648.0f;
+    uint32_t s[kRandomLanes];
+    for (size_t l=0; l<kRandomLanes; l++) s[l] = state_[l];
+    for (size_t i=0; i<size; i+=kRandomLanes) {
+      for (size_t l=0; l<kRandomLanes; l++) {
+        s[l] = Next(s[l]);
+        out[i + l] = static_cast<float>(static_cast<int32_t>(s[l])) * scale;
+      }
+    }
+    for (size_t l=0; l<kRandomLanes; l++) state_[l] = s[l];
+  }
+
+ private:
+  static inline uint32_t Next(uint32_t x) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+  }
+
+  // never zero, the fixed point of xorshift
+  static uint32_t Mix(uint32_t x) {
+    x = (x ^ (x >> 16)) * 0x85ebca6b;
+    x = (x ^ (x >> 13)) * 0xc2b2ae35;
+    x ^= x >> 16;
+    return x ? x : 1;
+  }
+
+  uint32_t state_[kRandomLanes];
+};
+
+#endif
@@ -26,7 +26,7 @@
 //
 // Smoothed random oscillator
 
-#include "stmlib/utils/random.h"
+#include "random_generator.hh"
 #include "stmlib/dsp/dsp.h"
 
 #include "resources.h"
@@ -42,9 +42,13 @@ class RandomOscillator
 {
  public:
 
-  inline void Init() {
+  inline void Init(RandomGenerator* random) {
+    random_ = random;
+    phase_ = 0.0f;
+    phase_increment_ = 0.0f;
+    direction_ = false;
     value_ = 0.0f;
-    next_value_ = Random::GetFloat() * 2.0f - 1.0f;
+    next_value_ = random_->GetFloat() * 2.0f - 1.0f;
   }
 
   inline void set_slope(float slope) {
@@ -59,7 +63,7 @@ class RandomOscillator
       phase_--;
       value_ = next_value_;
       direction_ = !direction_;
-      float rnd = (1.0f - kOscillationMinimumGap) * Random::GetFloat() + kOscillationMinimumGap;
+      float rnd = (1.0f - kOscillationMinimumGap) * random_->GetFloat() + kOscillationMinimumGap;
       next_value_ = direction_ ?
         value_ + (1.0f - value_) * rnd :
         value_ - (1.0f + value_) * rnd;
@@ -70,6 +74,7 @@ class RandomOscillator
   }
 
  private:
+  RandomGenerator* random_;
   float phase_;
   float phase_increment_;
   float value_;
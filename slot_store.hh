@@ -0,0 +1,335 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Log-structured slot store. Slot records are appended to a set of
+// flash sectors; the latest record of each slot wins. The index is
+// rebuilt by scanning at boot, replaying the sectors in the order of
+// their sequence numbers.
+//
+// Records are only appended to erased sectors, and once there are none
+// left, Write() fails. Space is reclaimed once less than a sector worth
+// of records is free, from the sector with the fewest live records:
+// Collect() moves them to the head one at a time, like any write, and
+// Reclaim() then erases the sector. Erasing stalls the flash bus for a
+// second, so the caller decides when it can happen.
+//
+// Each sector starts with a header word (magic and sequence number),
+// followed by records made of a header word (magic and slot number),
+// a PackedSlot and a checksum written last. Records interrupted by a
+// power loss fail the checksum and are skipped.
+//
+// [Flash] is FlashWriter on the hardware, or a simulator on the host.
+// A sector must hold more records than there are slots.
+
+#ifndef SLOT_STORE_H_
+#define SLOT_STORE_H_
+
+#include "stmlib/stmlib.h"
+#include "packed_slot.hh"
+
+#include <cstring>
+
+const uint32_t kSlotSectorMagic = 0x5EC7;
+const uint32_t kSlotRecordMagic = 0x5107;
+const size_t kMaxSlotSectors = 8;
+
+template<class Flash, size_t num_slots>
+class SlotStore {
+ public:
+  enum {
+    kDataWords = (sizeof(PackedSlot) + 3) / 4,
+    kRecordWords = kDataWords + 2,
+  };
+
+  // Rebuilds the index from the log; false if there is no log
+  bool Init(Flash* flash, uint32_t first_sector, size_t num_sectors) {
+    flash_ = flash;
+    first_sector_ = first_sector;
+    num_sectors_ = num_sectors;
+    records_per_sector_ =
+      (flash_->sector_size(first_sector) - 4) / (kRecordWords * 4);
+
+    for (size_t slot=0; slot<num_slots; slot++) {
+      index_[slot] = kNoRecord;
+    }
+
+    bool found = false;
+    for (size_t s=0; s<num_sectors_; s++) {
+      uint32_t header = *flash_->words(sector_address(s));
+      valid_[s] = (header >> 16) == kSlotSectorMagic;
+      erased_[s] = !valid_[s] && Blank(s);
+      sequences_[s] = header & 0xffff;
+      if (valid_[s] &&
+          (!found || static_cast<int16_t>(sequences_[s] - sequence_) > 0)) {
+        found = true;
+        head_ = s;
+        sequence_ = sequences_[s];
+      }
+    }
+
+    if (!found) return false;
+
+    // replay the sectors from the oldest to the head
+    bool replayed[kMaxSlotSectors] = { false };
+    for (size_t i=0; i<num_sectors_; i++) {
+      int32_t oldest = -1;
+      for (size_t s=0; s<num_sectors_; s++) {
+        if (valid_[s] && !replayed[s] &&
+            (oldest == -1 || age(s) > age(oldest))) {
+          oldest = s;
+        }
+      }
+      if (oldest == -1) break;
+      replayed[oldest] = true;
+      Replay(oldest);
+    }
+    CountLive();
+    return true;
+  }
+
+  // Erases all the sectors that are not blank. Blocking, only before
+  // the codec is started
+  void Format() {
+    for (size_t s=0; s<num_sectors_; s++) {
+      if (!Blank(s)) flash_->Erase(first_sector_ + s);
+      valid_[s] = false;
+      erased_[s] = true;
+      live_[s] = 0;
+    }
+    for (size_t slot=0; slot<num_slots; slot++) {
+      index_[slot] = kNoRecord;
+    }
+    head_ = num_sectors_ - 1;
+    next_ = records_per_sector_;
+    sequence_ = 0;
+  }
+
+  bool needs_compaction() {
+    return free_records() < records_per_sector_;
+  }
+
+  // Starts moving one live record of the sector to reclaim to the
+  // head; false if the flash is busy or there is nothing to move
+  bool Collect() {
+    int32_t victim = Victim();
+    return victim != -1 && Relocate(victim);
+  }
+
+  // True when the sector to reclaim has no live records left
+  bool reclaimable() {
+    int32_t victim = Victim();
+    return victim != -1 && live_[victim] == 0;
+  }
+
+  // No record can be written, nor moved to reclaim a sector: the log
+  // must be formatted
+  bool jammed() {
+    return free_records() == 0 && !reclaimable();
+  }
+
+  // Erases the sector to reclaim. Blocks for the duration of the
+  // erase: only call it while the codec interrupt can be stalled
+  void Reclaim() {
+    if (!reclaimable()) return;
+    int32_t victim = Victim();
+    flash_->Erase(first_sector_ + victim);
+    valid_[victim] = false;
+    erased_[victim] = true;
+  }
+
+  // Number of records that can still be written without erasing
+  size_t free_records() {
+    size_t free = records_per_sector_ - next_;
+    for (size_t s=0; s<num_sectors_; s++) {
+      if (erased_[s]) free += records_per_sector_;
+    }
+    return free;
+  }
+
+  bool Read(size_t slot, PackedSlot* packed) {
+    if (index_[slot] == kNoRecord) return false;
+    memcpy(packed, flash_->words(index_[slot]) + 1, sizeof(PackedSlot));
+    return true;
+  }
+
+  // Starts appending a record; false if the flash is busy or the log
+  // is full
+  bool Write(size_t slot, const PackedSlot* packed) {
+    if (flash_->busy()) return false;
+
+    uint32_t* words = flash_->buffer();
+    size_t size = 0;
+    uint32_t address;
+
+    if (next_ >= records_per_sector_) {
+      // open the next erased sector
+      int32_t erased = -1;
+      for (size_t i=1; i<=num_sectors_ && erased == -1; i++) {
+        size_t s = (head_ + i) % num_sectors_;
+        if (erased_[s]) erased = s;
+      }
+      if (erased == -1) return false;
+      head_ = erased;
+      next_ = 0;
+      sequence_++;
+      sequences_[head_] = sequence_;
+      address = sector_address(head_);
+      words[size++] = kSlotSectorMagic << 16 | sequence_;
+      valid_[head_] = true;
+      erased_[head_] = false;
+    } else {
+      address = record_address(head_, next_);
+    }
+
+    uint32_t* record = words + size;
+    record[0] = kSlotRecordMagic << 16 | slot;
+    record[kDataWords] = 0;
+    memcpy(record + 1, packed, sizeof(PackedSlot));
+    record[kRecordWords - 1] = Checksum(record);
+    size += kRecordWords;
+
+    flash_->Start(address, size);
+
+    if (index_[slot] != kNoRecord) live_[sector_of(index_[slot])]--;
+    index_[slot] = record_address(head_, next_);
+    live_[head_]++;
+    next_++;
+    return true;
+  }
+
+ private:
+  static const uint32_t kNoRecord = 0xffffffff;
+
+  uint32_t sector_address(size_t s) {
+    return flash_->sector_address(first_sector_ + s);
+  }
+
+  uint32_t record_address(size_t s, size_t record) {
+    return sector_address(s) + 4 + record * kRecordWords * 4;
+  }
+
+  size_t sector_of(uint32_t address) {
+    for (size_t s=0; s<num_sectors_; s++) {
+      if (address >= sector_address(s) &&
+          address < sector_address(s) + flash_->sector_size(first_sector_))
+        return s;
+    }
+    return 0;
+  }
+
+  // Sector with the fewest live records, if the log needs compaction
+  int32_t Victim() {
+    if (!needs_compaction()) return -1;
+    int32_t victim = -1;
+    for (size_t s=0; s<num_sectors_; s++) {
+      if (s != head_ && !erased_[s] &&
+          (victim == -1 || live_[s] < live_[victim])) {
+        victim = s;
+      }
+    }
+    return victim;
+  }
+
+  // Age of sector [s], in sectors opened since
+  uint16_t age(size_t s) {
+    return sequence_ - sequences_[s];
+  }
+
+  bool Blank(size_t s) {
+    return Blank(sector_address(s), flash_->sector_size(first_sector_) / 4);
+  }
+
+  bool Blank(uint32_t address, size_t size) {
+    const uint32_t* words = flash_->words(address);
+    for (size_t i=0; i<size; i++) {
+      if (words[i] != 0xffffffff) return false;
+    }
+    return true;
+  }
+
+  static uint32_t Checksum(const uint32_t* words) {
+    uint32_t sum = 0;
+    for (size_t i=0; i<kRecordWords - 1; i++) {
+      sum = ((sum << 5) | (sum >> 27)) ^ words[i];
+    }
+    return ~sum;
+  }
+
+  void Replay(size_t s) {
+    size_t record = 0;
+    for (; record<records_per_sector_; record++) {
+      uint32_t address = record_address(s, record);
+      if (Blank(address, kRecordWords)) break;
+      const uint32_t* words = flash_->words(address);
+      uint32_t slot = words[0] & 0xffff;
+      if ((words[0] >> 16) == kSlotRecordMagic &&
+          slot < num_slots &&
+          words[kRecordWords - 1] == Checksum(words)) {
+        index_[slot] = address;
+      }
+    }
+    if (s == head_) next_ = record;
+  }
+
+  void CountLive() {
+    for (size_t s=0; s<num_sectors_; s++) {
+      live_[s] = 0;
+    }
+    for (size_t slot=0; slot<num_slots; slot++) {
+      if (index_[slot] != kNoRecord) live_[sector_of(index_[slot])]++;
+    }
+  }
+
+  // Rewrites at the head one live record of sector [s]
+  bool Relocate(size_t s) {
+    if (live_[s] == 0) return false;
+    for (size_t slot=0; slot<num_slots; slot++) {
+      if (index_[slot] != kNoRecord && sector_of(index_[slot]) == s) {
+        PackedSlot packed;
+        Read(slot, &packed);
+        return Write(slot, &packed);
+      }
+    }
+    return false;
+  }
+
+  Flash* flash_;
+  uint32_t first_sector_;
+  size_t num_sectors_;
+  size_t records_per_sector_;
+
+  uint32_t index_[num_slots];   // address of the latest record
+  size_t live_[kMaxSlotSectors];
+  bool valid_[kMaxSlotSectors];
+  bool erased_[kMaxSlotSectors];
+  uint16_t sequences_[kMaxSlotSectors];
+
+  size_t head_;
+  size_t next_;
+  uint16_t sequence_;
+};
+
+#endif
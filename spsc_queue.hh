@@ -0,0 +1,86 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Single-producer, single-consumer lock-free queue
+
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+#include "stmlib/stmlib.h"
+
+// On a single core, a compiler barrier is enough to keep the payload
+// store ordered before the publication of the index.
+#define SPSC_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+template<typename T, size_t size>
+class SpscQueue {
+ public:
+  void Init() {
+    read_ptr_ = 0;
+    write_ptr_ = 0;
+    overflows_ = 0;
+  }
+
+  /* Producer side. Returns false and counts an overflow if full */
+  bool Write(const T& item) {
+    uint32_t w = write_ptr_;
+    if (w - read_ptr_ >= size) {
+      overflows_++;
+      return false;
+    }
+    buffer_[w & (size - 1)] = item;
+    SPSC_BARRIER();
+    write_ptr_ = w + 1;
+    return true;
+  }
+
+  /* Consumer side. Returns false if empty */
+  bool Read(T* item) {
+    uint32_t r = read_ptr_;
+    if (r == write_ptr_) {
+      return false;
+    }
+    *item = buffer_[r & (size - 1)];
+    SPSC_BARRIER();
+    read_ptr_ = r + 1;
+    return true;
+  }
+
+  size_t readable() const { return write_ptr_ - read_ptr_; }
+  size_t writable() const { return size - readable(); }
+  size_t capacity() const { return size; }
+  uint32_t overflows() const { return overflows_; }
+
+ private:
+  static_assert((size & (size - 1)) == 0, "size must be a power of 2");
+
+  T buffer_[size];
+  volatile uint32_t read_ptr_;
+  volatile uint32_t write_ptr_;
+  volatile uint32_t overflows_;
+};
+
+#endif
@@ -51,9 +51,12 @@ class Tap
 {
  public:
 
-  void Init() {
-    lfo_.Init();
+  void Init(RandomGenerator* random) {
+    lfo_.Init(random);
     fader_.Init();
+    filter_.Init();
+    lp_filter1_ = lp_filter2_ = lp_filter3_ = 0.0f;
+    velocity_type_ = VELOCITY_AMP;
     previous_lfo_sample_ = 0.0f;
     time_ = kBlockSize;
     velocity_ = 0.0f;
@@ -78,22 +81,39 @@ class Tap
 
   bool active() { return fader_.active(); }
   float volume() { return fader_.volume(); }
+
+#ifdef TEST
+  // the floating point state carried from block to block
+  template<typename Visitor>
+  void VisitState(Visitor* v) {
+    v->Visit("tap lp filter", &lp_filter1_, 1, 100.0f);
+    v->Visit("tap lp filter", &lp_filter2_, 1, 100.0f);
+    v->Visit("tap lp filter", &lp_filter3_, 1, 100.0f);
+    v->Visit("tap lfo", &previous_lfo_sample_, 1, 1.0f);
+    float volume = fader_.volume();
+    v->Visit("tap volume", &volume, 1, 2.0f);
+  }
+#endif
   void fade_in(float length) { fader_.fade_in(length); }
   void fade_out(float length) { fader_.fade_out(length); }
 
-  /* Dispatch function */
+  /* Dispatch function. [scale] holds one value per sample if the
+   * scale is streamed, or is NULL; [cleared] as buffer->cleared() */
+  template<bool cleared>
   void Process(Parameters *prev_params, Parameters *params,
+               const float* scale,
                AudioBuffer *buffer, FloatFrame* output) {
     if (velocity_type_ == VELOCITY_AMP)
-      Process<VELOCITY_AMP>(prev_params, params, buffer, output);
+      Process<VELOCITY_AMP, cleared>(prev_params, params, scale, buffer, output);
     else if (velocity_type_ == VELOCITY_LP)
-      Process<VELOCITY_LP>(prev_params, params, buffer, output);
+      Process<VELOCITY_LP, cleared>(prev_params, params, scale, buffer, output);
     else if (velocity_type_ == VELOCITY_BP)
-      Process<VELOCITY_BP>(prev_params, params, buffer, output);
+      Process<VELOCITY_BP, cleared>(prev_params, params, scale, buffer, output);
   }
 
-  template<VelocityType velocity_type>
+  template<VelocityType velocity_type, bool cleared>
   void Process(Parameters *prev_params, Parameters *params,
+               const float* scale,
                AudioBuffer *buffer, FloatFrame* output) {
 
     float velocity = velocity_;
@@ -133,22 +153,29 @@ class Tap
       amplitude_end = time_end - kBlockSize;
     }
 
-    time_start += amplitude_start * previous_lfo_sample_ * prev_params->modulation_amount;
-    time_end += amplitude_end * lfo_sample * params->modulation_amount;
+    float lfo_start = amplitude_start * previous_lfo_sample_ * prev_params->modulation_amount;
+    float lfo_end = amplitude_end * lfo_sample * params->modulation_amount;
     previous_lfo_sample_ = lfo_sample;
 
+    // Without a streamed scale, the read position ramps between the
+    // block values. With one, the scaled time is added per sample to
+    // the rest of the ramp: min time, LFO and the moving write head.
+    float start = scale ? kBlockSize + lfo_start : time_start + lfo_start;
+    float end = scale ? kBlockSize + lfo_end : time_end + lfo_end;
+
     float time = 0.0f;
-    const float time_increment = (time_end - time_start - kBlockSize)
+    const float time_increment = (end - start - kBlockSize)
       / static_cast<float>(kBlockSize);
 
     fader_.Prepare();
 
-    size_t size = kBlockSize;
-    while(size--) {
+    for (size_t i=0; i<kBlockSize; i++) {
 
       /* read sample from buffer */
       /* NOTE: doing the addition here avoids rounding errors with large times */
-      float sample = buffer->ReadLinear(time_start + time);
+      float position = start + time;
+      if (scale) position += time_ * scale[i];
+      float sample = buffer->ReadLinear<cleared>(position);
 
       union {float f; int i;} t; t.i = time_;
       sample = (t.i & 1) ? sample : -sample;
@@ -32,6 +32,11 @@ void TapAllocator::Init(Tap taps[kMaxTaps])
 {
   taps_ = taps;
   fade_time_ = 10000.0f;
+  next_voice_ = 0;
+  oldest_voice_ = 0;
+  count_voices_ = 0;
+  max_time_ = 0.0f;
+  queue_.Init();
 }
 
 void TapAllocator::Load(Slot* slot)
@@ -35,7 +35,10 @@
 #include "drivers/dac.hh"
 #include "ui.hh"
 #include "multitap_delay.hh"
+#include "double_buffer.hh"
 #include "hardware_tests.hh"
+#include "boot.hh"
+#include "tasks.hh"
 
 using namespace stmlib;
 
@@ -46,7 +49,13 @@ MultitapDelay delay;
 DigOut dac;
 Codec codec;
 
-Parameters parameters;
+Parameters parameters;           // written by the control task
+DoubleBuffer<Parameters> parameters_snapshot;
+SwapBuffer<CvStream> cv_stream;  // written by the control task
+
+const uint32_t kDelayBufferSize = SDRAM_SIZE / sizeof(short) / 2;
+
+BootProfile boot_profile;
 
 bool Panic() {
   codec.Stop();
@@ -63,56 +72,90 @@ extern "C" {
   void UsageFault_Handler() { while (1); }
   void SVC_Handler() { }
   void DebugMon_Handler() { }
-  void PendSV_Handler() { }
   void assert_failed(uint8_t* file, uint32_t line) { while (1); }
 
-  // slow timer for the UI
   void SysTick_Handler() {
-    ui.Poll();
-    system_clock.Tick();  // increment global ms counter.
+    UiTask();
+  }
+
+  void PendSV_Handler() {
+    ControlTask();
   }
-  
+
   void FillBuffer(Frame* input, Frame* output) {
-    ui.ReadParameters();
-    // dac.Write(true);            // profiling
-    delay.Process(&parameters, (ShortFrame*)input, (ShortFrame*)output);
-    // dac.Write(false);           // profiling
-    dac.Update();
+    delay.set_buffer_valid(sdram.cleared() / sizeof(short));
+    ProcessBlock(input, output);
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    boot_profile.Mark(BOOT_FIRST_BLOCK, sys.cycles());
   }
 
-  void ping_gate_out() {
-    dac.Ping();
-    ui.PingGateLed();
+  // chains the transfers of the delay buffer clear
+  void DMA2_Stream1_IRQHandler() {
+    if (sdram.ClearInterrupt()) {
+      boot_profile.Mark(BOOT_BUFFER_CLEARED, sys.cycles());
+    }
   }
 }
 
-void Init() {
+struct Board {
+  void InitSystem() {
 #ifdef APPLICATION
-  sys.Init(true);
+    sys.Init(true);
 #else
-  sys.Init(false);
+    sys.Init(false);
 #endif
+    sys.FlushDenormals();
+    system_clock.Init();
+    sys.StartCycleCounter();
+  }
+
+  void RunTesterIfRequested() {
+    TapoHardwareTester tester;
+    tester.run_if_requested();
+  }
 
-  system_clock.Init();
+  void InitCodecClock() {
+    // a failure is reported once the UI can show it
+    codec_ok_ = codec.InitClock(SAMPLE_RATE);
+    codec_reset_ = sys.cycles();
+  }
+
+  void InitSdram() {
+    sdram.Init();
+    // the delay buffer is cleared while the rest boots and the codec
+    // runs; reads beyond the cleared part return silence
+    sdram.StartClear(SDRAM_BASE, kDelayBufferSize * sizeof(short));
+  }
+
+  void InitDelay() {
+    dac.Init();
+    delay.Init((short*)SDRAM_BASE, kDelayBufferSize, false);
+  }
 
-  TapoHardwareTester tester;
-  tester.run_if_requested();
+  void InitUi() {
+    ui.Init(&delay, &parameters);
+    ui.ReadParameters(cv_stream.back());
+    parameters_snapshot.Init(parameters);
+    cv_stream.Publish();
+  }
 
-  sdram.Init();
-  dac.Init();
-  delay.Init((short*)SDRAM_BASE, SDRAM_SIZE/sizeof(short) / 2);
-  ui.Init(&delay, &parameters);
-  sys.StartTimers();
+  void StartCodec() {
+    sys.StartTimers();
+    // the codec needs 2ms out of reset, usually spent loading the UI
+    while (sys.cycles() - codec_reset_ < F_CPU / 500) { }
+    (codec_ok_ && codec.Start(&FillBuffer)) || Panic();
+  }
 
-  delay.tap_modulo_observable_.set_observer(&ping_gate_out);
+  uint32_t cycles() { return sys.cycles(); }
 
-  codec.Init(SAMPLE_RATE, &FillBuffer) || Panic();
-}
+  bool codec_ok_;
+  uint32_t codec_reset_;
+};
 
 int main(void) {
-  Init();
+  Board board;
+  Boot(&board, &boot_profile);
   while(1) {
     ui.DoEvents();
-    delay.Poll();
   }
 }
@@ -0,0 +1,78 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech <matthias.puech@gmail.com>
+// Based on code by: Olivier Gillet <ol.gillet@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Bodies of the interrupt handlers. tapo.cc calls them from the
+// handlers, and test/tapo_host.cc from its simulated main loop; both
+// define the objects declared here.
+
+#ifndef TASKS_H_
+#define TASKS_H_
+
+#include "stmlib/system/system_clock.h"
+#include "drivers/codec.hh"
+#include "drivers/dac.hh"
+#include "ui.hh"
+#include "multitap_delay.hh"
+#include "double_buffer.hh"
+
+extern Ui ui;
+extern MultitapDelay delay;
+extern DigOut dac;
+
+extern Parameters parameters;    // written by the control task
+extern DoubleBuffer<Parameters> parameters_snapshot;
+extern SwapBuffer<CvStream> cv_stream; // written by the control task
+
+// audio block, from the codec interrupt
+inline void ProcessBlock(Frame* input, Frame* output) {
+  Parameters block_parameters;
+  parameters_snapshot.Read(&block_parameters);
+  // dac.Write(true);            // profiling
+  delay.Process(&block_parameters, (ShortFrame*)input, (ShortFrame*)output,
+                cv_stream.front());
+  // dac.Write(false);           // profiling
+  if (delay.gate()) {
+    dac.Ping();
+  }
+  dac.Update();
+}
+
+// control task, pended at the end of each block; it runs below the
+// codec interrupt and publishes the parameters for the next block
+inline void ControlTask() {
+  ui.ReadParameters(cv_stream.back());
+  parameters_snapshot.Write(parameters);
+  cv_stream.Publish();
+}
+
+// slow timer for the UI
+inline void UiTask() {
+  ui.Poll();
+  stmlib::system_clock.Tick();  // increment global ms counter.
+}
+
+#endif
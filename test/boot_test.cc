@@ -0,0 +1,225 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Host build of the startup sequence, on simulated peripherals. Each
+// step advances a virtual cycle counter. The flash part of the UI
+// step runs the real Persistent::Init on the mock flash, and is
+// charged the datasheet time of the word programs and erases it does;
+// the other steps are charged estimates of their cost.
+//
+// The device is booted repeatedly, with slot and settings saves in
+// between, during which the stores are compacted in the background as
+// the UI does. Every boot must put the first audio block out within
+// 100ms, and none may erase a sector.
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "boot.hh"
+#include "persistent.hh"
+
+const double kCpuFrequency = 180e6;
+const double kTargetMs = 100.0;
+
+// Estimated costs, in seconds
+const double kSystemCost = 1e-3;           // PLL lock, timers
+const double kTesterCost = 10e-6;          // one GPIO read
+const double kCodecClockCost = 100e-6;     // GPIO, I2S PLL, I2C setup
+const double kCodecSettleTime = 2e-3;      // MCLK to first register write
+const double kSdramCost = 200e-6;          // FMC init sequence
+const double kDelayCost = 50e-6;           // DAC, delay line state
+const double kFlashScanCost = 5e-3;        // reading the 5 store sectors
+const double kUiCost = 500e-6;             // buttons, LEDs, control
+const int kCodecRegisters = 8;
+const double kI2cWriteCost = 30.0 / 50000; // start, 3 bytes with acks, stop
+const double kDmaBandwidth = 80e6;         // memory-to-memory, in bytes/s
+const uint32_t kBlockFrames = 64;
+const uint32_t kDelayBufferBytes = 0x02000000 / 2;
+
+// STM32F42x datasheet, x32 parallelism, typical
+const double kWordProgramTime = 16e-6;
+const double kSectorEraseTime = 1.0;       // 128KB
+
+const int kBoots = 12;
+const int kSavesBetweenBoots = 400;
+
+Persistent persistent;
+size_t background_erases;
+
+struct SimulatedBoard {
+  double now;
+  double reset_released;
+  double sdram_ready;
+  double clear_started;
+  double delay_ready;
+  double ui_ready;
+  double codec_started;
+  size_t programs;
+  size_t erases;
+  bool ok;
+
+  void Init() {
+    now = 0.0;
+    reset_released = sdram_ready = clear_started = -1.0;
+    delay_ready = ui_ready = codec_started = -1.0;
+    ok = true;
+  }
+
+  void Check(bool condition, const char* message) {
+    if (!condition) {
+      printf("ordering: %s\n", message);
+      ok = false;
+    }
+  }
+
+  void InitSystem() { now += kSystemCost; }
+  void RunTesterIfRequested() { now += kTesterCost; }
+
+  void InitCodecClock() {
+    now += kCodecClockCost;
+    reset_released = now;
+  }
+
+  void InitSdram() {
+    now += kSdramCost;
+    sdram_ready = clear_started = now;
+  }
+
+  void InitDelay() {
+    Check(sdram_ready >= 0.0, "delay line before SDRAM");
+    now += kDelayCost;
+    delay_ready = now;
+  }
+
+  void InitUi() {
+    Check(delay_ready >= 0.0, "UI before delay line");
+    programs = mock_flash_programs;
+    erases = mock_flash_erases;
+    persistent.Init(kDelayBufferBytes / sizeof(short));
+    programs = mock_flash_programs - programs;
+    erases = mock_flash_erases - erases;
+    now += kFlashScanCost + kUiCost +
+      programs * kWordProgramTime + erases * kSectorEraseTime;
+    ui_ready = now;
+  }
+
+  void StartCodec() {
+    Check(ui_ready >= 0.0, "codec started before UI");
+    Check(reset_released >= 0.0, "codec started before its clock");
+    if (now < reset_released + kCodecSettleTime) {
+      now = reset_released + kCodecSettleTime;
+    }
+    now += kCodecRegisters * kI2cWriteCost;
+    codec_started = now;
+  }
+
+  uint32_t cycles() {
+    return static_cast<uint32_t>(now * kCpuFrequency);
+  }
+};
+
+double Milliseconds(uint32_t cycles) {
+  return cycles * 1000.0 / kCpuFrequency;
+}
+
+// Saves slots and settings like the UI does, and waits for the writes
+// and the erases
+void Play(int saves) {
+  for (int n=0; n<saves; n++) {
+    Slot slot;
+    slot.size = 1 + rand() % kMaxTaps;
+    for (int i=0; i<slot.size; i++) {
+      slot.taps[i].time = rand() % 48000;
+      slot.taps[i].velocity = 1.0f;
+      slot.taps[i].velocity_type = VELOCITY_AMP;
+      slot.taps[i].panning = 0.5f;
+    }
+    // a few slots are saved over and over
+    persistent.SaveSlot(rand() % 4 ? rand() % 6 : rand() % kNumSlots, &slot);
+    persistent.mutable_data()->current_slot = n % kNumSlots;
+    persistent.SaveData();
+    for (int i=0; i<100; i++) {
+      persistent.Poll();
+      if (persistent.erase_pending()) {
+        persistent.Erase();
+        background_erases++;
+      }
+    }
+  }
+}
+
+int main() {
+  const char* names[BOOT_PHASE_LAST] = {
+    "system", "tester", "codec clock", "sdram", "delay", "ui", "codec",
+    "first block", "buffer cleared",
+  };
+
+  if (!MockFlashOpen(NULL)) {
+    printf("cannot map the flash\n");
+    return 1;
+  }
+
+  bool ok = true;
+  for (int boot=0; boot<kBoots; boot++) {
+    SimulatedBoard board;
+    BootProfile profile;
+    board.Init();
+    Boot(&board, &profile);
+
+    // what the audio and DMA interrupts mark on the hardware
+    board.now = board.codec_started +
+        static_cast<double>(kBlockFrames) / SAMPLE_RATE;
+    profile.Mark(BOOT_FIRST_BLOCK, board.cycles());
+    board.now = board.clear_started + kDelayBufferBytes / kDmaBandwidth;
+    profile.Mark(BOOT_BUFFER_CLEARED, board.cycles());
+
+    ok &= board.ok;
+    for (int i=0; i<BOOT_PHASE_LAST; i++) {
+      ok &= profile.reached(static_cast<BootPhase>(i));
+      if (boot == 0) {
+        printf("%-16s %8.2f ms\n", names[i], Milliseconds(profile.cycles[i]));
+      }
+    }
+    // the audio must not wait for the clear
+    double first_block = Milliseconds(profile.cycles[BOOT_FIRST_BLOCK]);
+    bool boot_ok = board.erases == 0 && first_block <= kTargetMs &&
+      profile.cycles[BOOT_FIRST_BLOCK] < profile.cycles[BOOT_BUFFER_CLEARED];
+    printf("boot %2d after %4d saves  %5zu words programmed, %zu erases, "
+           "first block after %7.2f ms  %s\n",
+           boot, boot * kSavesBetweenBoots, board.programs, board.erases,
+           first_block, boot_ok ? "ok" : "FAIL");
+    ok &= boot_ok;
+
+    Play(kSavesBetweenBoots);
+  }
+
+  // the stores must have been compacted
+  printf("%zu erases in the background\n", background_erases);
+  ok &= background_erases > 0;
+  MockFlashClose();
+  printf(ok ? "ok\n" : "FAILED\n");
+  return ok ? 0 : 1;
+}
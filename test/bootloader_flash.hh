@@ -0,0 +1,165 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+//
+// -----------------------------------------------------------------------------
+// Model of the flash of the STM32F4 for the bootloader tests, with the
+// interface of FlashWriter. It counts the time for which erases and
+// word programs stall the flash bus, and everything the bootloader
+// must never do: programming words which are not erased, touching the
+// bootloader or sectors 7 to 11.
+
+#ifndef BOOTLOADER_FLASH_H_
+#define BOOTLOADER_FLASH_H_
+
+#include <cstring>
+
+#include "bootloader/page_pipeline.hh"
+
+// in ms, per sector size, then per word in us; typical and maximum
+// at 2.7-3.6V, x32 parallelism
+struct FlashTimings {
+  double erase_16k, erase_64k, erase_128k;
+  double program_word;
+};
+
+const FlashTimings kTypicalTimings = { 250.0, 550.0, 1000.0, 16.0 };
+const FlashTimings kWorstTimings = { 500.0, 1100.0, 2000.0, 100.0 };
+
+const uint32_t kFlashBase = kFlashSectorBaseAddress[0];
+const uint32_t kFlashSize = kFlashEndAddress - kFlashBase;
+const uint32_t kApplicationStartAddress = kFlashSectorBaseAddress[2];
+
+class FlashModel {
+ public:
+  void Init(const FlashTimings& timings, bool blocking) {
+    memset(memory_, 0xff, sizeof(memory_));
+    timings_ = timings;
+    blocking_ = blocking;
+    busy_ = false;
+    stall_ = 0.0;
+    longest_stall_ = 0.0;
+    errors_ = 0;
+    trespasses_ = 0;
+    erased_sectors_ = 0;
+    erase_time_ = 0.0;
+  }
+
+  bool busy() { return busy_; }
+
+  void StartFrom(uint32_t address, const uint32_t* source, size_t size) {
+    address_ = address;
+    source_ = source;
+    size_ = size;
+    written_ = 0;
+    busy_ = true;
+    if (address < kApplicationStartAddress ||
+        address + size * 4 > kApplicationEndAddress) {
+      trespasses_++;
+    }
+  }
+
+  bool Step() {
+    if (!busy_) return false;
+    size_t end = blocking_ ? size_ : written_ + kFlashWriterWordsPerStep;
+    if (end > size_) end = size_;
+    size_t words = end - written_;
+    while (written_ < end) {
+      uint32_t* word = reinterpret_cast<uint32_t*>(
+          memory_ + address_ - kFlashBase) + written_;
+      if (*word != 0xffffffff) errors_++;
+      *word &= source_[written_];
+      written_++;
+    }
+    Stall(words * timings_.program_word * 1e-6);
+    if (written_ < size_) return false;
+    busy_ = false;
+    return true;
+  }
+
+  void Flush() {
+    while (busy_) Step();
+  }
+
+  void Erase(uint32_t sector) {
+    Flush();
+    uint32_t base = kFlashSectorBaseAddress[sector];
+    uint32_t size = FlashSectorEnd(sector) - base;
+    memset(memory_ + base - kFlashBase, 0xff, size);
+    if (base < kApplicationStartAddress || base >= kApplicationEndAddress) {
+      trespasses_++;
+    }
+    double time = 1e-3 * (size <= 0x4000 ? timings_.erase_16k :
+                          size <= 0x10000 ? timings_.erase_64k :
+                          timings_.erase_128k);
+    erase_time_ += time;
+    erased_sectors_ |= 1 << sector;
+    Stall(time);
+  }
+
+  // Stall since the last call, in seconds
+  double TakeStall() {
+    double stall = stall_;
+    stall_ = 0.0;
+    return stall;
+  }
+
+  uint8_t* memory(uint32_t address) {
+    return memory_ + address - kFlashBase;
+  }
+
+  double longest_stall() { return longest_stall_; }
+  double erase_time() { return erase_time_; }
+  // programs over non-erased words
+  size_t errors() { return errors_; }
+  // writes outside of the application
+  size_t trespasses() { return trespasses_; }
+  uint32_t erased_sectors() { return erased_sectors_; }
+
+ private:
+  void Stall(double seconds) {
+    stall_ += seconds;
+    if (stall_ > longest_stall_) longest_stall_ = stall_;
+  }
+
+  // as FlashWriter
+  static const size_t kFlashWriterWordsPerStep = 8;
+
+  uint8_t memory_[kFlashSize];
+  FlashTimings timings_;
+  bool blocking_;
+  const uint32_t* source_;
+  uint32_t address_;
+  size_t size_;
+  size_t written_;
+  bool busy_;
+  double stall_;
+  double longest_stall_;
+  size_t errors_;
+  size_t trespasses_;
+  uint32_t erased_sectors_;
+  double erase_time_;
+};
+
+#endif
@@ -0,0 +1,313 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+//
+// -----------------------------------------------------------------------------
+//
+// Host simulation of the bootloader: feeds the WAV written by the
+// encoder (make wav or make wav_compressed) through the demodulator,
+// the packet decoder, the decompressor and the page pipeline of
+// bootloader.cc, on a model of the flash of the STM32F4. Time is
+// counted in samples: erases and word programs stall the flash bus,
+// hence the codec interrupt, and the blocks received in the meantime
+// are lost but the last one, as with the circular DMA. Losing blocks
+// in a pause of the encoder is harmless; losing signal is not, and is
+// reported.
+//
+// usage: bootloader_sim [-m] [-b] [-r bitrate] update.wav [image.bin]
+//   -m  worst-case flash timings of the datasheet instead of typical
+//   -b  blocking writes of whole pages, as without the pipeline
+//   -r  bit rate of the encoder, 12000 by default as in make wav
+// With [image.bin], the flash is compared with it.
+
+#include <getopt.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bootloader/decompressor.hh"
+#include "bootloader/page_pipeline.hh"
+#include "stm_audio_bootloader/qpsk/demodulator.h"
+#include "stm_audio_bootloader/qpsk/packet_decoder.h"
+#include "test/bootloader_flash.hh"
+#include "test/wav_file.hh"
+
+using namespace stm_audio_bootloader;
+
+const double kSampleRate = 48000.0;
+const double kModulationRate = 6000.0;
+double bit_rate = 12000.0;
+const uint32_t kStartAddress = 0x08008000;
+const size_t kCodecBlockSize = 64;      // CODEC_BUFFER_SIZE
+const size_t kDiscardSamples = 8000;
+const int16_t kSilence = 512;           // peak of a lost block in a pause
+
+// The codec interrupt, pushing the input to the demodulator
+class CodecModel {
+ public:
+  void Init(WavReader* reader, Demodulator* demodulator) {
+    reader_ = reader;
+    demodulator_ = demodulator;
+    time_ = 0.0;
+    blocks_ = 0;
+    discard_ = kDiscardSamples;
+    lost_ = 0;
+    lost_signal_ = 0;
+  }
+
+  // Lets [samples] of time pass; while [stalled], the interrupt cannot
+  // run and only the last block survives in the DMA buffer
+  void Advance(double samples, bool stalled) {
+    time_ += samples;
+    size_t due = static_cast<size_t>(time_ / kCodecBlockSize) - blocks_;
+    for (size_t i = 0; i < due; i++) {
+      int16_t block[kCodecBlockSize];
+      reader_->Read(block, kCodecBlockSize, 1);
+      if (stalled && i + 1 < due) {
+        Lose(block);
+      } else {
+        Push(block);
+      }
+    }
+    blocks_ += due;
+  }
+
+  bool done() { return reader_->remaining() == 0; }
+  size_t lost() { return lost_; }
+  size_t lost_signal() { return lost_signal_; }
+  double seconds() { return time_ / kSampleRate; }
+
+ private:
+  void Push(const int16_t* block) {
+    for (size_t i = 0; i < kCodecBlockSize; i++) {
+      if (discard_) {
+        discard_--;
+      } else {
+        demodulator_->PushSample((block[i] >> 4) + 2048);
+      }
+    }
+  }
+
+  void Lose(const int16_t* block) {
+    lost_ += kCodecBlockSize;
+    for (size_t i = 0; i < kCodecBlockSize; i++) {
+      if (block[i] > kSilence || block[i] < -kSilence) {
+        lost_signal_ += kCodecBlockSize;
+        break;
+      }
+    }
+  }
+
+  WavReader* reader_;
+  Demodulator* demodulator_;
+  double time_;
+  size_t blocks_;
+  size_t discard_;
+  size_t lost_;
+  size_t lost_signal_;
+};
+
+WavReader reader;
+FlashModel flash;
+CodecModel codec;
+Demodulator demodulator;
+PacketDecoder decoder;
+PagePipeline<FlashModel> pipeline;
+Decompressor<FlashModel> decompressor;
+
+enum Result {
+  RESULT_RUNNING,
+  RESULT_DONE,
+  RESULT_OVERFLOW,
+  RESULT_ERROR_SYNC,
+  RESULT_ERROR_CRC,
+  RESULT_END_OF_FILE,
+  RESULT_ERROR_DECOMPRESSION,
+  RESULT_ERROR_IMAGE_CRC,
+  RESULT_ERROR_IMAGE_SIZE,
+};
+
+const char* kResultNames[] = {
+  "running", "done", "demodulator overflow", "sync error", "CRC error",
+  "end of file before end of transmission", "decompression error",
+  "image CRC error", "image larger than the application space"
+};
+
+// The main loop of bootloader.cc
+Result Run(bool* compressed, double* backpressure) {
+  decoder.Init(20000);
+  demodulator.Init(kModulationRate / kSampleRate * 4294967296.0,
+                   kSampleRate / kModulationRate, 2.0 * kSampleRate / bit_rate);
+  demodulator.SyncCarrier(true);
+  decoder.Reset();
+  pipeline.Init(&flash, kStartAddress);
+  decompressor.Init(&pipeline);
+  *compressed = false;
+  *backpressure = 0.0;
+  uint16_t packet_index = 0;
+  const uint16_t kPacketsPerBlock = kPageSize / kPacketSize;
+
+  Result result = RESULT_RUNNING;
+  while (result == RESULT_RUNNING) {
+    if (demodulator.state() == DEMODULATOR_STATE_OVERFLOW) {
+      return RESULT_OVERFLOW;
+    }
+    demodulator.ProcessAtLeast(32);
+
+    pipeline.Poll();
+    decompressor.Process();
+    if (decompressor.error()) return RESULT_ERROR_DECOMPRESSION;
+    if (pipeline.error()) return RESULT_ERROR_IMAGE_SIZE;
+    double stall = flash.TakeStall() * kSampleRate;
+    codec.Advance(stall, true);
+
+    bool ready = *compressed ? decompressor.idle() : pipeline.writeable();
+    if (!ready) *backpressure += stall;
+
+    while (demodulator.available() && ready && result == RESULT_RUNNING) {
+      uint8_t symbol = demodulator.NextSymbol();
+      switch (decoder.ProcessSymbol(symbol)) {
+      case PACKET_DECODER_STATE_OK:
+        if (packet_index == 0) {
+          *compressed = IsCompressed(decoder.packet_data());
+          if (*compressed) pipeline.Hold();
+        }
+        if (*compressed) {
+          decompressor.Feed(decoder.packet_data(), kPacketSize);
+          ready = decompressor.idle();
+          if (decompressor.error()) {
+            result = RESULT_ERROR_DECOMPRESSION;
+          } else if (packet_index + 1 == kPacketsPerBlock) {
+            pipeline.EraseTo(kStartAddress + decompressor.image_size());
+          }
+        } else {
+          pipeline.Append(decoder.packet_data(), kPacketSize);
+          ready = pipeline.writeable();
+        }
+        ++packet_index;
+        decoder.Reset();
+        if ((packet_index % kPacketsPerBlock) == 0) {
+          demodulator.SyncCarrier(false);
+        } else {
+          demodulator.SyncDecision();
+        }
+        break;
+      case PACKET_DECODER_STATE_ERROR_SYNC:
+        result = RESULT_ERROR_SYNC;
+        break;
+      case PACKET_DECODER_STATE_ERROR_CRC:
+        result = RESULT_ERROR_CRC;
+        break;
+      case PACKET_DECODER_STATE_END_OF_TRANSMISSION:
+        if (*compressed) {
+          pipeline.EraseTo(kStartAddress + decompressor.image_size());
+        }
+        result = RESULT_DONE;
+        break;
+      default:
+        break;
+      }
+    }
+
+    // nothing to write: idle until the next interrupt
+    if (!stall) {
+      if (codec.done()) return RESULT_END_OF_FILE;
+      codec.Advance(kCodecBlockSize, false);
+    }
+  }
+  pipeline.Flush();
+  if (result == RESULT_DONE && *compressed &&
+      !decompressor.Verify(flash.memory(kStartAddress))) {
+    result = RESULT_ERROR_IMAGE_CRC;
+  }
+  return result;
+}
+
+int main(int argc, char* argv[]) {
+  bool blocking = false;
+  const FlashTimings* timings = &kTypicalTimings;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "mbr:")) != -1) {
+    switch (opt) {
+    case 'm': timings = &kWorstTimings; break;
+    case 'b': blocking = true; break;
+    case 'r': bit_rate = atof(optarg); break;
+    default: return EXIT_FAILURE;
+    }
+  }
+  if (argc - optind < 1) {
+    printf("usage: bootloader_sim [-m] [-b] [-r bitrate] update.wav "
+           "[image.bin]\n");
+    return EXIT_FAILURE;
+  }
+  if (!reader.Open(argv[optind])) {
+    printf("cannot read %s\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+  if (reader.sample_rate() != kSampleRate) {
+    printf("expected %.0fHz, got %uHz\n", kSampleRate, reader.sample_rate());
+    return EXIT_FAILURE;
+  }
+
+  flash.Init(*timings, blocking);
+  codec.Init(&reader, &demodulator);
+  bool compressed;
+  double backpressure;
+  Result result = Run(&compressed, &backpressure);
+
+  printf("%s after %.1fs: %zu pages written from a %s update\n",
+         kResultNames[result], codec.seconds(), pipeline.pages_written(),
+         compressed ? "compressed" : "raw");
+  printf("%.1fs of erase\n", flash.erase_time());
+  printf("longest stall %.1fms, %.1fms of backpressure\n",
+         flash.longest_stall() * 1e3,
+         backpressure * 1e3 / kSampleRate);
+  printf("%zu samples lost, %zu of them with signal\n",
+         codec.lost(), codec.lost_signal());
+
+  bool ok = result == RESULT_DONE && !codec.lost_signal() &&
+    !flash.errors() && !flash.trespasses();
+  if (flash.errors()) printf("%zu words programmed over non-erased flash\n",
+                             flash.errors());
+  if (flash.trespasses()) printf("%zu writes outside of the application\n",
+                                 flash.trespasses());
+
+  if (argc - optind >= 2) {
+    FILE* fp = fopen(argv[optind + 1], "rb");
+    if (!fp) {
+      printf("cannot read %s\n", argv[optind + 1]);
+      return EXIT_FAILURE;
+    }
+    static uint8_t image[kFlashSize];
+    size_t size = fread(image, 1, kFlashBase + kFlashSize - kStartAddress, fp);
+    fclose(fp);
+    bool same = !memcmp(image, flash.memory(kStartAddress), size);
+    printf("image of %zu bytes %s\n", size, same ? "matches" : "DIFFERS");
+    ok &= same;
+  }
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
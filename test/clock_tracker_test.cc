@@ -0,0 +1,138 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+//
+// -----------------------------------------------------------------------------
+//
+// Host test for the clock tracker, fed with jittered synthetic clocks.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "clock_tracker.hh"
+
+// deterministic noise, independent of the host libc
+uint32_t rng_state = 0x21;
+
+float Uniform() {
+  rng_state = rng_state * 1664525L + 1013904223L;
+  return static_cast<float>(rng_state >> 8) / 16777216.0f;
+}
+
+struct Result {
+  int lock_edges;               // edges before the tracker locks
+  float period_error;           // rms, relative to the period
+  float phase_error;            // rms, in samples
+};
+
+enum Disturbance {
+  NONE,
+  SPURIOUS,                     // an extra edge every 7 periods
+  MISSING,                      // every 5th edge is lost
+};
+
+/* Runs a clock of [period] samples with uniform jitter of +/-
+ * [jitter] samples, switching to [new_period] halfway through. The
+ * errors are measured once the tracker had time to settle after
+ * the last change. */
+Result Run(float period, float new_period, float jitter,
+           Disturbance disturbance) {
+  const int kEdges = 400;
+  const int kSettle = 40;
+
+  ClockTracker tracker;
+  tracker.Init(SAMPLE_RATE);
+
+  Result r = { -1, 0.0f, 0.0f };
+  float time = 1000.0f;
+  int measured = 0;
+  double period_sq = 0.0, phase_sq = 0.0;
+
+  for (int i = 0; i < kEdges; i++) {
+    if (i == kEdges / 2) period = new_period;
+    time += period;
+    float edge = time + (2.0f * Uniform() - 1.0f) * jitter;
+
+    if (disturbance == SPURIOUS && i % 7 == 3) {
+      tracker.Tick(static_cast<uint32_t>(edge - period * (0.3f + 0.4f * Uniform())));
+    }
+    if (disturbance == MISSING && i % 5 == 4) {
+      continue;
+    }
+
+    tracker.Tick(static_cast<uint32_t>(edge));
+
+    if (r.lock_edges < 0 && tracker.locked()) {
+      r.lock_edges = i;
+    }
+
+    int since_change = i < kEdges / 2 ? i : i - kEdges / 2;
+    if (since_change >= kSettle) {
+      float p = (tracker.period() - period) / period;
+      float ph = static_cast<float>(
+        static_cast<int32_t>(tracker.last_edge() - static_cast<uint32_t>(time)));
+      period_sq += p * p;
+      phase_sq += ph * ph;
+      measured++;
+    }
+  }
+
+  r.period_error = sqrtf(period_sq / measured);
+  r.phase_error = sqrtf(phase_sq / measured);
+  return r;
+}
+
+bool Check(const char* name, Result r,
+           float max_period_error, float max_phase_error) {
+  bool ok = r.lock_edges >= 0 &&
+    r.period_error < max_period_error &&
+    r.phase_error < max_phase_error;
+  printf("%-28s lock after %3d edges, period error %.5f%%, phase error %6.1f samples  %s\n",
+         name, r.lock_edges, r.period_error * 100.0f, r.phase_error,
+         ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main(void) {
+  bool ok = true;
+
+  // block-quantized edges, as before sample-accurate detection
+  ok &= Check("120bpm, 64 samples jitter",
+              Run(24000.0f, 24000.0f, 64.0f, NONE), 0.0005f, 25.0f);
+  ok &= Check("120bpm, 4 samples jitter",
+              Run(24000.0f, 24000.0f, 4.0f, NONE), 0.0002f, 4.0f);
+  ok &= Check("fast clock, 4 samples jitter",
+              Run(1200.0f, 1200.0f, 4.0f, NONE), 0.0005f, 4.0f);
+  ok &= Check("120 to 140bpm",
+              Run(24000.0f, 20571.4f, 4.0f, NONE), 0.0002f, 4.0f);
+  ok &= Check("120 to 60bpm",
+              Run(24000.0f, 48000.0f, 4.0f, NONE), 0.0002f, 4.0f);
+  ok &= Check("spurious edges",
+              Run(24000.0f, 24000.0f, 4.0f, SPURIOUS), 0.0002f, 4.0f);
+  ok &= Check("missing edges",
+              Run(24000.0f, 24000.0f, 4.0f, MISSING), 0.0002f, 4.0f);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
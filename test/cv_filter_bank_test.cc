@@ -0,0 +1,81 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Host test for the CV filter bank: its step responses must match the
+// FAverage filters it replaces.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "average.hh"
+#include "cv_filter_bank.hh"
+
+// input sequences: steps up and down, and a slow ramp
+float Input(int i, float range) {
+  if (i < 100) return 0.0f;
+  if (i < 400) return range;
+  if (i < 700) return -0.3f * range;
+  if (i < 1000) return 0.0f;
+  return range * sinf(i * 0.01f);
+}
+
+template<int size, int shift>
+bool Compare(const char* name, float range) {
+  FAverage<size> reference;
+  CvFilterBank<3, size, shift> bank;
+  reference.Init();
+  bank.Init();
+
+  // one LSB of each format, plus the truncation of Average
+  float tolerance = 2.0f / (1 << shift) + 1.0f / kResolution;
+  float max_error = 0.0f;
+
+  for (int i = 0; i < 2000; i++) {
+    float x = Input(i, range);
+    // other channels carry different signals, to catch cross-talk
+    float in[3] = { x, -x, 0.5f * range };
+    reference.Process(x);
+    bank.Process(in);
+    float error = fabsf(bank.value(0) - reference.value());
+    if (error > max_error) max_error = error;
+  }
+
+  bool ok = max_error < tolerance &&
+    fabsf(bank.value(2) - 0.5f * range) < tolerance;
+  printf("%-12s max error %.7f (tolerance %.7f)  %s\n",
+         name, max_error, tolerance, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main(void) {
+  bool ok = true;
+  ok &= Compare<32, 14>("pots & CVs", 1.05f);
+  ok &= Compare<8, 14>("tap trigger", 1.0f);
+  ok &= Compare<256, 12>("scale", 4.07f);
+  ok &= Compare<64, 14>("sync ratio", 1.0f);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
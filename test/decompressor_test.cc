@@ -0,0 +1,274 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Host test for compressed updates: images written by the test are
+// compressed by bootloader/compress.py (see make check), then received
+// packet by packet as bootloader.cc does, through the decompressor and
+// the page pipeline, on the flash model. Each image must come back
+// bit-exact with only its sectors erased, and no page may wait for
+// the erase of its sector with the pipeline full while the signal goes
+// on (see page_pipeline_test for the timing). Truncated and corrupted streams must be
+// refused, never accepted with a different image, and never write
+// outside of the application.
+//
+// usage: decompressor_test -w dir   writes the images to dir
+//        decompressor_test dir      checks dir/*.tapz against them
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bootloader/decompressor.hh"
+#include "bootloader/page_pipeline.hh"
+#include "test/bootloader_flash.hh"
+
+const uint32_t kStartAddress = 0x08008000;
+const size_t kPacketSize = 256;
+const size_t kPacketsPerBlock = kPageSize / kPacketSize;
+const size_t kMaxImageSize = kApplicationEndAddress - kStartAddress;
+const size_t kMaxStreamSize = kMaxImageSize * 2;
+
+enum ImageType {
+  IMAGE_CODE,
+  IMAGE_RANDOM,
+  IMAGE_ZEROS
+};
+
+struct Image {
+  const char* name;
+  size_t size;
+  ImageType type;
+};
+
+const Image kImages[] = {
+  { "empty", 0, IMAGE_RANDOM },
+  { "tiny", 100, IMAGE_RANDOM },
+  { "page", kPageSize, IMAGE_CODE },
+  { "code", 200000, IMAGE_CODE },
+  { "random", 3 * kPageSize + 123, IMAGE_RANDOM },
+  { "zeros", 5 * kPageSize, IMAGE_ZEROS },
+  { "largest", kMaxImageSize, IMAGE_CODE },
+};
+const size_t kNumImages = sizeof(kImages) / sizeof(kImages[0]);
+
+FlashModel flash;
+PagePipeline<FlashModel> pipeline;
+Decompressor<FlashModel> decompressor;
+uint8_t image[kMaxImageSize];
+uint8_t stream[kMaxStreamSize];
+uint8_t corrupted[kMaxStreamSize];
+
+// Instructions and constants drawn from a small set of phrases, as in
+// firmware, with some noise
+void Generate(const Image& spec, uint8_t* data) {
+  uint8_t phrases[256][8];
+  srand(spec.size);
+  for (size_t i = 0; i < 256; i++) {
+    for (size_t j = 0; j < 8; j++) phrases[i][j] = rand();
+  }
+  size_t i = 0;
+  while (i < spec.size) {
+    if (spec.type == IMAGE_ZEROS) {
+      data[i++] = 0;
+    } else if (spec.type == IMAGE_RANDOM || rand() % 4 == 0) {
+      data[i++] = rand();
+    } else {
+      const uint8_t* phrase = phrases[(rand() % 64) * (rand() % 4)];
+      for (size_t j = 0; j < 8 && i < spec.size; j++) data[i++] = phrase[j];
+    }
+  }
+}
+
+size_t Load(const char* path, uint8_t* data, size_t max_size) {
+  FILE* fp = fopen(path, "rb");
+  if (!fp) return 0;
+  size_t size = fread(data, 1, max_size, fp);
+  fclose(fp);
+  return size;
+}
+
+enum Outcome {
+  OUTCOME_ACCEPTED,
+  OUTCOME_REFUSED,
+  OUTCOME_HELD
+};
+
+// The main loop, until the previous packet is consumed; false if a
+// page waits for an erase, which only comes in a pause
+bool Consume() {
+  while (!decompressor.idle()) {
+    if (pipeline.held()) return false;
+    pipeline.Poll();
+    decompressor.Process();
+  }
+  return true;
+}
+
+// The reception of bootloader.cc, a packet at a time
+Outcome Receive(const uint8_t* data, size_t size) {
+  flash.Init(kTypicalTimings, false);
+  memset(flash.memory(kStartAddress), 0x5a, kFlashEndAddress - kStartAddress);
+  pipeline.Init(&flash, kStartAddress);
+  decompressor.Init(&pipeline);
+
+  size_t num_packets = (size + kPacketSize - 1) / kPacketSize;
+  for (size_t i = 0; i < num_packets; i++) {
+    if (!Consume()) return OUTCOME_HELD;
+    uint8_t packet[kPacketSize];
+    memset(packet, 0xff, kPacketSize);
+    size_t packet_size = size - i * kPacketSize;
+    if (packet_size > kPacketSize) packet_size = kPacketSize;
+    memcpy(packet, data + i * kPacketSize, packet_size);
+    if (i == 0) {
+      if (!IsCompressed(packet)) return OUTCOME_REFUSED;
+      pipeline.Hold();
+    }
+    decompressor.Feed(packet, kPacketSize);
+    if (decompressor.error() || pipeline.error()) return OUTCOME_REFUSED;
+    if ((i + 1) % kPacketsPerBlock == 0 &&
+        StartsSector(kStartAddress + i / kPacketsPerBlock * kPageSize)) {
+      pipeline.EraseTo(kStartAddress + decompressor.image_size(),
+                       kSectorPauseEraseTime);
+    }
+  }
+  if (!num_packets) return OUTCOME_REFUSED;
+
+  // end of transmission
+  if (!Consume()) return OUTCOME_HELD;
+  pipeline.EraseTo(kStartAddress + decompressor.image_size());
+  pipeline.Flush();
+  return decompressor.Verify(flash.memory(kStartAddress)) ?
+    OUTCOME_ACCEPTED : OUTCOME_REFUSED;
+}
+
+uint32_t SectorsOf(size_t size) {
+  uint32_t sectors = 0;
+  for (uint32_t address = kStartAddress; address < kStartAddress + size;
+       address += kPageSize) {
+    sectors |= 1 << FlashSector(address);
+  }
+  return sectors;
+}
+
+// The bootloader, the settings and the slots are left alone
+bool Untouched() {
+  const uint8_t* settings = flash.memory(kApplicationEndAddress);
+  for (size_t i = 0; i < kFlashEndAddress - kApplicationEndAddress; i++) {
+    if (settings[i] != 0x5a) return false;
+  }
+  return flash.trespasses() == 0 && flash.errors() == 0;
+}
+
+bool Same(size_t size) {
+  return !memcmp(flash.memory(kStartAddress), image, size);
+}
+
+bool Check(const char* dir, const Image& spec) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s.tapz", dir, spec.name);
+  size_t size = Load(path, stream, kMaxStreamSize);
+  if (!size) {
+    printf("cannot read %s\n", path);
+    return false;
+  }
+  Generate(spec, image);
+
+  Outcome outcome = Receive(stream, size);
+  bool ok = outcome == OUTCOME_ACCEPTED && Same(spec.size) && Untouched() &&
+    flash.erased_sectors() == SectorsOf(spec.size);
+
+  // cut anywhere, as by a lost signal
+  size_t truncated = 0;
+  for (size_t n = 0; n < 32 && ok; n++) {
+    size_t cut = rand() % size;
+    Outcome outcome = Receive(stream, cut);
+    ok &= outcome == OUTCOME_REFUSED && Untouched();
+    truncated++;
+  }
+
+  // a packet corrupted past its CRC
+  size_t corruptions = 0;
+  size_t accepted = 0;
+  for (size_t n = 0; n < 256 && ok; n++) {
+    memcpy(corrupted, stream, size);
+    size_t flips = 1 + rand() % 4;
+    for (size_t i = 0; i < flips; i++) {
+      corrupted[rand() % size] ^= 1 << (rand() % 8);
+    }
+    Outcome outcome = Receive(corrupted, size);
+    // the flips can cancel out
+    if (outcome == OUTCOME_ACCEPTED) {
+      ok &= Same(spec.size);
+      accepted++;
+    }
+    ok &= outcome != OUTCOME_HELD && Untouched();
+    corruptions++;
+  }
+
+  printf("%-8s %6zu bytes, stream %3.0f%%, %zu truncated and %zu corrupted "
+         "streams (%zu harmless)  %s\n",
+         spec.name, spec.size, 100.0 * size / (spec.size ? spec.size : 1),
+         truncated, corruptions, accepted, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc == 3 && !strcmp(argv[1], "-w")) {
+    for (size_t i = 0; i < kNumImages; i++) {
+      char path[256];
+      snprintf(path, sizeof(path), "%s/%s.bin", argv[2], kImages[i].name);
+      Generate(kImages[i], image);
+      FILE* fp = fopen(path, "wb");
+      if (!fp || fwrite(image, 1, kImages[i].size, fp) != kImages[i].size) {
+        printf("cannot write %s\n", path);
+        return EXIT_FAILURE;
+      }
+      fclose(fp);
+    }
+    return EXIT_SUCCESS;
+  }
+  if (argc != 2) {
+    printf("usage: decompressor_test [-w] dir\n");
+    return EXIT_FAILURE;
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < kNumImages; i++) {
+    ok &= Check(argv[1], kImages[i]);
+  }
+
+  // a header announcing more than the application space: nothing is
+  // erased
+  memcpy(stream, "TAPZ", 4);
+  uint32_t header[3] = { kMaxImageSize + 4, 0, kPageSize };
+  memcpy(stream + 4, header, sizeof(header));
+  bool refused = Receive(stream, kCompressedHeaderSize) == OUTCOME_REFUSED &&
+    Untouched() && flash.erased_sectors() == 0;
+  printf("oversized image refused  %s\n", refused ? "ok" : "FAIL");
+  ok &= refused;
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
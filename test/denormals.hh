@@ -0,0 +1,62 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+//
+// -----------------------------------------------------------------------------
+//
+// Denormal policy of the host builds: flushed to zero, inputs and
+// results, as the firmware does with FPSCR.FZ (see System). Denormals
+// cost nothing on the M4F but stall x86 by a hundred cycles each, which
+// would make host timings meaningless in decaying tails; flushing on
+// both sides also keeps the host renders close to the module's.
+// The mode is per thread.
+
+#ifndef TEST_DENORMALS_H_
+#define TEST_DENORMALS_H_
+
+#include <stdint.h>
+
+#if defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>
+#endif
+
+const uint32_t kMxcsrFlushToZero = 1 << 15;
+const uint32_t kMxcsrDenormalsAreZero = 1 << 6;
+const uint64_t kFpcrFlushToZero = 1 << 24;
+
+inline void SetFlushDenormals(bool flush) {
+#if defined(__SSE__) || defined(__x86_64__)
+  uint32_t mask = kMxcsrFlushToZero | kMxcsrDenormalsAreZero;
+  _mm_setcsr(flush ? _mm_getcsr() | mask : _mm_getcsr() & ~mask);
+#elif defined(__aarch64__)
+  uint64_t fpcr;
+  asm volatile ("mrs %0, fpcr" : "=r" (fpcr));
+  fpcr = flush ? fpcr | kFpcrFlushToZero : fpcr & ~kFpcrFlushToZero;
+  asm volatile ("msr fpcr, %0" : : "r" (fpcr));
+#endif
+}
+
+inline void FlushDenormals() { SetFlushDenormals(true); }
+
+#endif
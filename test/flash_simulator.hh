@@ -0,0 +1,136 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Host simulator of the STM32F4 flash, with the interface of
+// FlashWriter. Programming can only clear bits, and the power can be
+// cut in the middle of a job.
+
+#ifndef FLASH_SIMULATOR_H_
+#define FLASH_SIMULATOR_H_
+
+#include <cstdlib>
+#include <cstring>
+
+#include "stmlib/stmlib.h"
+
+template<size_t num_sectors, size_t size_of_sector>
+class FlashSimulator {
+ public:
+  void Init() {
+    memset(memory_, 0xff, sizeof(memory_));
+    busy_ = false;
+    powered_ = true;
+    budget_ = -1;
+    errors_ = 0;
+    erases_ = 0;
+  }
+
+  bool busy() { return busy_; }
+  uint32_t* buffer() { return buffer_; }
+
+  const uint32_t* words(uint32_t address) { return memory_ + address / 4; }
+  uint32_t sector_address(uint32_t sector) { return sector * size_of_sector; }
+  uint32_t sector_size(uint32_t sector) { return size_of_sector; }
+
+  void Start(uint32_t address, size_t size) {
+    StartFrom(address, buffer_, size);
+  }
+
+  void StartFrom(uint32_t address, const uint32_t* source, size_t size) {
+    address_ = address;
+    source_ = source;
+    size_ = size;
+    written_ = 0;
+    busy_ = true;
+  }
+
+  bool Step() {
+    if (!busy_ || !powered_) return false;
+
+    while (written_ < size_ && powered_) {
+      uint32_t* word = memory_ + address_ / 4 + written_;
+      uint32_t value = source_[written_];
+      if ((*word & value) != value) errors_++;
+      // an interrupted program leaves some bits unprogrammed
+      *word &= Consume() ? value : value | rand();
+      written_++;
+    }
+
+    if (!powered_) return false;
+    busy_ = false;
+    return true;
+  }
+
+  void Flush() {
+    while (busy_ && powered_) Step();
+  }
+
+  void Erase(uint32_t sector) {
+    Flush();
+    if (!powered_) return;
+    uint32_t* words = memory_ + sector_address(sector) / 4;
+    // an interrupted erase leaves the sector half erased
+    size_t size = Consume() ? size_of_sector : size_of_sector / 2;
+    memset(words, 0xff, size);
+    erases_++;
+  }
+
+  // Cuts the power after [operations] more word programs or erases
+  void CutPowerAfter(int32_t operations) { budget_ = operations; }
+
+  // Restarts the chip after a power cut; the job in progress is lost
+  void PowerCycle() {
+    busy_ = false;
+    powered_ = true;
+    budget_ = -1;
+  }
+
+  bool powered() { return powered_; }
+  size_t errors() { return errors_; }
+  size_t erases() { return erases_; }
+
+ private:
+  bool Consume() {
+    if (budget_ < 0) return true;
+    if (budget_-- > 0) return true;
+    powered_ = false;
+    return false;
+  }
+
+  uint32_t memory_[num_sectors * size_of_sector / 4];
+  uint32_t buffer_[1024];
+  const uint32_t* source_;
+  uint32_t address_;
+  size_t size_;
+  size_t written_;
+  bool busy_;
+  bool powered_;
+  int32_t budget_;
+  size_t errors_;
+  size_t erases_;
+};
+
+#endif
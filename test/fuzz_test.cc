@@ -0,0 +1,455 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+//
+// -----------------------------------------------------------------------------
+//
+// Fuzzer of MultitapDelay::Process: random parameters over the whole
+// range of Control, random CV streams, slots, events and inputs
+// (silence, full-scale square, noise, impulses, DC). After every block,
+// the floating point state of the delay must be finite, within bounds
+// and free of denormals, as flushed by the policy of test/denormals.hh.
+//
+// It then renders a decaying tail with and without flushing, and
+// reports the blocks slowed down by denormals.
+//
+// usage: fuzz_test [-s seed] [-n iterations] [-b blocks per iteration]
+
+#include <time.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "multitap_delay.hh"
+#include "random_generator.hh"
+#include "test/denormals.hh"
+#include "test/render.hh"
+
+const int kBufferSize = 0x02000000 / sizeof(short) / 2;
+const uint32_t kTailDuration = 6 * SAMPLE_RATE;
+const uint32_t kTailBlocks = kTailDuration / kBlockSize;
+
+short buffer[kBufferSize];
+MultitapDelay delay;
+RandomGenerator fuzz_random;
+
+enum InputType {
+  INPUT_SILENCE,
+  INPUT_SQUARE,
+  INPUT_NOISE,
+  INPUT_IMPULSES,
+  INPUT_DC,
+  INPUT_LAST
+};
+
+const char* kInputNames[] = { "silence", "square", "noise", "impulses", "dc" };
+
+// Walks the state of the delay after each block
+struct Checker {
+  const char* failure;
+  float value;
+  int subnormals;
+
+  void Reset() {
+    failure = NULL;
+    subnormals = 0;
+  }
+
+  void Visit(const char* name, const float* x, size_t size, float bound) {
+    for (size_t i = 0; i < size; i++) {
+      if (std::fpclassify(x[i]) == FP_SUBNORMAL) subnormals++;
+      if (!failure && !(std::isfinite(x[i]) && fabsf(x[i]) <= bound)) {
+        failure = name;
+        value = x[i];
+      }
+    }
+  }
+};
+
+uint64_t Nanoseconds() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+bool OneIn(uint32_t n) {
+  return fuzz_random.GetWord() % n == 0;
+}
+
+// mostly uniform in [min, max], with the ends a few times more likely
+float Range(float min, float max) {
+  uint32_t r = fuzz_random.GetWord() % 16;
+  if (r == 0) return min;
+  if (r == 1) return max;
+  return min + (max - min) * fuzz_random.GetFloat();
+}
+
+// the ranges of Control
+void RandomParameters(Parameters* params) {
+  params->gain = Range(0.0f, 3.0f);
+  params->scale = Range(0.0f, 4.0f);
+  params->feedback = Range(0.0f, 1.4f);
+  params->modulation_amount = Range(0.0f, 1.0f);
+  params->modulation_frequency = Range(1e-7f, 0.035f);
+  params->morph = Range(0.0f, 600000.0f);
+  params->drywet = Range(0.0f, 1.0f);
+  params->sync_ratio = Range(0.25f, 4.0f);
+  params->velocity = Range(0.0f, 1.0f);
+  params->velocity_parameter = Range(0.0f, 1.0f);
+  params->edit_mode = static_cast<EditMode>(fuzz_random.GetWord() % 3);
+  params->velocity_type = static_cast<VelocityType>(
+      fuzz_random.GetWord() % 3);
+  params->sequencer_direction = static_cast<SequencerDirection>(
+      fuzz_random.GetWord() % 3);
+  params->panning_mode = static_cast<PanningMode>(fuzz_random.GetWord() % 3);
+}
+
+void RandomSlot(Slot* slot) {
+  if (OneIn(2)) {
+    LoadPreset(fuzz_random.GetWord() % kNumPresets, slot);
+    return;
+  }
+  slot->size = fuzz_random.GetWord() % (kMaxTaps + 1);
+  float time = 0.0f;
+  for (int i = 0; i < slot->size; i++) {
+    time += Range(0.0f, SAMPLE_RATE);
+    slot->taps[i].time = time;
+    slot->taps[i].velocity = Range(0.0f, 1.0f);
+    slot->taps[i].velocity_type = static_cast<VelocityType>(
+        fuzz_random.GetWord() % 3);
+    slot->taps[i].panning = Range(0.0f, 1.0f);
+  }
+}
+
+void RandomInput(InputType type, ShortFrame* input) {
+  short dc = static_cast<short>(Range(-32767.0f, 32767.0f));
+  uint32_t period = 2 + fuzz_random.GetWord() % 512;
+  for (size_t i = 0; i < kBlockSize; i++) {
+    short s = 0;
+    switch (type) {
+    case INPUT_SILENCE: break;
+    case INPUT_SQUARE: s = (i / period) & 1 ? 32767 : -32768; break;
+    case INPUT_NOISE: s = static_cast<short>(fuzz_random.GetWord()); break;
+    case INPUT_IMPULSES: s = OneIn(period) ? 32767 : 0; break;
+    case INPUT_DC: s = dc; break;
+    default: break;
+    }
+    input[i].l = s;
+    input[i].r = OneIn(2) ? s : static_cast<short>(-s);
+  }
+}
+
+void RandomCv(CvStream* cv) {
+  const float kMax[CV_STREAM_LAST] = { 4.0f, 1.4f, 1.0f };
+  for (int c = 0; c < CV_STREAM_LAST; c++) {
+    cv->active[c] = OneIn(4);
+    float value = Range(0.0f, kMax[c]);
+    float slope = Range(-0.1f, 0.1f);
+    for (size_t i = 0; i < kBlockSize; i++) {
+      value = std::min(std::max(value + slope, 0.0f), kMax[c]);
+      cv->values[c][i] = value;
+    }
+  }
+}
+
+// Posts the events of the previous block, at random times in it
+void RandomEvents(Parameters* params, Slot* slot, uint32_t clock) {
+  CommandQueue* q = &delay.ui_commands_;
+  uint32_t from = clock < kBlockSize ? 0 : clock - kBlockSize;
+  uint32_t time = from + fuzz_random.GetWord() % (clock - from + 1);
+  if (OneIn(8)) q->AddTap(params, time);
+  if (OneIn(64)) q->RemoveLastTap();
+  if (OneIn(256)) q->Clear();
+  if (OneIn(128)) {
+    RandomSlot(slot);
+    q->Load(slot);
+  }
+  if (OneIn(64)) q->set_repeat(OneIn(2));
+  if (OneIn(64)) q->ToggleRepeat();
+  if (OneIn(64)) delay.control_commands_.ToggleRepeat();
+  if (OneIn(128)) q->set_sync(OneIn(2));
+  if (OneIn(16)) q->ClockTick(time);
+  if (OneIn(128)) q->RepanTaps(params->panning_mode);
+  if (OneIn(16)) RandomParameters(params);
+}
+
+// false on the first broken invariant
+bool Fuzz(uint32_t seed, uint32_t blocks) {
+  fuzz_random.Init(seed);
+  Parameters params;
+  RandomParameters(&params);
+  Slot slot;
+  RandomSlot(&slot);
+
+  delay.Init(buffer, kBufferSize);
+  delay.ui_commands_.Load(&slot);
+
+  InputType input_type = INPUT_NOISE;
+  Checker checker;
+  CvStream cv;
+
+  for (uint32_t b = 0; b < blocks; b++) {
+    uint32_t clock = b * kBlockSize;
+    if (b) RandomEvents(&params, &slot, clock);
+    if (OneIn(32)) {
+      input_type = static_cast<InputType>(fuzz_random.GetWord() % INPUT_LAST);
+    }
+    ShortFrame input[kBlockSize], output[kBlockSize];
+    RandomInput(input_type, input);
+    RandomCv(&cv);
+
+    Parameters block_params = params;
+    delay.Process(&block_params, input, output, OneIn(2) ? &cv : NULL);
+
+    DelayEvent e;
+    while (delay.events_.Read(&e)) { }
+
+    checker.Reset();
+    delay.VisitState(&checker);
+    if (checker.failure || checker.subnormals) {
+      printf("seed %u, block %u (%s input): ", seed, b,
+             kInputNames[input_type]);
+      if (checker.failure) {
+        printf("%s out of bounds (%g)\n", checker.failure, checker.value);
+      } else {
+        printf("%d denormals in the state\n", checker.subnormals);
+      }
+      return false;
+    }
+  }
+  if (delay.ui_commands_.overflows() || delay.control_commands_.overflows()) {
+    printf("seed %u: commands dropped\n", seed);
+    return false;
+  }
+  return true;
+}
+
+// Toggles posted by the UI and by the repeat gate in the same block
+// cancel out instead of both reading the stale state
+bool ToggleRepeat() {
+  Parameters params;
+  InitParameters(&params);
+  delay.Init(buffer, kBufferSize);
+  ShortFrame input[kBlockSize], output[kBlockSize];
+  RandomInput(INPUT_SILENCE, input);
+
+  const int kToggles[] = { 1, 2, 3 };
+  bool repeat = false;
+  for (int toggles : kToggles) {
+    for (int i = 0; i < toggles; i++) {
+      CommandQueue* q = i % 2 ? &delay.control_commands_ : &delay.ui_commands_;
+      q->ToggleRepeat();
+      repeat = !repeat;
+    }
+    Parameters block_params = params;
+    delay.Process(&block_params, input, output);
+    if (delay.repeat_on() != repeat) {
+      printf("FAIL: %d repeat toggles in a block\n", toggles);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Before a flash erase, the output must fade to silence within a few
+// blocks, and come back after
+bool Mute() {
+  Parameters params;
+  InitParameters(&params);
+  params.drywet = 0.0f;
+  delay.Init(buffer, kBufferSize);
+  ShortFrame input[kBlockSize], output[kBlockSize];
+  ShortFrame dc = { 8192, 8192 };
+  std::fill(input, input + kBlockSize, dc);
+
+  delay.ui_commands_.set_mute(true);
+  int blocks = 0;
+  bool silent = false;
+  for (; blocks < 8 && !silent; blocks++) {
+    Parameters block_params = params;
+    delay.Process(&block_params, input, output);
+    silent = delay.muted();
+    for (size_t i = 0; i < kBlockSize; i++) {
+      silent &= output[i].l == 0 && output[i].r == 0;
+    }
+  }
+
+  delay.ui_commands_.set_mute(false);
+  for (int b = 0; b < 8; b++) {
+    Parameters block_params = params;
+    delay.Process(&block_params, input, output);
+  }
+  bool audible = !delay.muted() && output[kBlockSize - 1].l != 0;
+  if (!silent || !audible) {
+    printf("FAIL: mute, %s\n", silent ? "not unmuted" : "not silent");
+    return false;
+  }
+  return true;
+}
+
+// While the buffer is cleared in the background, the part not cleared
+// yet must read as silence, whatever it holds
+bool Uncleared() {
+  Parameters params;
+  InitParameters(&params);
+  // half cleared
+  std::fill(buffer, buffer + kBufferSize / 2, 0);
+  std::fill(buffer + kBufferSize / 2, buffer + kBufferSize, 12345);
+  delay.Init(buffer, kBufferSize, false);
+  delay.set_buffer_valid(kBufferSize / 2);
+
+  Slot slot;
+  slot.size = 2;
+  for (int i = 0; i < slot.size; i++) {
+    slot.taps[i].time = 10000.0f * (i + 1);
+    slot.taps[i].velocity = 1.0f;
+    slot.taps[i].velocity_type = VELOCITY_AMP;
+    slot.taps[i].panning = 0.5f;
+  }
+  delay.ui_commands_.Load(&slot);
+  params.panning_mode = PANNING_LEFT;
+
+  ShortFrame input[kBlockSize], output[kBlockSize];
+  RandomInput(INPUT_SILENCE, input);
+  int loudest = 0;
+  for (int b = 0; b < 32; b++) {
+    Parameters block_params = params;
+    delay.Process(&block_params, input, output);
+    for (size_t i = 0; i < kBlockSize; i++) {
+      loudest = std::max(loudest, std::abs(output[i].l));
+      loudest = std::max(loudest, std::abs(output[i].r));
+    }
+  }
+  if (loudest > 16) {
+    printf("FAIL: the uncleared buffer is heard (%d)\n", loudest);
+    return false;
+  }
+  return true;
+}
+
+struct TailStats {
+  int subnormal_blocks;
+  double median_ns;
+  double worst_ns;
+  int spikes;                   // blocks over twice the median
+};
+
+// Noise in low-passed taps, then a silence in which the filters decay
+// through the denormal range
+void RenderTail(TailStats* stats) {
+  Parameters params;
+  InitParameters(&params);
+  params.velocity_type = VELOCITY_LP;
+  params.velocity_parameter = 0.0f;
+  params.velocity = 0.05f;
+
+  delay.Init(buffer, kBufferSize);
+  fuzz_random.Init(kRandomDefaultSeed);
+  Checker checker;
+  static double ns[kTailBlocks];
+  stats->subnormal_blocks = 0;
+
+  for (uint32_t b = 0; b < kTailBlocks; b++) {
+    uint32_t clock = b * kBlockSize;
+    for (int i = 1; i <= 8; i++) {
+      uint32_t tap = i * SAMPLE_RATE / 16;
+      if (tap + kBlockSize > clock && tap <= clock) {
+        delay.ui_commands_.AddTap(&params, tap);
+      }
+    }
+    ShortFrame input[kBlockSize], output[kBlockSize];
+    RandomInput(clock < SAMPLE_RATE ? INPUT_NOISE : INPUT_SILENCE, input);
+
+    Parameters block_params = params;
+    uint64_t start = Nanoseconds();
+    delay.Process(&block_params, input, output);
+    ns[b] = Nanoseconds() - start;
+
+    checker.Reset();
+    delay.VisitState(&checker);
+    if (checker.subnormals) stats->subnormal_blocks++;
+  }
+
+  double sorted[kTailBlocks];
+  std::copy(ns, ns + kTailBlocks, sorted);
+  std::sort(sorted, sorted + kTailBlocks);
+  stats->median_ns = sorted[kTailBlocks / 2];
+  stats->worst_ns = sorted[kTailBlocks - 1];
+  stats->spikes = 0;
+  for (uint32_t b = 0; b < kTailBlocks; b++) {
+    if (ns[b] > 2.0 * stats->median_ns) stats->spikes++;
+  }
+}
+
+void PrintTail(const char* name, const TailStats& s) {
+  printf("%-12s %4d blocks with denormals, median %6.0f ns, "
+         "worst %6.0f ns, %d blocks over 2x median\n", name,
+         s.subnormal_blocks, s.median_ns, s.worst_ns, s.spikes);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t seed = 1;
+  uint32_t iterations = 50;
+  uint32_t blocks = 2000;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:n:b:")) != -1) {
+    switch (opt) {
+    case 's': seed = strtoul(optarg, NULL, 0); break;
+    case 'n': iterations = strtoul(optarg, NULL, 0); break;
+    case 'b': blocks = strtoul(optarg, NULL, 0); break;
+    default: return EXIT_FAILURE;
+    }
+  }
+
+  FlushDenormals();
+  uint32_t failures = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    if (!Fuzz(seed + i, blocks)) failures++;
+  }
+  printf("%u/%u iterations of %u blocks ok (seeds %u..%u)\n",
+         iterations - failures, iterations, blocks, seed,
+         seed + iterations - 1);
+
+  if (!ToggleRepeat()) failures++;
+  if (!Mute()) failures++;
+  if (!Uncleared()) failures++;
+
+  TailStats flushed, unflushed;
+  SetFlushDenormals(false);
+  RenderTail(&unflushed);
+  FlushDenormals();
+  RenderTail(&flushed);
+  PrintTail("no flushing", unflushed);
+  PrintTail("flushing", flushed);
+  if (flushed.subnormal_blocks) {
+    printf("FAIL: denormals despite flushing\n");
+    failures++;
+  }
+
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
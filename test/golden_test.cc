@@ -0,0 +1,355 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+//
+// -----------------------------------------------------------------------------
+//
+// Golden-output regression suite: renders a fixed matrix of scenarios
+// on a synthetic input and compares the hash of each output with the
+// references in test/golden.txt. Optionally, in the same run, gates
+// the time per block against a baseline measured on the same machine:
+// test/golden_perf.txt is the one of the CI host, see "make bench".
+//
+// usage: golden_test [-u] [-p perf.txt [-w] [-t percent]]
+//   -u  rewrites the references instead of checking them
+//   -p  compares the ns/block of each scenario with a baseline
+//   -w  writes the baseline instead
+//   -t  tolerated slowdown of the whole suite, in percent (default 10);
+//       slower scenarios are listed, but only the total is gated as
+//       single scenarios are too noisy on a busy host
+
+#include <time.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "multitap_delay.hh"
+#include "test/denormals.hh"
+#include "test/render.hh"
+
+const char* kReferencesPath = "test/golden.txt";
+
+const int kBufferSize = 0x02000000 / sizeof(short) / 2;
+const uint32_t kDuration = 3 * SAMPLE_RATE;
+const int kTimingRuns = 5;
+const int kMaxScenarios = 64;
+
+short buffer[kBufferSize];
+MultitapDelay delay;
+ShortFrame input[kDuration];
+
+struct Scenario {
+  char name[32];
+  int preset;                   // loaded at start, -1 for none
+  bool live_taps;               // tapped during the first second
+  VelocityType velocity_type;
+  float feedback;
+  float modulation;
+  bool sync;                    // clock at 120bpm
+  bool repeat;                  // from 1s to 2s
+  int morph_to;                 // preset loaded at 1.5s, -1 for none
+};
+
+struct Result {
+  uint64_t hash;
+  float rms;
+  double ns_per_block;
+};
+
+Scenario scenarios[kMaxScenarios];
+Result results[kMaxScenarios];
+int num_scenarios;
+
+// deterministic noise, independent of the host libc
+uint32_t rng_state = 0x21;
+
+float Uniform() {
+  rng_state = rng_state * 1664525L + 1013904223L;
+  return static_cast<float>(rng_state >> 8) / 16777216.0f;
+}
+
+// plucks of filtered noise and sine every 300ms, on both channels
+void MakeInput() {
+  float lp = 0.0f, phase = 0.0f, envelope = 0.0f;
+  for (uint32_t i = 0; i < kDuration; i++) {
+    if (i % (SAMPLE_RATE * 3 / 10) == 0) envelope = 1.0f;
+    envelope *= 0.9997f;
+    ONE_POLE(lp, Uniform() * 2.0f - 1.0f, 0.2f);
+    phase += 220.0f / SAMPLE_RATE;
+    if (phase >= 1.0f) phase -= 1.0f;
+    float s = envelope * (0.5f * lp + 0.3f * sinf(2.0f * M_PI * phase));
+    input[i].l = static_cast<short>(s * 16384.0f);
+    input[i].r = static_cast<short>(-s * 12000.0f);
+  }
+}
+
+Scenario* AddScenario(const char* name) {
+  Scenario* s = &scenarios[num_scenarios++];
+  strncpy(s->name, name, sizeof(s->name) - 1);
+  s->name[sizeof(s->name) - 1] = '\0';
+  s->preset = -1;
+  s->live_taps = false;
+  s->velocity_type = VELOCITY_AMP;
+  s->feedback = 0.0f;
+  s->modulation = 0.0f;
+  s->sync = false;
+  s->repeat = false;
+  s->morph_to = -1;
+  return s;
+}
+
+void MakeScenarios() {
+  for (int p = 0; p < kNumPresets; p++) {
+    // the last factory bank is empty: its slots all sound the same
+    if (lut_preset_sizes[p] == 0) continue;
+    char name[32];
+    snprintf(name, sizeof(name), "preset-%02d", p);
+    AddScenario(name)->preset = p;
+  }
+  const char* kVelocityNames[] = { "taps-amp", "taps-lp", "taps-bp" };
+  for (int v = VELOCITY_AMP; v <= VELOCITY_BP; v++) {
+    Scenario* s = AddScenario(kVelocityNames[v]);
+    s->live_taps = true;
+    s->velocity_type = static_cast<VelocityType>(v);
+  }
+  Scenario* s;
+  s = AddScenario("feedback-high");
+  s->preset = 0;
+  s->feedback = 0.95f;
+  s = AddScenario("modulation");
+  s->preset = 2;
+  s->modulation = 0.8f;
+  s = AddScenario("sync-clock");
+  s->preset = 1;
+  s->sync = true;
+  s = AddScenario("repeat");
+  s->live_taps = true;
+  s->repeat = true;
+  s = AddScenario("morph-load");
+  s->preset = 0;
+  s->morph_to = 8;
+}
+
+// CPU time of this thread, so that preemption does not count
+uint64_t Nanoseconds() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void Render(const Scenario& s, Result* r) {
+  Slot slot, morph_slot;
+  if (s.preset >= 0) LoadPreset(s.preset, &slot);
+  if (s.morph_to >= 0) LoadPreset(s.morph_to, &morph_slot);
+
+  Parameters params;
+  InitParameters(&params);
+  params.feedback = s.feedback;
+  params.modulation_amount = s.modulation;
+  params.modulation_frequency = s.modulation * 0.002f;
+  params.velocity_type = s.velocity_type;
+
+  delay.Init(buffer, kBufferSize);
+  CommandQueue* q = &delay.ui_commands_;
+  if (s.preset >= 0) q->Load(&slot);
+  if (s.sync) q->set_sync(true);
+
+  const uint32_t kTaps[] = { SAMPLE_RATE / 4, SAMPLE_RATE * 3 / 5,
+                             SAMPLE_RATE * 4 / 5 };
+  const uint32_t kClockPeriod = SAMPLE_RATE / 2;
+
+  uint64_t hash = 14695981039346656037ULL; // FNV-1a
+  double sum_sq = 0.0;
+  uint64_t ns = 0;
+
+  for (uint32_t clock = 0; clock < kDuration; clock += kBlockSize) {
+    // events of the previous block, with their exact time
+    uint32_t from = clock < kBlockSize ? 0 : clock - kBlockSize;
+    for (size_t i = 0; s.live_taps && i < 3; i++) {
+      if (kTaps[i] >= from && kTaps[i] < clock) {
+        params.velocity = 1.0f - 0.3f * i;
+        q->AddTap(&params, kTaps[i]);
+      }
+    }
+    uint32_t tick = clock / kClockPeriod * kClockPeriod;
+    if (s.sync && tick && tick >= from && tick < clock) {
+      q->ClockTick(tick);
+    }
+    if (s.repeat && clock == SAMPLE_RATE) q->set_repeat(true);
+    if (s.repeat && clock == 2 * SAMPLE_RATE) q->set_repeat(false);
+    if (s.morph_to >= 0 && clock == SAMPLE_RATE * 3 / 2) {
+      params.morph = 0.5f;
+      q->Load(&morph_slot);
+    }
+
+    ShortFrame output[kBlockSize];
+    Parameters block_params = params;
+    uint64_t start = Nanoseconds();
+    delay.Process(&block_params, &input[clock], output);
+    ns += Nanoseconds() - start;
+
+    DelayEvent e;
+    while (delay.events_.Read(&e)) { }
+
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(output);
+    for (size_t i = 0; i < sizeof(output); i++) {
+      hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    for (size_t i = 0; i < kBlockSize; i++) {
+      sum_sq += output[i].l * output[i].l + output[i].r * output[i].r;
+    }
+  }
+  r->hash = hash;
+  r->rms = sqrt(sum_sq / (2.0 * kDuration)) / 32768.0;
+  r->ns_per_block = static_cast<double>(ns) / (kDuration / kBlockSize);
+}
+
+// "<name> <value>" lines; returns the value for [name]
+bool Lookup(FILE* fp, const char* name, char* value) {
+  char line[256];
+  rewind(fp);
+  while (fgets(line, sizeof(line), fp)) {
+    char n[32];
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%31s %63s", n, value) == 2 && !strcmp(n, name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int main(int argc, char* argv[]) {
+  bool update = false;
+  bool write_baseline = false;
+  const char* perf_path = NULL;
+  float tolerance = 10.0f;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "up:wt:")) != -1) {
+    switch (opt) {
+    case 'u': update = true; break;
+    case 'p': perf_path = optarg; break;
+    case 'w': write_baseline = true; break;
+    case 't': tolerance = atof(optarg); break;
+    default: return EXIT_FAILURE;
+    }
+  }
+
+  FlushDenormals();
+  MakeInput();
+  MakeScenarios();
+
+  // the fastest of a few passes over the whole suite, against the
+  // noise of the host
+  for (int i = 0; i < num_scenarios; i++) {
+    Render(scenarios[i], &results[i]);
+  }
+  for (int pass = 1; perf_path && pass < kTimingRuns; pass++) {
+    for (int i = 0; i < num_scenarios; i++) {
+      Result r;
+      Render(scenarios[i], &r);
+      results[i].ns_per_block = std::min(results[i].ns_per_block,
+                                         r.ns_per_block);
+    }
+  }
+
+  bool ok = true;
+
+  if (update) {
+    FILE* fp = fopen(kReferencesPath, "w");
+    if (!fp) {
+      printf("cannot write %s\n", kReferencesPath);
+      return EXIT_FAILURE;
+    }
+    fprintf(fp, "# golden_test references: <scenario> <FNV-1a of output>\n");
+    for (int i = 0; i < num_scenarios; i++) {
+      fprintf(fp, "%s %016llx\n", scenarios[i].name,
+              static_cast<unsigned long long>(results[i].hash));
+    }
+    fclose(fp);
+    printf("%d references written to %s\n", num_scenarios, kReferencesPath);
+  } else {
+    FILE* fp = fopen(kReferencesPath, "r");
+    if (!fp) {
+      printf("cannot read %s\n", kReferencesPath);
+      return EXIT_FAILURE;
+    }
+    for (int i = 0; i < num_scenarios; i++) {
+      char value[64];
+      bool found = Lookup(fp, scenarios[i].name, value);
+      bool match = found && strtoull(value, NULL, 16) == results[i].hash;
+      printf("%-16s rms %.4f  %6.0f ns/block  %s\n", scenarios[i].name,
+             results[i].rms, results[i].ns_per_block,
+             match ? "ok" : found ? "FAIL: output differs" :
+             "FAIL: no reference");
+      ok &= match;
+    }
+    fclose(fp);
+  }
+
+  if (perf_path && write_baseline) {
+    FILE* fp = fopen(perf_path, "w");
+    if (!fp) {
+      printf("cannot write %s\n", perf_path);
+      return EXIT_FAILURE;
+    }
+    fprintf(fp, "# golden_test baseline: <scenario> <ns per block>\n");
+    for (int i = 0; i < num_scenarios; i++) {
+      fprintf(fp, "%s %.0f\n", scenarios[i].name, results[i].ns_per_block);
+    }
+    fclose(fp);
+    printf("baseline written to %s\n", perf_path);
+  } else if (perf_path) {
+    FILE* fp = fopen(perf_path, "r");
+    if (!fp) {
+      printf("cannot read %s\n", perf_path);
+      return EXIT_FAILURE;
+    }
+    double total = 0.0, total_baseline = 0.0;
+    for (int i = 0; i < num_scenarios; i++) {
+      char value[64];
+      if (!Lookup(fp, scenarios[i].name, value)) continue;
+      double baseline = atof(value);
+      double change = 100.0 * (results[i].ns_per_block / baseline - 1.0);
+      total += results[i].ns_per_block;
+      total_baseline += baseline;
+      if (change > tolerance) {
+        printf("%-16s %6.0f ns/block, %+.1f%% over baseline\n",
+               scenarios[i].name, results[i].ns_per_block, change);
+      }
+    }
+    fclose(fp);
+    double change = 100.0 * (total / total_baseline - 1.0);
+    bool fast_enough = total_baseline > 0.0 && change <= tolerance;
+    printf("timing: %+.1f%% over baseline in total  %s\n", change,
+           fast_enough ? "ok" : "FAIL");
+    ok &= fast_enough;
+  }
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
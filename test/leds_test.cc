@@ -0,0 +1,106 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Host test for the LED driver on mock GPIO ports: after each write,
+// the pins hold the same levels as with one GPIO_WriteBit per LED, and
+// only the ports with changed pins are written.
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "drivers/leds.hh"
+
+Leds leds;
+bool values[kNumLeds];          // what the UI asked for
+
+void Set(uint8_t channel, bool value) {
+  leds.set(channel, value);
+  values[channel] = value;
+}
+
+// Pin level of an LED, as written before the shadow framebuffer
+bool ExpectedLevel(int i) {
+  bool v = values[i];
+  if (i >= LED_DELETE_R && i <= LED_REPEAT_B) v = !v;
+  return i < 18 ? !v : v;
+}
+
+// Applies the writes to the mock ports, returns how many were written
+int Apply() {
+  int written = 0;
+  for (int p=0; p<kNumMockPorts; p++) {
+    written += MockApplyBsrr(&mock_ports[p]);
+  }
+  return written;
+}
+
+bool Check() {
+  bool ok = true;
+  for (int i=0; i<kNumLeds; i++) {
+    bool level = LED_GPIOs[i]->ODR & LED_Pins[i];
+    if (level != ExpectedLevel(i)) {
+      printf("led %d: pin %d, expected %d\n", i, level, ExpectedLevel(i));
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+int main() {
+  bool ok = true;
+
+  // garbage before Init
+  for (int p=0; p<kNumMockPorts; p++) {
+    mock_ports[p].ODR = rand();
+  }
+  leds.Init();
+  ok &= Apply() == kNumLedPorts;
+  ok &= Check();
+
+  int writes = 0, changes = 0;
+  for (int n=0; n<10000; n++) {
+    int changed = rand() % 4;
+    for (int k=0; k<changed; k++) {
+      Set(rand() % kNumLeds, rand() & 1);
+    }
+    if (rand() % 100 == 0) {
+      leds.Clear();
+      for (int i=0; i<kNumLeds; i++) values[i] = false;
+    }
+    leds.Write();
+    writes += Apply();
+    changes += changed;
+    ok &= Check();
+  }
+
+  // nothing changed, nothing written
+  leds.Write();
+  ok &= Apply() == 0;
+
+  printf("%d port writes for %d LED changes: %s\n",
+         writes, changes, ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Host implementation of the codec driver: no DMA, the simulated board
+// calls Fill() with one block in mock_codec_rx and takes the output
+// from mock_codec_tx.
+
+#include "drivers/codec.hh"
+
+Codec* Codec::instance_;
+
+Frame mock_codec_rx[CODEC_BUFFER_SIZE];
+Frame mock_codec_tx[CODEC_BUFFER_SIZE];
+
+bool Codec::InitClock(int32_t sample_rate) {
+  return true;
+}
+
+bool Codec::Start(FillBufferCallback cb) {
+  callback_ = cb;
+  instance_ = this;
+  return true;
+}
+
+bool Codec::Init(int32_t sample_rate, FillBufferCallback cb) {
+  return InitClock(sample_rate) && Start(cb);
+}
+
+void Codec::Stop() {
+  instance_ = NULL;
+}
+
+void Codec::Fill(int32_t offset) {
+  (*callback_)(mock_codec_rx, mock_codec_tx);
+}
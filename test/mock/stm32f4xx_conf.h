@@ -0,0 +1,328 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Mock of the peripheral library, the hardware abstraction boundary
+// of the host builds. The drivers run unchanged on top of it:
+// peripherals are plain structs that the simulated board reads and
+// writes (MockApplyBsrr, MockDmaWrite), and the flash is a file mapped
+// at its address on the chip (MockFlashOpen).
+
+#ifndef MOCK_STM32F4XX_CONF_H_
+#define MOCK_STM32F4XX_CONF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum { DISABLE = 0, ENABLE = 1 };
+enum { RESET = 0, SET = 1 };
+enum { Bit_RESET = 0, Bit_SET = 1 };
+typedef int BitAction;
+typedef int FunctionalState;
+
+// GPIO
+
+struct GPIO_TypeDef {
+  volatile uint32_t MODER;
+  volatile uint32_t OTYPER;
+  volatile uint32_t OSPEEDR;
+  volatile uint32_t PUPDR;
+  volatile uint32_t IDR;
+  volatile uint32_t ODR;
+  volatile uint16_t BSRRL;
+  volatile uint16_t BSRRH;
+  volatile uint32_t LCKR;
+  volatile uint32_t AFR[2];
+};
+
+const int kNumMockPorts = 7;
+extern GPIO_TypeDef mock_ports[kNumMockPorts];
+
+#define GPIOA (&mock_ports[0])
+#define GPIOB (&mock_ports[1])
+#define GPIOC (&mock_ports[2])
+#define GPIOD (&mock_ports[3])
+#define GPIOE (&mock_ports[4])
+#define GPIOF (&mock_ports[5])
+#define GPIOG (&mock_ports[6])
+
+// Applies what was written to BSRR to ODR; returns true if the port
+// was written
+bool MockApplyBsrr(GPIO_TypeDef* port);
+
+#define GPIO_Pin_0  ((uint16_t)0x0001)
+#define GPIO_Pin_1  ((uint16_t)0x0002)
+#define GPIO_Pin_2  ((uint16_t)0x0004)
+#define GPIO_Pin_3  ((uint16_t)0x0008)
+#define GPIO_Pin_4  ((uint16_t)0x0010)
+#define GPIO_Pin_5  ((uint16_t)0x0020)
+#define GPIO_Pin_6  ((uint16_t)0x0040)
+#define GPIO_Pin_7  ((uint16_t)0x0080)
+#define GPIO_Pin_8  ((uint16_t)0x0100)
+#define GPIO_Pin_9  ((uint16_t)0x0200)
+#define GPIO_Pin_10 ((uint16_t)0x0400)
+#define GPIO_Pin_11 ((uint16_t)0x0800)
+#define GPIO_Pin_12 ((uint16_t)0x1000)
+#define GPIO_Pin_13 ((uint16_t)0x2000)
+#define GPIO_Pin_14 ((uint16_t)0x4000)
+#define GPIO_Pin_15 ((uint16_t)0x8000)
+
+enum {
+  GPIO_PinSource0, GPIO_PinSource1, GPIO_PinSource2, GPIO_PinSource3,
+  GPIO_PinSource4, GPIO_PinSource5, GPIO_PinSource6, GPIO_PinSource7,
+  GPIO_PinSource8, GPIO_PinSource9, GPIO_PinSource10, GPIO_PinSource11,
+  GPIO_PinSource12, GPIO_PinSource13, GPIO_PinSource14, GPIO_PinSource15,
+};
+
+enum { GPIO_Mode_IN, GPIO_Mode_OUT, GPIO_Mode_AF, GPIO_Mode_AN };
+enum { GPIO_OType_PP, GPIO_OType_OD };
+enum { GPIO_PuPd_NOPULL, GPIO_PuPd_UP, GPIO_PuPd_DOWN };
+enum { GPIO_Speed_2MHz, GPIO_Speed_25MHz, GPIO_Speed_50MHz,
+       GPIO_Speed_100MHz };
+
+struct GPIO_InitTypeDef {
+  uint32_t GPIO_Pin;
+  int GPIO_Mode;
+  int GPIO_Speed;
+  int GPIO_OType;
+  int GPIO_PuPd;
+};
+
+inline void GPIO_StructInit(GPIO_InitTypeDef*) { }
+inline void GPIO_Init(GPIO_TypeDef*, GPIO_InitTypeDef*) { }
+
+inline uint8_t GPIO_ReadInputDataBit(GPIO_TypeDef* port, uint16_t pin) {
+  return (port->IDR & pin) ? Bit_SET : Bit_RESET;
+}
+
+inline void GPIO_WriteBit(GPIO_TypeDef* port, uint16_t pin, BitAction v) {
+  if (v) port->ODR |= pin; else port->ODR &= ~pin;
+}
+
+// RCC
+
+enum {
+  RCC_AHB1Periph_GPIOA = 0x01,
+  RCC_AHB1Periph_GPIOB = 0x02,
+  RCC_AHB1Periph_GPIOC = 0x04,
+  RCC_AHB1Periph_GPIOD = 0x08,
+  RCC_AHB1Periph_GPIOE = 0x10,
+  RCC_AHB1Periph_GPIOF = 0x20,
+  RCC_AHB1Periph_GPIOG = 0x40,
+  RCC_AHB1Periph_DMA2 = 0x400000,
+};
+enum { RCC_APB1Periph_TIM2 = 0x01, RCC_APB1Periph_DAC = 0x20000000 };
+enum { RCC_APB2Periph_ADC1 = 0x100, RCC_APB2Periph_ADC3 = 0x400 };
+
+inline void RCC_AHB1PeriphClockCmd(uint32_t, int) { }
+inline void RCC_APB1PeriphClockCmd(uint32_t, int) { }
+inline void RCC_APB2PeriphClockCmd(uint32_t, int) { }
+
+// DMA: the simulated board writes through MockDmaWrite
+
+struct DMA_Stream_TypeDef {
+  volatile uint32_t NDTR;
+  volatile uint16_t* memory;
+  uint32_t size;
+};
+
+extern DMA_Stream_TypeDef mock_dma2_stream0, mock_dma2_stream4;
+#define DMA2_Stream0 (&mock_dma2_stream0)
+#define DMA2_Stream4 (&mock_dma2_stream4)
+
+struct DMA_InitTypeDef {
+  uint32_t DMA_Channel;
+  uintptr_t DMA_PeripheralBaseAddr;
+  uintptr_t DMA_Memory0BaseAddr;
+  uint32_t DMA_DIR;
+  uint32_t DMA_BufferSize;
+  uint32_t DMA_PeripheralInc;
+  uint32_t DMA_MemoryInc;
+  uint32_t DMA_PeripheralDataSize;
+  uint32_t DMA_MemoryDataSize;
+  uint32_t DMA_Mode;
+  uint32_t DMA_Priority;
+  uint32_t DMA_FIFOMode;
+  uint32_t DMA_FIFOThreshold;
+  uint32_t DMA_MemoryBurst;
+  uint32_t DMA_PeripheralBurst;
+};
+
+enum {
+  DMA_Channel_0, DMA_Channel_2 = 2,
+  DMA_DIR_PeripheralToMemory = 0,
+  DMA_PeripheralInc_Disable = 0,
+  DMA_MemoryInc_Enable = 1,
+  DMA_PeripheralDataSize_HalfWord = 1,
+  DMA_MemoryDataSize_HalfWord = 1,
+  DMA_Mode_Circular = 1,
+  DMA_Priority_High = 2,
+  DMA_FIFOMode_Disable = 0,
+  DMA_FIFOThreshold_HalfFull = 1,
+  DMA_MemoryBurst_Single = 0,
+  DMA_PeripheralBurst_Single = 0,
+};
+
+inline void DMA_Init(DMA_Stream_TypeDef* stream, DMA_InitTypeDef* init) {
+  stream->memory = reinterpret_cast<volatile uint16_t*>(
+      init->DMA_Memory0BaseAddr);
+  stream->size = stream->NDTR = init->DMA_BufferSize;
+}
+
+inline void DMA_Cmd(DMA_Stream_TypeDef*, int) { }
+
+inline uint16_t DMA_GetCurrDataCounter(DMA_Stream_TypeDef* stream) {
+  return stream->NDTR;
+}
+
+// Transfers [size] half-words to a circular stream
+void MockDmaWrite(DMA_Stream_TypeDef* stream, const uint16_t* data,
+                  size_t size);
+
+// ADC
+
+struct ADC_TypeDef {
+  volatile uint32_t DR;
+};
+
+extern ADC_TypeDef mock_adc1, mock_adc3;
+#define ADC1 (&mock_adc1)
+#define ADC3 (&mock_adc3)
+
+struct ADC_CommonInitTypeDef {
+  uint32_t ADC_Mode;
+  uint32_t ADC_Prescaler;
+  uint32_t ADC_DMAAccessMode;
+  uint32_t ADC_TwoSamplingDelay;
+};
+
+struct ADC_InitTypeDef {
+  uint32_t ADC_Resolution;
+  int ADC_ScanConvMode;
+  int ADC_ContinuousConvMode;
+  uint32_t ADC_ExternalTrigConvEdge;
+  uint32_t ADC_ExternalTrigConv;
+  uint32_t ADC_DataAlign;
+  uint8_t ADC_NbrOfConversion;
+};
+
+enum {
+  ADC_Mode_Independent, ADC_Prescaler_Div8, ADC_DMAAccessMode_Disabled,
+  ADC_TwoSamplingDelay_20Cycles, ADC_Resolution_12b,
+  ADC_ExternalTrigConvEdge_Rising, ADC_ExternalTrigConv_T2_TRGO,
+  ADC_DataAlign_Left, ADC_SampleTime_84Cycles,
+};
+enum {
+  ADC_Channel_1 = 1, ADC_Channel_2, ADC_Channel_3, ADC_Channel_4,
+  ADC_Channel_5, ADC_Channel_6, ADC_Channel_7, ADC_Channel_8,
+  ADC_Channel_11 = 11, ADC_Channel_12, ADC_Channel_13, ADC_Channel_14,
+};
+
+inline void ADC_CommonInit(ADC_CommonInitTypeDef*) { }
+inline void ADC_Init(ADC_TypeDef*, ADC_InitTypeDef*) { }
+inline void ADC_DeInit() { }
+inline void ADC_RegularChannelConfig(ADC_TypeDef*, uint8_t, uint8_t,
+                                     uint8_t) { }
+inline void ADC_DMARequestAfterLastTransferCmd(ADC_TypeDef*, int) { }
+inline void ADC_DMACmd(ADC_TypeDef*, int) { }
+inline void ADC_Cmd(ADC_TypeDef*, int) { }
+
+// TIM
+
+struct TIM_TypeDef {
+  volatile uint32_t CNT;
+};
+
+extern TIM_TypeDef mock_tim2;
+#define TIM2 (&mock_tim2)
+
+struct TIM_TimeBaseInitTypeDef {
+  uint16_t TIM_Prescaler;
+  uint16_t TIM_CounterMode;
+  uint32_t TIM_Period;
+  uint16_t TIM_ClockDivision;
+  uint8_t TIM_RepetitionCounter;
+};
+
+enum { TIM_CKD_DIV1, TIM_CounterMode_Up, TIM_TRGOSource_Update };
+
+inline void TIM_TimeBaseStructInit(TIM_TimeBaseInitTypeDef*) { }
+inline void TIM_TimeBaseInit(TIM_TypeDef*, TIM_TimeBaseInitTypeDef*) { }
+inline void TIM_SelectOutputTrigger(TIM_TypeDef*, uint16_t) { }
+inline void TIM_Cmd(TIM_TypeDef*, int) { }
+
+// DAC
+
+struct DAC_InitTypeDef {
+  uint32_t DAC_Trigger;
+  uint32_t DAC_WaveGeneration;
+  uint32_t DAC_LFSRUnmask_TriangleAmplitude;
+  uint32_t DAC_OutputBuffer;
+};
+
+enum {
+  DAC_Trigger_None, DAC_WaveGeneration_None, DAC_TriangleAmplitude_4095,
+  DAC_OutputBuffer_Enable, DAC_Channel_2, DAC_Align_12b_R,
+};
+
+extern uint16_t mock_dac_channel2;
+
+inline void DAC_Init(uint32_t, DAC_InitTypeDef*) { }
+inline void DAC_Cmd(uint32_t, int) { }
+inline void DAC_DeInit() { }
+inline void DAC_SetChannel2Data(uint32_t, uint16_t v) {
+  mock_dac_channel2 = v;
+}
+
+// FLASH: programming can only clear bits
+
+enum FLASH_Status { FLASH_COMPLETE = 9 };
+enum {
+  FLASH_FLAG_EOP = 0x01, FLASH_FLAG_OPERR = 0x02, FLASH_FLAG_WRPERR = 0x10,
+  FLASH_FLAG_PGAERR = 0x20, FLASH_FLAG_PGPERR = 0x40,
+  FLASH_FLAG_PGSERR = 0x80,
+};
+enum { VoltageRange_3 = 2 };
+
+const uint32_t kMockFlashBase = 0x08000000;
+const size_t kMockFlashSize = 0x100000;
+
+// Maps the flash at its address, backed by [path] if not NULL;
+// returns false on failure
+bool MockFlashOpen(const char* path);
+void MockFlashClose();
+
+// word programs and sector erases so far, for the timings of the boot
+// test
+extern size_t mock_flash_programs;
+extern size_t mock_flash_erases;
+
+inline void FLASH_Unlock() { }
+inline void FLASH_Lock() { }
+inline void FLASH_ClearFlag(uint32_t) { }
+FLASH_Status FLASH_EraseSector(uint32_t sector, uint8_t voltage_range);
+FLASH_Status FLASH_ProgramWord(uint32_t address, uint32_t data);
+
+#endif
@@ -0,0 +1,124 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// State of the mock peripherals.
+
+#include "stm32f4xx_conf.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstring>
+
+GPIO_TypeDef mock_ports[kNumMockPorts];
+DMA_Stream_TypeDef mock_dma2_stream0, mock_dma2_stream4;
+ADC_TypeDef mock_adc1, mock_adc3;
+TIM_TypeDef mock_tim2;
+uint16_t mock_dac_channel2;
+
+bool MockApplyBsrr(GPIO_TypeDef* port) {
+  bool written = port->BSRRL || port->BSRRH;
+  port->ODR = (port->ODR | port->BSRRL) & ~port->BSRRH;
+  port->BSRRL = port->BSRRH = 0;
+  return written;
+}
+
+void MockDmaWrite(DMA_Stream_TypeDef* stream, const uint16_t* data,
+                  size_t size) {
+  while (size--) {
+    stream->memory[stream->size - stream->NDTR] = *data++;
+    if (--stream->NDTR == 0) stream->NDTR = stream->size;
+  }
+}
+
+static uint8_t* flash = NULL;
+size_t mock_flash_programs = 0;
+size_t mock_flash_erases = 0;
+
+bool MockFlashOpen(const char* path) {
+  void* address = reinterpret_cast<void*>(kMockFlashBase);
+  int flags = MAP_FIXED_NOREPLACE;
+  int fd = -1;
+
+  if (path) {
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size < static_cast<off_t>(kMockFlashSize)) {
+      // a new flash is erased
+      uint8_t erased[4096];
+      memset(erased, 0xff, sizeof(erased));
+      for (off_t s = size; s < static_cast<off_t>(kMockFlashSize);
+           s += sizeof(erased)) {
+        if (pwrite(fd, erased, sizeof(erased), s) < 0) return false;
+      }
+    }
+    flags |= MAP_SHARED;
+  } else {
+    flags |= MAP_PRIVATE | MAP_ANONYMOUS;
+  }
+
+  void* mapped = mmap(address, kMockFlashSize, PROT_READ | PROT_WRITE,
+                      flags, fd, 0);
+  if (fd >= 0) close(fd);
+  if (mapped != address) return false;
+  flash = static_cast<uint8_t*>(mapped);
+  if (!path) memset(flash, 0xff, kMockFlashSize);
+  return true;
+}
+
+void MockFlashClose() {
+  if (flash) munmap(flash, kMockFlashSize);
+  flash = NULL;
+}
+
+FLASH_Status FLASH_EraseSector(uint32_t sector, uint8_t voltage_range) {
+  sector /= 8;
+  uint32_t start, size;
+  if (sector < 4) {
+    start = sector * 0x4000;
+    size = 0x4000;
+  } else if (sector == 4) {
+    start = 0x10000;
+    size = 0x10000;
+  } else {
+    start = 0x20000 + (sector - 5) * 0x20000;
+    size = 0x20000;
+  }
+  memset(flash + start, 0xff, size);
+  mock_flash_erases++;
+  return FLASH_COMPLETE;
+}
+
+FLASH_Status FLASH_ProgramWord(uint32_t address, uint32_t data) {
+  uint32_t word;
+  memcpy(&word, flash + address - kMockFlashBase, 4);
+  word &= data;
+  memcpy(flash + address - kMockFlashBase, &word, 4);
+  mock_flash_programs++;
+  return FLASH_COMPLETE;
+}
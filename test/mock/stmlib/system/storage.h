@@ -0,0 +1,48 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Mock of stmlib::Storage, found before the real one by the host
+// builds. The host flash never holds data saved by the firmwares that
+// used it, so there is never anything to load.
+
+#ifndef STMLIB_SYSTEM_STORAGE_H_
+#define STMLIB_SYSTEM_STORAGE_H_
+
+#include "stmlib/stmlib.h"
+
+namespace stmlib {
+
+template<uint32_t last_sector_index, uint32_t num_sectors = 1>
+class Storage {
+ public:
+  bool ParsimoniousLoad(void* data, size_t size, uint16_t* token) {
+    return false;
+  }
+};
+
+}  // namespace stmlib
+
+#endif  // STMLIB_SYSTEM_STORAGE_H_
@@ -0,0 +1,109 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Host test for the packed slot format: round trip within one step of
+// each field's resolution, and rejection of corrupted slots.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "packed_slot.hh"
+
+float Uniform() {
+  return static_cast<float>(rand()) / RAND_MAX;
+}
+
+void RandomSlot(Slot* slot) {
+  slot->size = rand() % (kMaxTaps + 1);
+  for (int i=0; i<slot->size; i++) {
+    slot->taps[i].time = Uniform() * 8000000.0f;
+    slot->taps[i].velocity = Uniform();
+    slot->taps[i].velocity_type = static_cast<VelocityType>(rand() % 3);
+    slot->taps[i].panning = Uniform();
+  }
+}
+
+bool RoundTrip() {
+  float max_time = 0.0f, max_velocity = 0.0f, max_panning = 0.0f;
+  bool ok = true;
+
+  for (int n=0; n<1000; n++) {
+    Slot slot, unpacked;
+    PackedSlot packed;
+    RandomSlot(&slot);
+    PackSlot(&slot, &packed);
+    ok &= UnpackSlot(&packed, &unpacked);
+    ok &= unpacked.size == slot.size;
+    for (int i=0; i<slot.size; i++) {
+      TapParameters* a = &slot.taps[i];
+      TapParameters* b = &unpacked.taps[i];
+      max_time = fmaxf(max_time, fabsf(a->time - b->time));
+      max_velocity = fmaxf(max_velocity, fabsf(a->velocity - b->velocity));
+      max_panning = fmaxf(max_panning, fabsf(a->panning - b->panning));
+      ok &= a->velocity_type == b->velocity_type;
+    }
+  }
+
+  ok &= max_time <= 0.5f && max_velocity <= 0.5f / 255.0f + 1e-6f &&
+    max_panning <= 0.5f / 63.0f + 1e-6f;
+  printf("round trip   time %.2f velocity %.5f panning %.5f  %s\n",
+         max_time, max_velocity, max_panning, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+bool Corruption() {
+  bool ok = true;
+  for (int n=0; n<1000; n++) {
+    Slot slot, unpacked;
+    PackedSlot packed;
+    do RandomSlot(&slot); while (slot.size == 0);
+    PackSlot(&slot, &packed);
+    // flip one bit of the used part of the slot
+    uint8_t* bytes = &packed.size;
+    size_t used = 1 + 2 + slot.size * sizeof(PackedTap);
+    size_t byte = rand() % used;
+    bytes[byte] ^= 1 << (rand() % 8);
+    ok &= !UnpackSlot(&packed, &unpacked);
+  }
+
+  Slot slot, unpacked;
+  PackedSlot packed;
+  RandomSlot(&slot);
+  PackSlot(&slot, &packed);
+  packed.version++;
+  ok &= !UnpackSlot(&packed, &unpacked);
+
+  printf("corruption   %s\n", ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main(void) {
+  bool ok = true;
+  ok &= RoundTrip();
+  ok &= Corruption();
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
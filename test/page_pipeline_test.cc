@@ -0,0 +1,323 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Host test for the page pipeline of the bootloader, on the packets of
+// a raw update rather than on its audio: the demodulator and the
+// encoder come from the stm_audio_bootloader submodule (see
+// bootloader_sim for the whole chain). The packets arrive at the bit
+// rate of the encoder, in blocks of a page followed by a pause, while
+// the flash model stalls the codec interrupt for each erase and word
+// program. Over a flash holding an older firmware and settings, at 12
+// to 48 kbit/s and with typical or worst-case timings, the image must
+// be written back bit-exact, each sector erased once and only the
+// sectors of the image, and no stall may fall outside of the pauses.
+//
+// With a directory, the compressed updates written there by make check
+// (see decompressor_test) are received the same way, through the
+// decompressor, with the sectors erased a few at a time in the long
+// pauses.
+//
+// usage: page_pipeline_test [dir]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bootloader/decompressor.hh"
+#include "bootloader/page_pipeline.hh"
+#include "test/bootloader_flash.hh"
+
+const uint32_t kStartAddress = 0x08008000;
+const size_t kPacketSize = 256;
+const size_t kPacketsPerBlock = kPageSize / kPacketSize;
+const size_t kMaxPages = (kApplicationEndAddress - kStartAddress) / kPageSize;
+const double kCodecBlock = 64 / 48000.0;
+// assumed pauses of encoder.py -t stm32f4 after a block which starts a
+// sector, and after the others
+const double kSectorPause = 2.5;
+const double kBlockPause = 0.2;
+// assumed size of the symbol buffer of the demodulator
+const size_t kSymbolBufferSize = 128;
+
+FlashModel flash;
+PagePipeline<FlashModel> pipeline;
+Decompressor<FlashModel> decompressor;
+uint8_t image[kMaxPages * kPageSize + kPageSize];
+uint8_t stream[2 * kMaxPages * kPageSize];
+
+// Start and end of the signal of each block
+double block_start[kMaxPages + 1];
+double block_end[kMaxPages + 1];
+size_t num_blocks;
+
+void Encode(double bit_rate, size_t blocks) {
+  double time = 0.0;
+  for (size_t i = 0; i < blocks; i++) {
+    uint32_t address = kStartAddress + i * kPageSize;
+    block_start[i] = time;
+    time += kPacketsPerBlock * kPacketSize * 8 / bit_rate;
+    block_end[i] = time;
+    time += FlashSector(address) != FlashSector(address - 1) ?
+      kSectorPause : kBlockPause;
+  }
+  num_blocks = blocks;
+}
+
+double PacketEnd(size_t packet) {
+  size_t block = packet / kPacketsPerBlock;
+  double packet_time =
+    (block_end[block] - block_start[block]) / kPacketsPerBlock;
+  return block_start[block] + (packet % kPacketsPerBlock + 1) * packet_time;
+}
+
+// of signal between [start] and [end]
+double Signal(double start, double end) {
+  double signal = 0.0;
+  for (size_t i = 0; i < num_blocks; i++) {
+    double a = start > block_start[i] ? start : block_start[i];
+    double b = end < block_end[i] ? end : block_end[i];
+    if (b > a) signal += b - a;
+  }
+  return signal;
+}
+
+// Over the stall of the flash, the codec interrupt only keeps the last
+// block of the DMA buffer
+double Stall(double* time) {
+  double stall = flash.TakeStall();
+  double lost = stall > kCodecBlock ?
+    Signal(*time, *time + stall - kCodecBlock) : 0.0;
+  *time += stall;
+  return lost;
+}
+
+// Fills the flash with an older firmware and settings, and the image
+// with random words
+void Prepare(const FlashTimings& timings, size_t num_pages) {
+  flash.Init(timings, false);
+  memset(flash.memory(kStartAddress), 0x5a, kFlashEndAddress - kStartAddress);
+  for (size_t i = 0; i < num_pages * kPageSize; i++) {
+    image[i] = rand();
+  }
+  pipeline.Init(&flash, kStartAddress);
+}
+
+bool Untouched() {
+  const uint8_t* settings = flash.memory(kApplicationEndAddress);
+  for (size_t i = 0; i < kFlashEndAddress - kApplicationEndAddress; i++) {
+    if (settings[i] != 0x5a) return false;
+  }
+  return flash.trespasses() == 0;
+}
+
+uint32_t SectorsOf(size_t num_pages) {
+  uint32_t sectors = 0;
+  for (size_t i = 0; i < num_pages; i++) {
+    sectors |= 1 << FlashSector(kStartAddress + i * kPageSize);
+  }
+  return sectors;
+}
+
+// The main loop of bootloader.cc on a raw update
+bool Transfer(double bit_rate, const FlashTimings& timings,
+              const char* timings_name, size_t num_pages) {
+  Prepare(timings, num_pages);
+  Encode(bit_rate, num_pages);
+
+  size_t num_packets = num_pages * kPacketsPerBlock;
+  size_t packet = 0;
+  double time = 0.0;
+  double lost = 0.0;
+  double held = 0.0;
+  bool overflow = false;
+  while ((packet < num_packets || pipeline.busy()) && !pipeline.error()) {
+    double start = time;
+    pipeline.Poll();
+    lost += Stall(&time);
+    if (time == start) time += kCodecBlock;
+
+    bool ready = pipeline.writeable();
+    while (ready && packet < num_packets && PacketEnd(packet) <= time) {
+      pipeline.Append(image + packet * kPacketSize, kPacketSize);
+      ready = pipeline.writeable();
+      packet++;
+      lost += Stall(&time);
+    }
+
+    // the symbols wait in the demodulator
+    held = ready ? 0.0 : held + Signal(start, time);
+    overflow |= held * bit_rate / 2 > kSymbolBufferSize;
+  }
+
+  bool ok = !pipeline.error() && !overflow && lost == 0.0 &&
+    !memcmp(flash.memory(kStartAddress), image, num_pages * kPageSize) &&
+    flash.errors() == 0 && Untouched() &&
+    flash.erased_sectors() == SectorsOf(num_pages);
+  printf("%2.0f kbit/s, %s: %2zu pages in %5.1fs, %.2fs of erase, "
+         "longest stall %4.0fms, %s%.1fms of signal lost  %s\n",
+         bit_rate / 1000, timings_name, num_pages, time, flash.erase_time(),
+         flash.longest_stall() * 1e3, overflow ? "overflow, " : "",
+         lost * 1e3, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+// The main loop of bootloader.cc on a compressed update, padded by the
+// encoder to whole blocks
+bool TransferCompressed(double bit_rate, const FlashTimings& timings,
+                        const char* timings_name, const char* dir,
+                        const char* name) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s.tapz", dir, name);
+  FILE* fp = fopen(path, "rb");
+  size_t size = fp ? fread(stream, 1, sizeof(stream), fp) : 0;
+  if (fp) fclose(fp);
+  size_t blocks = (size + kPageSize - 1) / kPageSize;
+  if (!size || blocks > kMaxPages + 1) {
+    printf("cannot read %s\n", path);
+    return false;
+  }
+  memset(stream + size, 0xff, blocks * kPageSize - size);
+
+  flash.Init(timings, false);
+  memset(flash.memory(kStartAddress), 0x5a, kFlashEndAddress - kStartAddress);
+  pipeline.Init(&flash, kStartAddress);
+  decompressor.Init(&pipeline);
+  Encode(bit_rate, blocks);
+
+  size_t num_packets = blocks * kPacketsPerBlock;
+  size_t packet = 0;
+  double time = 0.0;
+  double lost = 0.0;
+  double held = 0.0;
+  bool overflow = false;
+  // until the end of transmission, which is only read once the last
+  // packet is consumed
+  while ((packet < num_packets ||
+          (!decompressor.idle() && !pipeline.held())) &&
+         !decompressor.error() && !pipeline.error()) {
+    double start = time;
+    pipeline.Poll();
+    decompressor.Process();
+    lost += Stall(&time);
+    if (time == start) time += kCodecBlock;
+
+    bool ready = decompressor.idle();
+    while (ready && packet < num_packets && PacketEnd(packet) <= time) {
+      if (packet == 0) pipeline.Hold();
+      decompressor.Feed(stream + packet * kPacketSize, kPacketSize);
+      ready = decompressor.idle();
+      size_t block = packet / kPacketsPerBlock;
+      if ((packet + 1) % kPacketsPerBlock == 0 &&
+          StartsSector(kStartAddress + block * kPageSize)) {
+        pipeline.EraseTo(kStartAddress + decompressor.image_size(),
+                         kSectorPauseEraseTime);
+      }
+      packet++;
+      lost += Stall(&time);
+    }
+
+    held = ready ? 0.0 : held + Signal(start, time);
+    overflow |= held * bit_rate / 2 > kSymbolBufferSize;
+  }
+
+  // end of transmission
+  bool consumed = decompressor.idle();
+  pipeline.EraseTo(kStartAddress + decompressor.image_size());
+  pipeline.Flush();
+  size_t num_pages = (decompressor.image_size() + kPageSize - 1) / kPageSize;
+  bool ok = consumed && !decompressor.error() && !pipeline.error() &&
+    !overflow && lost == 0.0 &&
+    decompressor.Verify(flash.memory(kStartAddress)) &&
+    flash.errors() == 0 && Untouched() &&
+    flash.erased_sectors() == SectorsOf(num_pages);
+  printf("%2.0f kbit/s, %s: %-7s %2zu blocks in %5.1fs, %.2fs of erase, "
+         "longest stall %4.0fms, %s%.1fms of signal lost  %s\n",
+         bit_rate / 1000, timings_name, name, blocks, time,
+         flash.erase_time(), flash.longest_stall() * 1e3,
+         overflow ? "overflow, " : "", lost * 1e3, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+// Pages held back until the sectors of the image are erased at once
+bool Held() {
+  Prepare(kTypicalTimings, 3);
+  pipeline.Hold();
+  pipeline.Append(image, kPageSize);
+  pipeline.Append(image + kPageSize, kPageSize);
+  pipeline.Poll();
+  bool ok = !pipeline.writeable() && flash.erased_sectors() == 0 &&
+    !flash.busy();
+  pipeline.EraseTo(kStartAddress + 3 * kPageSize);
+  ok &= flash.erased_sectors() == SectorsOf(3);
+  pipeline.Flush();
+  pipeline.Append(image + 2 * kPageSize, kPageSize);
+  pipeline.Flush();
+  ok &= !memcmp(flash.memory(kStartAddress), image, 3 * kPageSize) &&
+    flash.errors() == 0 && Untouched() &&
+    flash.erased_sectors() == SectorsOf(3);
+  printf("3 pages held, then erased at once  %s\n", ok ? "ok" : "FAIL");
+  return ok;
+}
+
+// An image running into the settings is refused at its first page past
+// the application
+bool TooLarge() {
+  Prepare(kTypicalTimings, kMaxPages + 1);
+  for (size_t i = 0; i < kMaxPages + 1; i++) {
+    pipeline.Append(image + i * kPageSize, kPageSize);
+    pipeline.Flush();
+  }
+  pipeline.EraseTo(kFlashEndAddress);
+  bool ok = pipeline.error() && pipeline.pages_written() == kMaxPages &&
+    flash.errors() == 0 && Untouched() &&
+    flash.erased_sectors() == SectorsOf(kMaxPages);
+  printf("image of %zu pages refused  %s\n", kMaxPages + 1, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  bool ok = true;
+  const double kBitRates[] = { 12000.0, 24000.0, 48000.0 };
+  for (size_t i = 0; i < 3; i++) {
+    ok &= Transfer(kBitRates[i], kTypicalTimings, "typical", 9);
+    ok &= Transfer(kBitRates[i], kTypicalTimings, "typical", kMaxPages);
+    ok &= Transfer(kBitRates[i], kWorstTimings, "worst  ", kMaxPages);
+  }
+  if (argc == 2) {
+    const char* kStreams[] = { "code", "largest", "random", "zeros" };
+    for (size_t i = 0; i < 3; i++) {
+      for (size_t j = 0; j < 4; j++) {
+        ok &= TransferCompressed(kBitRates[i], kTypicalTimings, "typical",
+                                 argv[1], kStreams[j]);
+        ok &= TransferCompressed(kBitRates[i], kWorstTimings, "worst  ",
+                                 argv[1], kStreams[j]);
+      }
+    }
+  }
+  ok &= Held();
+  ok &= TooLarge();
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
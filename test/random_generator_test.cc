@@ -0,0 +1,112 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+//
+// -----------------------------------------------------------------------------
+//
+// Host test for the per-instance random generator.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "random_generator.hh"
+
+bool Check(const char* name, bool ok) {
+  printf("%-36s %s\n", name, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+// same seed, same sequence; another seed, another sequence
+bool Reproducible() {
+  RandomGenerator a, b, c;
+  a.Init(1234);
+  b.Init(1234);
+  c.Init(1235);
+  int differ = 0;
+  for (int i = 0; i < 1000; i++) {
+    uint32_t x = a.GetWord();
+    if (x != b.GetWord()) return false;
+    differ += x != c.GetWord();
+  }
+  return differ > 990;
+}
+
+// two instances do not disturb each other
+bool Independent() {
+  RandomGenerator a, b, reference;
+  a.Init();
+  b.Init();
+  reference.Init();
+  for (int i = 0; i < 1000; i++) {
+    b.GetWord();
+    if (a.GetWord() != reference.GetWord()) return false;
+  }
+  return true;
+}
+
+bool FillRange() {
+  RandomGenerator r;
+  r.Init();
+  float block[64];
+  float min = 1.0f, max = -1.0f;
+  double sum = 0.0, sum_sq = 0.0;
+  const int kBlocks = 10000;
+  for (int n = 0; n < kBlocks; n++) {
+    r.Fill(block, 64, 0.5f);
+    for (int i = 0; i < 64; i++) {
+      if (block[i] < min) min = block[i];
+      if (block[i] > max) max = block[i];
+      sum += block[i];
+      sum_sq += block[i] * block[i];
+    }
+  }
+  double count = kBlocks * 64.0;
+  double mean = sum / count;
+  double variance = sum_sq / count - mean * mean;
+  // uniform on [-0.5..0.5): mean 0, variance 1/12
+  return min >= -0.5f && max <= 0.5f && min < -0.499f && max > 0.499f &&
+    fabs(mean) < 0.002 && fabs(variance - 1.0 / 12.0) < 0.001;
+}
+
+bool FloatRange() {
+  RandomGenerator r;
+  r.Init(0);                    // zero is not a fixed point
+  double sum = 0.0;
+  for (int i = 0; i < 100000; i++) {
+    float x = r.GetFloat();
+    if (x < 0.0f || x >= 1.0f) return false;
+    sum += x;
+  }
+  return fabs(sum / 100000 - 0.5) < 0.005;
+}
+
+int main(void) {
+  bool ok = true;
+  ok &= Check("same seed, same sequence", Reproducible());
+  ok &= Check("instances are independent", Independent());
+  ok &= Check("block fill range and moments", FillRange());
+  ok &= Check("single draws in [0..1)", FloatRange());
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
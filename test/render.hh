@@ -0,0 +1,125 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+//
+// -----------------------------------------------------------------------------
+//
+// Parameters and slots shared by the offline renderers.
+
+#ifndef TEST_RENDER_H_
+#define TEST_RENDER_H_
+
+#include <cstdlib>
+#include <cstring>
+
+#include "parameters.hh"
+#include "resources.h"
+
+const int kNumPresets = LUT_PRESET_SIZES_SIZE;
+
+// as tapo_test
+inline void InitParameters(Parameters* params) {
+  params->gain = 1.0f;
+  params->scale = 0.3f;
+  params->feedback = 0.0f;
+  params->modulation_amount = 0.0f;
+  params->modulation_frequency = 0.0f;
+  params->morph = 0.01f;          // > 0.0f otherwise clicks
+  params->drywet = 1.0f;
+  params->sync_ratio = 1.0f;
+  params->velocity = 1.0f;
+  params->edit_mode = EDIT_NORMAL;
+  params->velocity_type = VELOCITY_AMP;
+  params->sequencer_direction = DIRECTION_FORWARD;
+  params->velocity_parameter = 0.5f;
+  params->panning_mode = PANNING_ALTERNATE;
+}
+
+struct FloatParameter {
+  const char* name;
+  float Parameters::* field;
+};
+
+const FloatParameter kFloatParameters[] = {
+  { "gain", &Parameters::gain },
+  { "scale", &Parameters::scale },
+  { "feedback", &Parameters::feedback },
+  { "modulation_amount", &Parameters::modulation_amount },
+  { "modulation_frequency", &Parameters::modulation_frequency },
+  { "morph", &Parameters::morph },
+  { "drywet", &Parameters::drywet },
+  { "sync_ratio", &Parameters::sync_ratio },
+  { "velocity", &Parameters::velocity },
+  { "velocity_parameter", &Parameters::velocity_parameter },
+  { NULL, NULL }
+};
+
+// Sets any field of Parameters by name; false if unknown or out of range
+inline bool SetParameter(Parameters* params,
+                         const char* name, const char* value) {
+  for (const FloatParameter* p = kFloatParameters; p->name; p++) {
+    if (!strcmp(p->name, name)) {
+      params->*(p->field) = atof(value);
+      return true;
+    }
+  }
+  int v = atoi(value);
+  if (v < 0 || v > 2) return false;
+  if (!strcmp(name, "edit_mode")) {
+    params->edit_mode = static_cast<EditMode>(v);
+  } else if (!strcmp(name, "velocity_type")) {
+    params->velocity_type = static_cast<VelocityType>(v);
+  } else if (!strcmp(name, "sequencer_direction")) {
+    params->sequencer_direction = static_cast<SequencerDirection>(v);
+  } else if (!strcmp(name, "panning_mode")) {
+    params->panning_mode = static_cast<PanningMode>(v);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Factory slot from the preset tables
+inline void LoadPreset(int preset, Slot* slot) {
+  slot->size = lut_preset_sizes[preset];
+  for (int i=0; i<slot->size; i++) {
+    int index = preset * kMaxTaps + i;
+    slot->taps[i].time = lut_preset_times[index];
+    slot->taps[i].velocity = lut_preset_velos[index];
+    slot->taps[i].velocity_type =
+        static_cast<VelocityType>(lut_preset_types[index]);
+    slot->taps[i].panning = lut_preset_pans[index];
+  }
+}
+
+// exact for the sample times printed by SamplesToMs
+inline uint32_t MsToSamples(double ms) {
+  return static_cast<uint32_t>(ms * SAMPLE_RATE / 1000.0 + 0.5);
+}
+
+inline double SamplesToMs(uint32_t samples) {
+  return samples * 1000.0 / SAMPLE_RATE;
+}
+
+#endif
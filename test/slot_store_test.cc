@@ -0,0 +1,174 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Host test for the log-structured slot store on a simulated flash of
+// the size of the firmware's: random saves with power cuts in the
+// middle of programs, and of the background compaction between saves. After every reboot, each slot must read
+// back its last saved content, or the previous one for the slot being
+// written. The log must never refuse a save, and sectors must never
+// be erased in the middle of a write.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "test/flash_simulator.hh"
+#include "slot_store.hh"
+
+const size_t kSlots = 96;
+const size_t kSectors = 4;
+
+typedef FlashSimulator<kSectors, 0x20000> Flash;
+typedef SlotStore<Flash, kSlots> Store;
+
+Flash flash;
+Store store;
+PackedSlot expected[kSlots];
+bool present[kSlots];
+size_t reboots;
+size_t cuts;
+size_t formats;
+size_t erases_while_saving;
+
+void RandomPackedSlot(PackedSlot* packed) {
+  Slot slot;
+  slot.size = rand() % (kMaxTaps + 1);
+  for (int i=0; i<slot.size; i++) {
+    slot.taps[i].time = rand() % 1000000;
+    slot.taps[i].velocity = (rand() % 256) / 255.0f;
+    slot.taps[i].velocity_type = static_cast<VelocityType>(rand() % 3);
+    slot.taps[i].panning = (rand() % 64) / 63.0f;
+  }
+  PackSlot(&slot, packed);
+}
+
+// [pending] is the slot that was being written, if any
+bool Boot(int pending, const PackedSlot* next) {
+  flash.PowerCycle();
+  if (!store.Init(&flash, 0, kSectors)) {
+    store.Format();
+  }
+  reboots++;
+
+  bool ok = true;
+  for (size_t slot=0; slot<kSlots; slot++) {
+    PackedSlot packed;
+    bool read = store.Read(slot, &packed);
+    bool same = read == present[slot] &&
+      (!read || !memcmp(&packed, &expected[slot], sizeof(packed)));
+    if (!same && static_cast<int>(slot) == pending &&
+        read && !memcmp(&packed, next, sizeof(packed))) {
+      // the interrupted write made it
+      expected[slot] = *next;
+      present[slot] = true;
+      same = true;
+    }
+    ok &= same;
+  }
+
+  if (store.jammed()) {
+    // like Persistent, start again from the slots in RAM
+    store.Format();
+    for (size_t slot=0; slot<kSlots; slot++) {
+      if (present[slot]) store.Write(slot, &expected[slot]);
+      flash.Flush();
+    }
+    formats++;
+  }
+  return ok;
+}
+
+// Polls the store like Persistent does until the save is done or the
+// power is cut; returns false if the store refused the write
+bool Save(size_t slot, const PackedSlot* packed) {
+  if (!store.Write(slot, packed)) return false;
+  while (flash.busy() && flash.powered()) {
+    flash.Step();
+  }
+  return true;
+}
+
+// Compacts in the background like Persistent: moves the live records
+// one write at a time, then erases the sector once the UI has muted the
+// output. False if the power was cut
+bool Collect() {
+  while (flash.powered() && store.Collect()) {
+    while (flash.busy() && flash.powered()) {
+      flash.Step();
+    }
+  }
+  if (flash.powered() && store.reclaimable()) {
+    if (flash.busy()) erases_while_saving++;
+    store.Reclaim();
+  }
+  return flash.powered();
+}
+
+int main(void) {
+  flash.Init();
+  bool ok = Boot(-1, NULL);
+
+  size_t refused = 0;
+  for (int n=0; n<20000 && ok; n++) {
+    // a few slots are saved over and over, so that the others stay
+    // live in old sectors and must be moved before these are erased
+    size_t slot = rand() % 4 ? rand() % 6 : rand() % kSlots;
+    PackedSlot packed;
+    RandomPackedSlot(&packed);
+
+    bool cut = rand() % 16 == 0;
+    if (cut) flash.CutPowerAfter(rand() % (4 * Store::kRecordWords));
+
+    if (!Collect()) {
+      cuts++;
+      ok &= Boot(-1, NULL);
+      continue;
+    }
+    if (!Save(slot, &packed)) {
+      refused++;
+      flash.CutPowerAfter(-1);
+      continue;
+    }
+    if (flash.powered()) {
+      flash.CutPowerAfter(-1);
+      expected[slot] = packed;
+      present[slot] = true;
+    } else {
+      cuts++;
+      ok &= Boot(slot, &packed);
+    }
+  }
+
+  ok &= Boot(-1, NULL);
+  ok &= flash.errors() == 0;
+  ok &= erases_while_saving == 0;
+  ok &= refused == 0;
+  printf("%zu reboots, %zu power cuts, %zu formats, %zu erases "
+         "(%zu while saving), %zu saves refused, %zu program errors  %s\n",
+         reboots, cuts, formats, flash.erases(), erases_while_saving,
+         refused, flash.errors(), ok ? "ok" : "FAIL");
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
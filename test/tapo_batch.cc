@@ -0,0 +1,348 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+//
+// -----------------------------------------------------------------------------
+//
+// Batch renderer: every factory preset on every input, with every
+// parameter set, on all cores. Each worker owns a delay and its
+// buffer; jobs are spread evenly at start, and a worker that runs out
+// steals half of the remaining jobs of another.
+//
+// usage: tapo_batch [-j threads] [-d seconds] [-p sets.txt] [-o dir]
+//                   input.wav...
+//
+// A parameter set is a line of "<parameter> <value>" pairs, applied
+// over the defaults of test/render.hh. Outputs, if requested, are
+// named <dir>/<input>-p<preset>-s<set>.wav.
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "multitap_delay.hh"
+#include "test/denormals.hh"
+#include "test/render.hh"
+#include "test/wav_file.hh"
+
+const int kBufferSize = 0x02000000 / sizeof(short) / 2;
+const int kMaxInputs = 256;
+const int kMaxParameterSets = 64;
+const int kMaxWorkers = 64;
+
+const char* inputs[kMaxInputs];
+int num_inputs;
+
+Parameters parameter_sets[kMaxParameterSets];
+int num_parameter_sets;
+
+Slot presets[kNumPresets];
+
+const char* output_dir;
+float duration = -1.0f;
+
+struct Job {
+  int input;
+  int preset;
+  int parameter_set;
+};
+
+struct Result {
+  bool ok;
+  uint32_t num_frames;
+  uint64_t ns;
+  int32_t peak;
+};
+
+Job* jobs;
+Result* results;
+int num_jobs;
+
+// A range of jobs; the owner takes from the front, thieves from the back
+struct WorkQueue {
+  pthread_mutex_t lock;
+  int begin;
+  int end;
+};
+
+struct Worker {
+  pthread_t thread;
+  int index;
+  MultitapDelay* delay;
+  short* buffer;
+  WavWriter* writer;
+};
+
+WorkQueue queues[kMaxWorkers];
+Worker workers[kMaxWorkers];
+int num_workers;
+
+uint64_t Nanoseconds() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+bool Pop(WorkQueue* q, int* job) {
+  pthread_mutex_lock(&q->lock);
+  bool ok = q->begin < q->end;
+  if (ok) *job = q->begin++;
+  pthread_mutex_unlock(&q->lock);
+  return ok;
+}
+
+// Moves the back half of a victim's jobs to [q]
+bool Steal(WorkQueue* q, WorkQueue* victim) {
+  pthread_mutex_lock(&victim->lock);
+  int n = (victim->end - victim->begin + 1) / 2;
+  int end = victim->end;
+  victim->end -= n;
+  pthread_mutex_unlock(&victim->lock);
+  if (n <= 0) return false;
+  pthread_mutex_lock(&q->lock);
+  q->begin = end - n;
+  q->end = end;
+  pthread_mutex_unlock(&q->lock);
+  return true;
+}
+
+bool NextJob(Worker* w, int* job) {
+  WorkQueue* q = &queues[w->index];
+  while (!Pop(q, job)) {
+    bool stolen = false;
+    for (int i=1; i<num_workers && !stolen; i++) {
+      stolen = Steal(q, &queues[(w->index + i) % num_workers]);
+    }
+    if (!stolen) return false;
+  }
+  return true;
+}
+
+const char* BaseName(const char* path) {
+  const char* slash = strrchr(path, '/');
+  return slash ? slash + 1 : path;
+}
+
+void Render(Worker* w, const Job& job, Result* result) {
+  result->ok = false;
+  WavReader reader;
+  if (!reader.Open(inputs[job.input])) return;
+
+  bool write = output_dir != NULL;
+  if (write) {
+    char path[1024];
+    char name[256];
+    strncpy(name, BaseName(inputs[job.input]), sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    char* dot = strrchr(name, '.');
+    if (dot) *dot = '\0';
+    snprintf(path, sizeof(path), "%s/%s-p%02d-s%02d.wav",
+             output_dir, name, job.preset, job.parameter_set);
+    if (!w->writer->Open(path, 2, SAMPLE_RATE)) {
+      reader.Close();
+      return;
+    }
+  }
+
+  uint32_t num_frames = reader.num_frames();
+  if (duration >= 0.0f) num_frames = duration * SAMPLE_RATE;
+  num_frames -= num_frames % kBlockSize;
+
+  MultitapDelay* delay = w->delay;
+  delay->Init(w->buffer, kBufferSize);
+  delay->ui_commands_.Load(&presets[job.preset]);
+
+  int32_t peak = 0;
+  uint64_t start = Nanoseconds();
+  for (uint32_t n = 0; n < num_frames; n += kBlockSize) {
+    ShortFrame converted[kBlockSize];
+    ShortFrame output[kBlockSize];
+    const ShortFrame* input = reinterpret_cast<const ShortFrame*>(
+        reader.Peek(kBlockSize, 2));
+    if (!input) {
+      reader.Read(&converted[0].l, kBlockSize, 2);
+      input = converted;
+    }
+    Parameters params = parameter_sets[job.parameter_set];
+    delay->Process(&params, input, output);
+    DelayEvent e;
+    while (delay->events_.Read(&e)) { }
+    for (size_t i=0; i<kBlockSize; i++) {
+      peak = std::max(peak, std::abs(static_cast<int32_t>(output[i].l)));
+      peak = std::max(peak, std::abs(static_cast<int32_t>(output[i].r)));
+    }
+    if (write) w->writer->Write(&output[0].l, kBlockSize);
+  }
+  result->ns = Nanoseconds() - start;
+  result->num_frames = num_frames;
+  result->peak = peak;
+  result->ok = !write || w->writer->Close();
+  reader.Close();
+}
+
+void* Work(void* arg) {
+  Worker* w = static_cast<Worker*>(arg);
+  FlushDenormals();
+  int job;
+  while (NextJob(w, &job)) {
+    Render(w, jobs[job], &results[job]);
+  }
+  return NULL;
+}
+
+bool LoadParameterSets(const char* path) {
+  FILE* fp = fopen(path, "r");
+  if (!fp) return false;
+  char line[1024];
+  int line_number = 0;
+  num_parameter_sets = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    line_number++;
+    if (line[0] == '#' || line[0] == '\n') continue;
+    if (num_parameter_sets == kMaxParameterSets) break;
+    Parameters* params = &parameter_sets[num_parameter_sets++];
+    InitParameters(params);
+    char* save;
+    char* name;
+    char* tokens = line;
+    while ((name = strtok_r(tokens, " \t\n", &save))) {
+      tokens = NULL;
+      char* value = strtok_r(NULL, " \t\n", &save);
+      if (!value || !SetParameter(params, name, value)) {
+        fprintf(stderr, "parameter sets line %d: bad parameter\n",
+                line_number);
+        fclose(fp);
+        return false;
+      }
+    }
+  }
+  fclose(fp);
+  return num_parameter_sets > 0;
+}
+
+int main(int argc, char* argv[]) {
+  const char* sets_path = NULL;
+  num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "j:d:p:o:")) != -1) {
+    switch (opt) {
+    case 'j': num_workers = atoi(optarg); break;
+    case 'd': duration = atof(optarg); break;
+    case 'p': sets_path = optarg; break;
+    case 'o': output_dir = optarg; break;
+    default: return 1;
+    }
+  }
+  num_inputs = argc - optind;
+  if (num_inputs < 1 || num_inputs > kMaxInputs) {
+    fprintf(stderr, "usage: %s [-j threads] [-d seconds] [-p sets.txt] "
+            "[-o dir] input.wav...\n", argv[0]);
+    return 1;
+  }
+  for (int i=0; i<num_inputs; i++) inputs[i] = argv[optind + i];
+  CONSTRAIN(num_workers, 1, kMaxWorkers);
+
+  if (sets_path) {
+    if (!LoadParameterSets(sets_path)) {
+      fprintf(stderr, "cannot load the parameter sets from %s\n", sets_path);
+      return 1;
+    }
+  } else {
+    num_parameter_sets = 1;
+    InitParameters(&parameter_sets[0]);
+  }
+  for (int p=0; p<kNumPresets; p++) LoadPreset(p, &presets[p]);
+
+  num_jobs = num_inputs * kNumPresets * num_parameter_sets;
+  jobs = new Job[num_jobs];
+  results = new Result[num_jobs];
+  int n = 0;
+  for (int i=0; i<num_inputs; i++) {
+    for (int p=0; p<kNumPresets; p++) {
+      for (int s=0; s<num_parameter_sets; s++) {
+        jobs[n].input = i;
+        jobs[n].preset = p;
+        jobs[n].parameter_set = s;
+        n++;
+      }
+    }
+  }
+
+  for (int i=0; i<num_workers; i++) {
+    pthread_mutex_init(&queues[i].lock, NULL);
+    queues[i].begin = num_jobs * i / num_workers;
+    queues[i].end = num_jobs * (i + 1) / num_workers;
+    workers[i].index = i;
+    workers[i].delay = new MultitapDelay;
+    workers[i].buffer = new short[kBufferSize];
+    workers[i].writer = output_dir ? new WavWriter : NULL;
+  }
+
+  uint64_t start = Nanoseconds();
+  for (int i=1; i<num_workers; i++) {
+    pthread_create(&workers[i].thread, NULL, Work, &workers[i]);
+  }
+  Work(&workers[0]);
+  for (int i=1; i<num_workers; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  double elapsed = (Nanoseconds() - start) * 1e-9;
+
+  int failures = 0;
+  double audio = 0.0;
+  for (int j=0; j<num_jobs; j++) {
+    const Job& job = jobs[j];
+    const Result& r = results[j];
+    if (!r.ok) {
+      printf("%s p%02d s%02d: failed\n",
+             BaseName(inputs[job.input]), job.preset, job.parameter_set);
+      failures++;
+      continue;
+    }
+    audio += static_cast<double>(r.num_frames) / SAMPLE_RATE;
+    printf("%s p%02d s%02d: peak %5d, %.0fx real time\n",
+           BaseName(inputs[job.input]), job.preset, job.parameter_set,
+           r.peak, r.num_frames * 1e9 / (r.ns * static_cast<double>(SAMPLE_RATE)));
+  }
+  fprintf(stderr, "%d jobs on %d threads: %.1fs of audio in %.2fs "
+          "(%.0fx real time)\n", num_jobs, num_workers, audio, elapsed,
+          audio / elapsed);
+
+  for (int i=0; i<num_workers; i++) {
+    delete workers[i].delay;
+    delete[] workers[i].buffer;
+    delete workers[i].writer;
+  }
+  delete[] jobs;
+  delete[] results;
+  return failures ? 1 : 0;
+}
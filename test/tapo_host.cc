@@ -0,0 +1,381 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// The whole firmware on the host, on the mock peripherals of
+// test/mock: audio from a WAV file, pots, CVs, buttons, switches and
+// the gate input driven by a scenario, flash in a file, and a virtual
+// SysTick. Runs as fast as the host can.
+//
+// usage: tapo_host [-f flash.bin] [-t trace.txt] [-d seconds]
+//                  input.wav output.wav [scenario.txt]
+//
+// A scenario has one event per line, at a time in milliseconds:
+//   <ms> pot <scale|feedback|modulation|drywet|morph|gain> <0..1>
+//   <ms> cv <scale|feedback|modulation|drywet|clock|fsr|vel|taptrig> <0..1>
+//   <ms> button <1..6|repeat|delete> <down|up>
+//   <ms> switch <edit|velo> <0..2>
+//   <ms> gate <0|1>
+// Values are raw ADC readings, so bipolar CVs are at 0V around 0.5.
+// The trace has a line per change of the LEDs or gate output.
+
+#include <getopt.h>
+#include <sys/time.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "stmlib/system/system_clock.h"
+#include "drivers/codec.hh"
+#include "drivers/dac.hh"
+#include "ui.hh"
+#include "multitap_delay.hh"
+#include "double_buffer.hh"
+#include "boot.hh"
+#include "tasks.hh"
+#include "test/denormals.hh"
+#include "test/wav_file.hh"
+
+using namespace stmlib;
+
+// defined in test/mock/codec.cc
+extern Frame mock_codec_rx[CODEC_BUFFER_SIZE];
+extern Frame mock_codec_tx[CODEC_BUFFER_SIZE];
+
+const uint32_t kDelayBufferSize = 0x02000000 / sizeof(short) / 2;
+const uint32_t kSamplesPerTick = SAMPLE_RATE / 1000;
+
+short delay_buffer[kDelayBufferSize];
+
+Ui ui;
+MultitapDelay delay;
+DigOut dac;
+Codec codec;
+
+Parameters parameters;
+DoubleBuffer<Parameters> parameters_snapshot;
+SwapBuffer<CvStream> cv_stream;
+
+BootProfile boot_profile;
+uint32_t sample_clock;
+
+WavReader reader;
+WavWriter writer;
+
+// The delay buffer is cleared by Init, so the codec interrupt of
+// tapo.cc only has the block to process
+void FillBuffer(Frame* input, Frame* output) {
+  ProcessBlock(input, output);
+}
+
+struct HostBoard {
+  void InitSystem() {
+    FlushDenormals();
+    system_clock.Init();
+  }
+  void RunTesterIfRequested() { }
+  void InitCodecClock() { codec.InitClock(SAMPLE_RATE); }
+  void InitSdram() { }
+
+  void InitDelay() {
+    dac.Init();
+    delay.Init(delay_buffer, kDelayBufferSize);
+  }
+
+  void InitUi() {
+    ui.Init(&delay, &parameters);
+    ui.ReadParameters(cv_stream.back());
+    parameters_snapshot.Init(parameters);
+    cv_stream.Publish();
+  }
+
+  void StartCodec() { codec.Start(&FillBuffer); }
+
+  // virtual CPU cycles
+  uint32_t cycles() { return 1 + sample_clock * (F_CPU / SAMPLE_RATE); }
+};
+
+// Inputs of the simulated board
+
+uint16_t pots[kNumPots];
+uint16_t cvs[kNumCvs];
+
+void SetPin(const PinAssign& pin, bool level) {
+  if (level) pin.gpio->IDR |= pin.pin; else pin.gpio->IDR &= ~pin.pin;
+}
+
+void SetButton(int button, bool pressed) {
+  SetPin(button_pins[button], !pressed); // pulled up
+}
+
+void SetSwitch(int sw, int state) {
+  for (int j=0; j<kNumBitPerSwitch; j++) {
+    bool active = (state >> (kNumBitPerSwitch - 1 - j)) & 1;
+    SetPin(switch_pins[j + kNumBitPerSwitch * sw], !active);
+  }
+}
+
+void SetGate(bool level) {
+  if (level) GPIOA->IDR |= GPIO_Pin_4; else GPIOA->IDR &= ~GPIO_Pin_4;
+}
+
+void InitInputs() {
+  for (size_t i=0; i<kNumPots; i++) pots[i] = 32768;
+  for (size_t i=0; i<kNumCvs; i++) cvs[i] = 0;
+  for (int i=ADC_SCALE_CV; i<ADC_CLOCK_CV; i++) cvs[i - ADC_SCALE_CV] = 32768;
+  for (int i=0; i<kNumButtons; i++) SetButton(i, false);
+  for (int i=0; i<kNumSwitches; i++) SetSwitch(i, 0);
+  SetGate(false);
+}
+
+// one scan of each ADC, as triggered by TIM2
+void ScanAdcs() {
+  MockDmaWrite(DMA2_Stream4, pots, kNumPots);
+  MockDmaWrite(DMA2_Stream0, cvs, kNumCvs);
+}
+
+// Scenario
+
+const char* kPotNames[] = {
+  "scale", "feedback", "modulation", "drywet", "morph", "gain", NULL
+};
+const char* kCvNames[] = {
+  "scale", "feedback", "modulation", "drywet",
+  "clock", "fsr", "vel", "taptrig", NULL
+};
+const char* kButtonNames[] = {
+  "1", "2", "3", "4", "5", "6", "repeat", "delete", NULL
+};
+const char* kSwitchNames[] = { "edit", "velo", NULL };
+
+int Lookup(const char** names, const char* name) {
+  for (int i=0; names[i]; i++) {
+    if (!strcmp(names[i], name)) return i;
+  }
+  return -1;
+}
+
+class Scenario {
+ public:
+  bool Init(const char* path) {
+    line_ = 0;
+    pending_ = false;
+    fp_ = path ? fopen(path, "r") : NULL;
+    return !path || fp_;
+  }
+
+  // Applies the events up to [now] ms; false on a syntax error
+  bool Apply(uint32_t now) {
+    while (fp_) {
+      if (!pending_ && !Next()) return false;
+      if (!fp_ || time_ > now) return true;
+      pending_ = false;
+      if (!Execute()) {
+        fprintf(stderr, "scenario line %d: bad event\n", line_);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void Close() {
+    if (fp_) fclose(fp_);
+    fp_ = NULL;
+  }
+
+ private:
+  // reads the next event, closing the file at its end
+  bool Next() {
+    char line[256];
+    while (fgets(line, sizeof(line), fp_)) {
+      line_++;
+      if (line[0] == '#' || line[0] == '\n') continue;
+      value_[0] = '\0';
+      if (sscanf(line, "%u %15s %15s %15s",
+                 &time_, target_, name_, value_) < 3) {
+        fprintf(stderr, "scenario line %d: syntax error\n", line_);
+        return false;
+      }
+      pending_ = true;
+      return true;
+    }
+    Close();
+    return true;
+  }
+
+  bool Execute() {
+    float value = atof(value_);
+    uint16_t raw = value >= 1.0f ? 65535 : value <= 0.0f ? 0 :
+        static_cast<uint16_t>(value * 65536.0f);
+    int index;
+    if (!strcmp(target_, "pot")) {
+      if ((index = Lookup(kPotNames, name_)) < 0) return false;
+      pots[index] = raw;
+    } else if (!strcmp(target_, "cv")) {
+      if ((index = Lookup(kCvNames, name_)) < 0) return false;
+      cvs[index] = raw;
+    } else if (!strcmp(target_, "button")) {
+      if ((index = Lookup(kButtonNames, name_)) < 0) return false;
+      SetButton(index, !strcmp(value_, "down"));
+    } else if (!strcmp(target_, "switch")) {
+      if ((index = Lookup(kSwitchNames, name_)) < 0) return false;
+      SetSwitch(index, atoi(value_));
+    } else if (!strcmp(target_, "gate")) {
+      // one argument: the value is in [name_]
+      SetGate(atoi(name_));
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  FILE* fp_;
+  int line_;
+  bool pending_;
+  uint32_t time_;
+  char target_[16];
+  char name_[16];
+  char value_[16];
+};
+
+// Outputs of the simulated board, as pin levels
+
+void ReadOutputs(char* leds, bool* gate) {
+  for (int p=0; p<kNumMockPorts; p++) {
+    MockApplyBsrr(&mock_ports[p]);
+  }
+  for (int i=0; i<kNumLeds; i++) {
+    leds[i] = (LED_GPIOs[i]->ODR & LED_Pins[i]) ? '1' : '0';
+  }
+  leds[kNumLeds] = '\0';
+  *gate = GPIOA->ODR & GPIO_Pin_5;
+}
+
+double Now() {
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+int main(int argc, char* argv[]) {
+  const char* flash_path = NULL;
+  const char* trace_path = NULL;
+  float duration = -1.0f;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "f:t:d:")) != -1) {
+    switch (opt) {
+    case 'f': flash_path = optarg; break;
+    case 't': trace_path = optarg; break;
+    case 'd': duration = atof(optarg); break;
+    default: return 1;
+    }
+  }
+  if (argc - optind < 2) {
+    fprintf(stderr, "usage: %s [-f flash.bin] [-t trace.txt] [-d seconds] "
+            "input.wav output.wav [scenario.txt]\n", argv[0]);
+    return 1;
+  }
+
+  if (!reader.Open(argv[optind])) {
+    fprintf(stderr, "cannot read %s\n", argv[optind]);
+    return 1;
+  }
+  if (reader.sample_rate() != SAMPLE_RATE) {
+    fprintf(stderr, "warning: %s is at %uHz, played at %dHz\n",
+            argv[optind], reader.sample_rate(), SAMPLE_RATE);
+  }
+  uint32_t num_frames = reader.num_frames();
+  if (duration >= 0.0f) num_frames = duration * SAMPLE_RATE;
+  num_frames -= num_frames % CODEC_BUFFER_SIZE;
+
+  FILE* fp_trace = trace_path ? fopen(trace_path, "w") : NULL;
+  Scenario scenario;
+  if (!writer.Open(argv[optind + 1], 2, SAMPLE_RATE) ||
+      (trace_path && !fp_trace) ||
+      !scenario.Init(argc - optind > 2 ? argv[optind + 2] : NULL)) {
+    fprintf(stderr, "cannot open output, trace or scenario\n");
+    return 1;
+  }
+  if (!MockFlashOpen(flash_path)) {
+    fprintf(stderr, "cannot map the flash\n");
+    return 1;
+  }
+
+  InitInputs();
+  if (!scenario.Apply(0)) return 1;
+
+  HostBoard board;
+  Boot(&board, &boot_profile);
+
+  char leds[kNumLeds + 1], previous_leds[kNumLeds + 1] = "";
+  bool gate, previous_gate = false;
+  uint32_t next_tick = 0;
+  double start = Now();
+
+  for (sample_clock = 0; sample_clock < num_frames;
+       sample_clock += CODEC_BUFFER_SIZE) {
+    uint32_t now = sample_clock / kSamplesPerTick;
+    if (!scenario.Apply(now)) return 1;
+
+    for (size_t i=0; i<CODEC_BUFFER_SIZE; i += kAdcDecimation) {
+      ScanAdcs();
+    }
+    while (next_tick <= sample_clock) {
+      UiTask();
+      next_tick += kSamplesPerTick;
+    }
+
+    reader.Read(&mock_codec_rx[0].l, CODEC_BUFFER_SIZE, 2);
+    codec.Fill(0);
+    writer.Write(&mock_codec_tx[0].l, CODEC_BUFFER_SIZE);
+    ControlTask();
+
+    ui.DoEvents();
+
+    ReadOutputs(leds, &gate);
+    if (fp_trace && (strcmp(leds, previous_leds) || gate != previous_gate)) {
+      fprintf(fp_trace, "%u %s %d\n", now, leds, gate);
+      strcpy(previous_leds, leds);
+      previous_gate = gate;
+    }
+  }
+
+  double elapsed = Now() - start;
+  fprintf(stderr, "%.1fs of audio in %.2fs (%.0fx real time)\n",
+          static_cast<double>(num_frames) / SAMPLE_RATE, elapsed,
+          num_frames / (elapsed * SAMPLE_RATE));
+
+  scenario.Close();
+  if (fp_trace) fclose(fp_trace);
+  reader.Close();
+  MockFlashClose();
+  if (!writer.Close()) {
+    fprintf(stderr, "cannot write %s\n", argv[optind + 1]);
+    return 1;
+  }
+  return 0;
+}
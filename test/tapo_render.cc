@@ -0,0 +1,325 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+//
+// -----------------------------------------------------------------------------
+//
+// Offline renderer: runs MultitapDelay alone on a WAV file, with its
+// parameters and commands driven by an automation script, as fast as
+// the host can.
+//
+// usage: tapo_render [-s slots.txt] [-l timing.csv] [-d seconds]
+//                    input.wav output.wav [automation.txt]
+//
+// The slot file has one tap per line, "<ms> <velocity> <type> <pan>"
+// with type 0..2 (amp, lp, bp) and pan in [0..1]; a line "slot"
+// starts the next slot.
+//
+// The automation has one event per line, at a time in milliseconds:
+//   <ms> <parameter> <value>     any field of Parameters, by name
+//   <ms> tap [velocity]
+//   <ms> remove | clear
+//   <ms> load [slot]
+//   <ms> repeat <0|1>
+//   <ms> sync <0|1>
+//   <ms> repan <0..2>
+//   <ms> clock
+// Events are posted at the first block boundary following their time,
+// as the main loop would; taps and clock edges keep their exact time.
+// The timing log has a line per block: "<block>,<clock>,<ns>".
+
+#include <time.h>
+#include <getopt.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "stmlib/stmlib.h"
+
+#include "multitap_delay.hh"
+#include "parameters.hh"
+#include "test/denormals.hh"
+#include "test/render.hh"
+#include "test/wav_file.hh"
+
+const int kBufferSize = 0x02000000 / sizeof(short) / 2;
+const int kMaxSlots = 16;
+
+short buffer[kBufferSize];
+
+MultitapDelay delay;
+Parameters params;
+
+Slot slots[kMaxSlots];
+int num_slots;
+
+WavReader reader;
+WavWriter writer;
+
+bool LoadSlots(const char* path) {
+  FILE* fp = fopen(path, "r");
+  if (!fp) return false;
+  char line[256];
+  int line_number = 0;
+  num_slots = 1;
+  slots[0].size = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    line_number++;
+    if (line[0] == '#' || line[0] == '\n') continue;
+    if (!strncmp(line, "slot", 4)) {
+      if (num_slots == kMaxSlots) break;
+      slots[num_slots++].size = 0;
+      continue;
+    }
+    Slot* slot = &slots[num_slots - 1];
+    double ms;
+    float velocity, panning;
+    int type;
+    if (sscanf(line, "%lf %f %d %f", &ms, &velocity, &type, &panning) != 4 ||
+        type < VELOCITY_AMP || type > VELOCITY_BP ||
+        slot->size == kMaxTaps) {
+      fprintf(stderr, "slot line %d: bad tap\n", line_number);
+      fclose(fp);
+      return false;
+    }
+    TapParameters* tap = &slot->taps[slot->size++];
+    tap->time = MsToSamples(ms);
+    tap->velocity = velocity;
+    tap->velocity_type = static_cast<VelocityType>(type);
+    tap->panning = panning;
+  }
+  fclose(fp);
+  return true;
+}
+
+// Automation
+
+class Automation {
+ public:
+  bool Init(const char* path) {
+    line_ = 0;
+    pending_ = false;
+    fp_ = path ? fopen(path, "r") : NULL;
+    return !path || fp_;
+  }
+
+  // Posts the events up to sample [now]; false on a bad event
+  bool Apply(uint32_t now) {
+    while (fp_) {
+      if (!pending_ && !Next()) return false;
+      if (!fp_ || time_ > now) return true;
+      pending_ = false;
+      if (!Execute()) {
+        fprintf(stderr, "automation line %d: bad event\n", line_);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void Close() {
+    if (fp_) fclose(fp_);
+    fp_ = NULL;
+  }
+
+ private:
+  // reads the next event, closing the file at its end
+  bool Next() {
+    char line[256];
+    while (fgets(line, sizeof(line), fp_)) {
+      line_++;
+      if (line[0] == '#' || line[0] == '\n') continue;
+      double ms;
+      value_[0] = '\0';
+      if (sscanf(line, "%lf %31s %31s", &ms, name_, value_) < 2) {
+        fprintf(stderr, "automation line %d: syntax error\n", line_);
+        return false;
+      }
+      time_ = MsToSamples(ms);
+      pending_ = true;
+      return true;
+    }
+    Close();
+    return true;
+  }
+
+  bool Execute() {
+    CommandQueue* q = &delay.ui_commands_;
+    int value = atoi(value_);
+    if (!strcmp(name_, "tap")) {
+      Parameters p = params;
+      if (value_[0]) p.velocity = atof(value_);
+      q->AddTap(&p, time_);
+    } else if (!strcmp(name_, "remove")) {
+      q->RemoveLastTap();
+    } else if (!strcmp(name_, "clear")) {
+      q->Clear();
+    } else if (!strcmp(name_, "load")) {
+      if (value < 0 || value >= num_slots) return false;
+      q->Load(&slots[value]);
+    } else if (!strcmp(name_, "repeat")) {
+      q->set_repeat(value);
+    } else if (!strcmp(name_, "sync")) {
+      q->set_sync(value);
+    } else if (!strcmp(name_, "repan")) {
+      if (value < PANNING_LEFT || value > PANNING_ALTERNATE) return false;
+      q->RepanTaps(static_cast<PanningMode>(value));
+    } else if (!strcmp(name_, "clock")) {
+      q->ClockTick(time_);
+    } else {
+      return SetParameter(&params, name_, value_);
+    }
+    return true;
+  }
+
+  FILE* fp_;
+  int line_;
+  bool pending_;
+  uint32_t time_;
+  char name_[32];
+  char value_[32];
+};
+
+uint64_t Nanoseconds() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char* argv[]) {
+  const char* slots_path = NULL;
+  const char* timing_path = NULL;
+  float duration = -1.0f;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:l:d:")) != -1) {
+    switch (opt) {
+    case 's': slots_path = optarg; break;
+    case 'l': timing_path = optarg; break;
+    case 'd': duration = atof(optarg); break;
+    default: return 1;
+    }
+  }
+  if (argc - optind < 2) {
+    fprintf(stderr, "usage: %s [-s slots.txt] [-l timing.csv] [-d seconds] "
+            "input.wav output.wav [automation.txt]\n", argv[0]);
+    return 1;
+  }
+
+  if (!reader.Open(argv[optind])) {
+    fprintf(stderr, "cannot read %s\n", argv[optind]);
+    return 1;
+  }
+  if (reader.sample_rate() != SAMPLE_RATE) {
+    fprintf(stderr, "warning: %s is at %uHz, played at %dHz\n",
+            argv[optind], reader.sample_rate(), SAMPLE_RATE);
+  }
+  // past the end of the input, the tails are rendered on silence
+  uint32_t num_frames = reader.num_frames();
+  if (duration >= 0.0f) num_frames = duration * SAMPLE_RATE;
+  num_frames -= num_frames % kBlockSize;
+
+  if (slots_path && !LoadSlots(slots_path)) {
+    fprintf(stderr, "cannot load the slots from %s\n", slots_path);
+    return 1;
+  }
+
+  FILE* fp_timing = timing_path ? fopen(timing_path, "w") : NULL;
+  Automation automation;
+  if (!writer.Open(argv[optind + 1], 2, SAMPLE_RATE) ||
+      (timing_path && !fp_timing) ||
+      !automation.Init(argc - optind > 2 ? argv[optind + 2] : NULL)) {
+    fprintf(stderr, "cannot open output, timing log or automation\n");
+    return 1;
+  }
+  if (fp_timing) fprintf(fp_timing, "block,clock,ns\n");
+
+  InitParameters(&params);
+  FlushDenormals();
+  delay.Init(buffer, kBufferSize);
+
+  uint64_t total = 0, worst = 0;
+  uint32_t worst_block = 0;
+
+  for (uint32_t block = 0; block * kBlockSize < num_frames; block++) {
+    uint32_t clock = block * kBlockSize;
+    if (!automation.Apply(clock)) return 1;
+
+    ShortFrame converted[kBlockSize];
+    ShortFrame output[kBlockSize];
+
+    // in place when the input is 16-bit stereo
+    const ShortFrame* input = reinterpret_cast<const ShortFrame*>(
+        reader.Peek(kBlockSize, 2));
+    if (!input) {
+      reader.Read(&converted[0].l, kBlockSize, 2);
+      input = converted;
+    }
+
+    // Process may overwrite its parameters, as on the firmware
+    Parameters block_params = params;
+    uint64_t start = Nanoseconds();
+    delay.Process(&block_params, input, output);
+    uint64_t elapsed = Nanoseconds() - start;
+
+    total += elapsed;
+    if (elapsed > worst) {
+      worst = elapsed;
+      worst_block = block;
+    }
+    if (fp_timing) {
+      fprintf(fp_timing, "%u,%u,%llu\n", block, clock,
+              static_cast<unsigned long long>(elapsed));
+    }
+
+    DelayEvent e;
+    while (delay.events_.Read(&e)) { }
+
+    writer.Write(&output[0].l, kBlockSize);
+  }
+
+  uint32_t num_blocks = num_frames / kBlockSize;
+  if (!num_blocks) num_blocks = 1;
+  double budget = 1e9 * kBlockSize / SAMPLE_RATE;
+  fprintf(stderr, "%.1fs of audio in %.2fs (%.0fx real time)\n",
+          static_cast<double>(num_frames) / SAMPLE_RATE, total * 1e-9,
+          num_frames * 1e9 / (total * static_cast<double>(SAMPLE_RATE)));
+  fprintf(stderr, "block: %.0fns average, %lluns worst (block %u), "
+          "budget %.0fns\n", static_cast<double>(total) / num_blocks,
+          static_cast<unsigned long long>(worst), worst_block, budget);
+  if (delay.ui_commands_.overflows()) {
+    fprintf(stderr, "warning: %u commands dropped, spread the events\n",
+            delay.ui_commands_.overflows());
+  }
+
+  automation.Close();
+  if (fp_timing) fclose(fp_timing);
+  reader.Close();
+  if (!writer.Close()) {
+    fprintf(stderr, "cannot write %s\n", argv[optind + 1]);
+    return 1;
+  }
+  return 0;
+}
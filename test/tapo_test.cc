@@ -34,36 +34,8 @@
 
 #include "multitap_delay.hh"
 #include "parameters.hh"
-
-void write_wav_header(FILE* fp, int num_samples, int num_channels) {
-  uint32_t l;
-  uint16_t s;
-  
-  fwrite("RIFF", 4, 1, fp);
-  l = 36 + num_samples * 2 * num_channels;
-  fwrite(&l, 4, 1, fp);
-  fwrite("WAVE", 4, 1, fp);
-  
-  fwrite("fmt ", 4, 1, fp);
-  l = 16;
-  fwrite(&l, 4, 1, fp);
-  s = 1;
-  fwrite(&s, 2, 1, fp);
-  s = num_channels;
-  fwrite(&s, 2, 1, fp);
-  l = SAMPLE_RATE;
-  fwrite(&l, 4, 1, fp);
-  l = static_cast<uint32_t>(SAMPLE_RATE) * 2 * num_channels;
-  fwrite(&l, 4, 1, fp);
-  s = 2 * num_channels;
-  fwrite(&s, 2, 1, fp);
-  s = 16;
-  fwrite(&s, 2, 1, fp);
-  
-  fwrite("data", 4, 1, fp);
-  l = num_samples * 2 * num_channels;
-  fwrite(&l, 4, 1, fp);
-}
+#include "test/denormals.hh"
+#include "test/wav_file.hh"
 
 const int kBufferSize = 1 << 20;
 short buffer[kBufferSize];
@@ -72,24 +44,22 @@ MultitapDelay delay;
 
 Parameters params;
 
-void reset_observer() {
-  printf("Reset!\n");
-}
+WavReader reader;
+WavWriter writer;
 
 void TestDSP() {
   size_t duration = 20;
 
-  FILE* fp_in = fopen("audio/ericderr.wav", "rb");
-  FILE* fp_out = fopen("tapo.wav", "wb");
+  if (!reader.Open("audio/ericderr.wav") ||
+      !writer.Open("tapo.wav", 2, SAMPLE_RATE)) {
+    printf("cannot open audio files\n");
+    return;
+  }
 
   size_t remaining_samples = SAMPLE_RATE * duration;
-  write_wav_header(fp_out, remaining_samples, 2);
-  fseek(fp_in, 48, SEEK_SET);
-
-  delay.reset_observable_.set_observer(&reset_observer);
 
   while (remaining_samples) {
-    ShortFrame input[kBlockSize];
+    ShortFrame converted[kBlockSize];
     ShortFrame output[kBlockSize];
 
     params.velocity = 1.0f;
@@ -100,32 +70,38 @@ void TestDSP() {
     params.scale = 0.3f;
     params.modulation_amount = 0.0f;
     params.modulation_frequency = 0.0f;
-    params.repeat = false;
     params.edit_mode = EDIT_NORMAL;
     params.panning_mode = PANNING_ALTERNATE;
     params.velocity_type = VELOCITY_AMP;
     
-    if (fread(
-          input,
-          sizeof(ShortFrame),
-          kBlockSize,
-          fp_in) != kBlockSize) {
-      ShortFrame z = {0, 0};
-      std::fill(input, input+kBlockSize, z);
+    // in place when the input is 16-bit stereo
+    const ShortFrame* input = reinterpret_cast<const ShortFrame*>(
+        reader.Peek(kBlockSize, 2));
+    if (!input) {
+      reader.Read(&converted[0].l, kBlockSize, 2);
+      input = converted;
     }
     remaining_samples -= kBlockSize;
 
     // std::copy(input, input+kBlockSize, output);
     delay.Process(&params, input, output);
 
-    fwrite(output, sizeof(ShortFrame), kBlockSize, fp_out);
+    DelayEvent e;
+    while (delay.events_.Read(&e)) {
+      if (e.type == EVENT_RESET) {
+        printf("Reset!\n");
+      }
+    }
+
+    writer.Write(&output[0].l, kBlockSize);
   }
 
-  fclose(fp_out);
-  fclose(fp_in);
+  writer.Close();
+  reader.Close();
 }
 
 int main(void) {
+  FlushDenormals();
   delay.Init(buffer, kBufferSize);
   TestDSP();
 }
@@ -0,0 +1,314 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// WAV files for the host tools. The reader maps the file in memory and
+// parses its chunks; 16-bit input can be used in place, other formats
+// (8/24/32-bit PCM, 32/64-bit float) are converted to 16-bit when
+// read. The writer buffers 16-bit output in large chunks and fills in
+// the sizes in the header when closed.
+
+#ifndef WAV_FILE_H_
+#define WAV_FILE_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "stmlib/stmlib.h"
+
+enum WavFormat {
+  WAV_FORMAT_PCM = 1,
+  WAV_FORMAT_FLOAT = 3,
+  WAV_FORMAT_EXTENSIBLE = 0xfffe,
+};
+
+class WavReader {
+ public:
+  WavReader() : map_(NULL), map_size_(0) { }
+  ~WavReader() { Close(); }
+
+  bool Open(const char* path) {
+    Close();
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < 12) {
+      close(fd);
+      return false;
+    }
+    map_size_ = st.st_size;
+    void* map = mmap(NULL, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      map_size_ = 0;
+      return false;
+    }
+    map_ = static_cast<const uint8_t*>(map);
+    madvise(map, map_size_, MADV_SEQUENTIAL);
+    if (!Parse()) {
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  void Close() {
+    if (map_) munmap(const_cast<uint8_t*>(map_), map_size_);
+    map_ = NULL;
+    map_size_ = 0;
+  }
+
+  size_t num_channels() const { return num_channels_; }
+  uint32_t sample_rate() const { return sample_rate_; }
+  size_t bits() const { return bits_; }
+  bool is_float() const { return format_ == WAV_FORMAT_FLOAT; }
+  size_t num_frames() const { return num_frames_; }
+  size_t position() const { return position_; }
+  size_t remaining() const { return num_frames_ - position_; }
+
+  void Seek(size_t frame) {
+    position_ = frame < num_frames_ ? frame : num_frames_;
+  }
+
+  // Pointer to the next [size] frames in the file, when they can be
+  // used in place (16-bit PCM with [channels] channels, aligned), or
+  // NULL. Advances the position.
+  const int16_t* Peek(size_t size, size_t channels) {
+    if (bits_ != 16 || format_ != WAV_FORMAT_PCM ||
+        num_channels_ != channels || remaining() < size ||
+        reinterpret_cast<uintptr_t>(data_) % 2) {
+      return NULL;
+    }
+    const int16_t* frames =
+        reinterpret_cast<const int16_t*>(data_) + position_ * channels;
+    position_ += size;
+    return frames;
+  }
+
+  // Reads up to [size] frames as 16-bit with [channels] channels: mono
+  // is copied to all channels, extra channels are dropped. Frames past
+  // the end of the file are silent. Returns the number of frames read.
+  size_t Read(int16_t* out, size_t size, size_t channels) {
+    size_t read = remaining() < size ? remaining() : size;
+    size_t stride = num_channels_ * bytes_;
+    const uint8_t* frame = data_ + position_ * stride;
+    for (size_t i = 0; i < read; i++) {
+      for (size_t c = 0; c < channels; c++) {
+        size_t source = c < num_channels_ ? c : num_channels_ - 1;
+        *out++ = Sample(frame + source * bytes_);
+      }
+      frame += stride;
+    }
+    memset(out, 0, (size - read) * channels * sizeof(int16_t));
+    position_ += read;
+    return read;
+  }
+
+ private:
+  static uint16_t Le16(const uint8_t* p) { return p[0] | p[1] << 8; }
+  static uint32_t Le32(const uint8_t* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+  }
+
+  bool Parse() {
+    if (memcmp(map_, "RIFF", 4) || memcmp(map_ + 8, "WAVE", 4)) return false;
+    bool has_format = false;
+    size_t offset = 12;
+    while (offset + 8 <= map_size_) {
+      const uint8_t* chunk = map_ + offset;
+      size_t size = Le32(chunk + 4);
+      size_t available = map_size_ - offset - 8;
+      if (!memcmp(chunk, "fmt ", 4)) {
+        if (size < 16 || size > available) return false;
+        format_ = Le16(chunk + 8);
+        num_channels_ = Le16(chunk + 10);
+        sample_rate_ = Le32(chunk + 12);
+        bits_ = Le16(chunk + 22);
+        if (format_ == WAV_FORMAT_EXTENSIBLE) {
+          // the format is in the first two bytes of the subformat GUID
+          if (size < 40) return false;
+          format_ = Le16(chunk + 32);
+        }
+        has_format = true;
+      } else if (!memcmp(chunk, "data", 4)) {
+        if (!has_format || !Supported()) return false;
+        // streamed files may leave the size unset: use what is there
+        if (size > available) size = available;
+        bytes_ = bits_ / 8;
+        data_ = chunk + 8;
+        num_frames_ = size / (num_channels_ * bytes_);
+        position_ = 0;
+        return true;
+      }
+      offset += 8 + size + (size & 1);
+    }
+    return false;
+  }
+
+  bool Supported() const {
+    if (num_channels_ == 0) return false;
+    if (format_ == WAV_FORMAT_PCM) {
+      return bits_ == 8 || bits_ == 16 || bits_ == 24 || bits_ == 32;
+    }
+    return format_ == WAV_FORMAT_FLOAT && (bits_ == 32 || bits_ == 64);
+  }
+
+  static int16_t Clip(float x) {
+    x = floorf(x * 32768.0f + 0.5f);
+    return x > 32767.0f ? 32767 : x < -32768.0f ? -32768 :
+        static_cast<int16_t>(x);
+  }
+
+  int16_t Sample(const uint8_t* p) const {
+    if (format_ == WAV_FORMAT_FLOAT) {
+      if (bits_ == 32) {
+        float f;
+        memcpy(&f, p, 4);
+        return Clip(f);
+      }
+      double d;
+      memcpy(&d, p, 8);
+      return Clip(d);
+    }
+    switch (bits_) {
+    case 8: return (p[0] - 128) << 8;  // unsigned
+    case 16: return Le16(p);
+    case 24: return Le16(p + 1);       // truncated
+    default: return Le16(p + 2);
+    }
+  }
+
+  const uint8_t* map_;
+  size_t map_size_;
+  const uint8_t* data_;
+  size_t num_frames_;
+  size_t position_;
+  uint16_t format_;
+  size_t num_channels_;
+  uint32_t sample_rate_;
+  size_t bits_;
+  size_t bytes_;
+};
+
+const size_t kWavWriterBufferSize = 1 << 20; // bytes
+
+class WavWriter {
+ public:
+  WavWriter() : fp_(NULL) { }
+  ~WavWriter() { Close(); }
+
+  // 16-bit PCM output
+  bool Open(const char* path, size_t num_channels, uint32_t sample_rate) {
+    Close();
+    fp_ = fopen(path, "wb");
+    if (!fp_) return false;
+    num_channels_ = num_channels;
+    sample_rate_ = sample_rate;
+    num_frames_ = 0;
+    fill_ = 0;
+    error_ = false;
+    // the sizes are patched by Close()
+    WriteHeader();
+    return !error_;
+  }
+
+  void Write(const int16_t* frames, size_t size) {
+    size_t bytes = size * num_channels_ * sizeof(int16_t);
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(frames);
+    num_frames_ += size;
+    while (bytes) {
+      size_t chunk = kWavWriterBufferSize - fill_;
+      if (chunk > bytes) chunk = bytes;
+      memcpy(buffer_ + fill_, data, chunk);
+      fill_ += chunk;
+      data += chunk;
+      bytes -= chunk;
+      if (fill_ == kWavWriterBufferSize) Flush();
+    }
+  }
+
+  // Returns false if anything could not be written
+  bool Close() {
+    if (!fp_) return true;
+    Flush();
+    fseek(fp_, 0, SEEK_SET);
+    WriteHeader();
+    error_ |= fclose(fp_) != 0;
+    fp_ = NULL;
+    return !error_;
+  }
+
+  size_t num_frames() const { return num_frames_; }
+
+ private:
+  void Flush() {
+    if (fill_ && fwrite(buffer_, fill_, 1, fp_) != 1) error_ = true;
+    fill_ = 0;
+  }
+
+  static void Put16(uint8_t* p, uint16_t x) {
+    p[0] = x;
+    p[1] = x >> 8;
+  }
+
+  static void Put32(uint8_t* p, uint32_t x) {
+    Put16(p, x);
+    Put16(p + 2, x >> 16);
+  }
+
+  void WriteHeader() {
+    uint8_t header[44];
+    uint32_t data_size = num_frames_ * num_channels_ * sizeof(int16_t);
+    memcpy(header, "RIFF", 4);
+    Put32(header + 4, 36 + data_size);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    Put32(header + 16, 16);
+    Put16(header + 20, WAV_FORMAT_PCM);
+    Put16(header + 22, num_channels_);
+    Put32(header + 24, sample_rate_);
+    Put32(header + 28, sample_rate_ * num_channels_ * sizeof(int16_t));
+    Put16(header + 32, num_channels_ * sizeof(int16_t));
+    Put16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    Put32(header + 40, data_size);
+    if (fwrite(header, sizeof(header), 1, fp_) != 1) error_ = true;
+  }
+
+  FILE* fp_;
+  size_t num_channels_;
+  uint32_t sample_rate_;
+  size_t num_frames_;
+  size_t fill_;
+  bool error_;
+  uint8_t buffer_[kWavWriterBufferSize];
+};
+
+#endif
@@ -0,0 +1,157 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Host test for the WAV reader and writer: round trip through the
+// writer, and reading of the other formats, extra chunks and mono.
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "test/wav_file.hh"
+
+const char* kPath = "wav_file_test.wav";
+const size_t kNumFrames = 3000;
+
+WavReader reader;
+WavWriter writer;
+
+void Put(std::vector<uint8_t>* v, uint32_t x, size_t bytes) {
+  for (size_t i=0; i<bytes; i++) v->push_back(x >> (8 * i));
+}
+
+void PutId(std::vector<uint8_t>* v, const char* id) {
+  v->insert(v->end(), id, id + 4);
+}
+
+int16_t Signal(size_t i, size_t c) {
+  return (i * 37 + c * 1000) % 65536 - 32768;
+}
+
+// Writes a file of [kNumFrames] frames of Signal() in the given format,
+// after an odd-sized chunk
+void WriteFile(uint16_t format, size_t channels, size_t bits) {
+  std::vector<uint8_t> data;
+  for (size_t i=0; i<kNumFrames; i++) {
+    for (size_t c=0; c<channels; c++) {
+      int16_t s = Signal(i, c);
+      if (format == WAV_FORMAT_FLOAT) {
+        float f = s / 32768.0f;
+        uint32_t x;
+        memcpy(&x, &f, 4);
+        Put(&data, x, 4);
+      } else if (bits == 24) {
+        Put(&data, static_cast<uint32_t>(s) << 8 | 0x55, 3);
+      } else {
+        Put(&data, static_cast<uint16_t>(s), 2);
+      }
+    }
+  }
+
+  std::vector<uint8_t> file;
+  bool extensible = format == WAV_FORMAT_EXTENSIBLE;
+  PutId(&file, "RIFF");
+  Put(&file, 0, 4);
+  PutId(&file, "WAVE");
+  PutId(&file, "LIST");
+  Put(&file, 3, 4);
+  Put(&file, 0, 4);             // 3 bytes and padding
+  PutId(&file, "fmt ");
+  Put(&file, extensible ? 40 : 16, 4);
+  Put(&file, format, 2);
+  Put(&file, channels, 2);
+  Put(&file, 44100, 4);
+  Put(&file, 44100 * channels * bits / 8, 4);
+  Put(&file, channels * bits / 8, 2);
+  Put(&file, bits, 2);
+  if (extensible) {
+    Put(&file, 22, 2);
+    Put(&file, bits, 2);
+    Put(&file, 3, 4);
+    Put(&file, WAV_FORMAT_PCM, 2); // subformat GUID
+    for (int i=0; i<14; i++) file.push_back(0);
+  }
+  PutId(&file, "data");
+  Put(&file, data.size(), 4);
+  file.insert(file.end(), data.begin(), data.end());
+
+  FILE* fp = fopen(kPath, "wb");
+  fwrite(&file[0], file.size(), 1, fp);
+  fclose(fp);
+}
+
+bool CheckRead(const char* name, size_t channels) {
+  bool ok = reader.Open(kPath) && reader.num_frames() == kNumFrames &&
+      reader.num_channels() == channels;
+  int16_t frames[2 * 256];
+  for (size_t i=0; ok && i<kNumFrames; ) {
+    size_t read = reader.Read(frames, 256, 2);
+    for (size_t j=0; j<read; j++, i++) {
+      ok &= frames[2 * j] == Signal(i, 0);
+      ok &= frames[2 * j + 1] == Signal(i, channels == 1 ? 0 : 1);
+    }
+  }
+  // silence past the end
+  ok &= reader.Read(frames, 256, 2) == 0 && frames[511] == 0;
+  printf("%-16s %s\n", name, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+bool RoundTrip() {
+  int16_t frames[2 * kNumFrames];
+  for (size_t i=0; i<kNumFrames; i++) {
+    frames[2 * i] = Signal(i, 0);
+    frames[2 * i + 1] = Signal(i, 1);
+  }
+  bool ok = writer.Open(kPath, 2, 48000);
+  for (size_t i=0; i<kNumFrames; i += 100) {
+    writer.Write(frames + 2 * i, 100);
+  }
+  ok &= writer.Close();
+
+  ok &= reader.Open(kPath) && reader.num_frames() == kNumFrames &&
+      reader.sample_rate() == 48000 && reader.bits() == 16;
+  const int16_t* in_place = reader.Peek(kNumFrames, 2);
+  ok &= in_place && !memcmp(in_place, frames, sizeof(frames));
+  ok &= reader.Peek(1, 2) == NULL;
+  printf("%-16s %s\n", "round trip", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+int main() {
+  bool ok = RoundTrip();
+  WriteFile(WAV_FORMAT_PCM, 2, 24);
+  ok &= CheckRead("24-bit", 2);
+  WriteFile(WAV_FORMAT_FLOAT, 2, 32);
+  ok &= CheckRead("32-bit float", 2);
+  WriteFile(WAV_FORMAT_EXTENSIBLE, 2, 16);
+  ok &= CheckRead("extensible", 2);
+  WriteFile(WAV_FORMAT_PCM, 1, 16);
+  ok &= CheckRead("mono", 1);
+  reader.Close();
+  remove(kPath);
+  return ok ? 0 : 1;
+}
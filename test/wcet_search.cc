@@ -0,0 +1,561 @@
+// Copyright 2017 Matthias Puech.
+//
+// Author: Matthias Puech (matthias.puech@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+//
+// -----------------------------------------------------------------------------
+//
+// Worst-case execution time search: looks for the slot, parameters
+// and events that make one block of MultitapDelay::Process the most
+// expensive. Random candidates first, then hill-climbing from the
+// worst ones by small mutations. The cost of a candidate is its worst
+// block, each block timed as the fastest of a few identical renders.
+//
+// usage: wcet_search [-d seconds] [-r random] [-c climbs] [-k top]
+//                    [-s seed] [-o dir]
+//
+// Writes <dir>/wcet-input.wav and, for each of the [top] worst
+// candidates, wcet-<n>.txt and wcet-<n>-slots.txt, which replay with
+//   tapo_render -s wcet-<n>-slots.txt -d <seconds>
+//               wcet-input.wav out.wav wcet-<n>.txt
+
+#include <time.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "multitap_delay.hh"
+#include "random_generator.hh"
+#include "test/denormals.hh"
+#include "test/render.hh"
+#include "test/wav_file.hh"
+
+const int kBufferSize = 0x02000000 / sizeof(short) / 2;
+const int kMaxBlocks = 10 * SAMPLE_RATE / kBlockSize;
+const int kTimingRuns = 3;
+const int kMaxEvents = 128;
+const int kMaxEventsPerBlock = 8;  // half a command queue
+const int kMaxTop = 16;
+const uint32_t kMaxTapTime = 4 * SAMPLE_RATE;
+
+short buffer[kBufferSize];
+MultitapDelay delay;
+ShortFrame input[kMaxBlocks * kBlockSize];
+WavWriter writer;
+
+int num_blocks;
+RandomGenerator search_random;
+
+enum ScriptEventType {
+  SCRIPT_PARAMETER,
+  SCRIPT_TAP,
+  SCRIPT_LOAD,
+  SCRIPT_REPEAT,
+  SCRIPT_SYNC,
+  SCRIPT_CLOCK,
+  SCRIPT_CLEAR,
+  SCRIPT_REMOVE,
+  SCRIPT_LAST
+};
+
+struct ScriptEvent {
+  uint32_t block;
+  ScriptEventType type;
+  int parameter;                // or slot
+  float value;
+};
+
+struct Candidate {
+  Slot slots[2];
+  int num_events;
+  ScriptEvent events[kMaxEvents];
+};
+
+struct Cost {
+  uint64_t worst_ns;
+  uint32_t worst_block;
+  double mean_ns;
+};
+
+// Parameters searched, with their range on the module; values are
+// min + (max - min) * u^curve
+struct SearchParameter {
+  const char* name;
+  float min;
+  float max;
+  float curve;
+  bool integer;
+};
+
+const SearchParameter kSearchParameters[] = {
+  { "scale", 0.0f, 4.0f, 2.0f, false },
+  { "feedback", 0.0f, 1.4f, 1.0f, false },
+  { "modulation_amount", 0.0f, 1.0f, 0.5f, false },
+  { "modulation_frequency", 0.0000001f, 0.035f, 4.0f, false },
+  { "morph", 0.0f, 600000.0f, 4.0f, false },
+  { "drywet", 0.0f, 1.0f, 1.0f, false },
+  { "gain", 0.0f, 3.0f, 1.0f, false },
+  { "sync_ratio", 0.25f, 4.0f, 1.0f, false },
+  { "velocity_parameter", 0.0f, 1.0f, 1.0f, false },
+  { "velocity_type", 0.0f, 2.0f, 1.0f, true },
+  { "panning_mode", 0.0f, 2.0f, 1.0f, true },
+  { "edit_mode", 0.0f, 2.0f, 1.0f, true },
+};
+
+const int kNumSearchParameters =
+    sizeof(kSearchParameters) / sizeof(kSearchParameters[0]);
+
+// Values are rounded as the scripts print them, so that the replay
+// sees exactly what was measured
+void FormatValue(const SearchParameter& p, float value, char* out) {
+  if (p.integer) {
+    snprintf(out, 16, "%d", static_cast<int>(value));
+  } else {
+    snprintf(out, 16, "%.6g", value);
+  }
+}
+
+float Round(float value) {
+  char s[16];
+  snprintf(s, sizeof(s), "%.6g", value);
+  return atof(s);
+}
+
+float Uniform() { return search_random.GetFloat(); }
+int Choose(int n) { return search_random.GetWord() % n; }
+
+float RandomValue(const SearchParameter& p) {
+  float value = p.min + (p.max - p.min) * powf(Uniform(), p.curve);
+  return p.integer ? floorf(value + 0.5f) : Round(value);
+}
+
+// Taps
+
+void RandomTap(TapParameters* tap) {
+  tap->time = kBlockSize + Choose(kMaxTapTime - kBlockSize);
+  tap->velocity = Round(Uniform());
+  tap->velocity_type = static_cast<VelocityType>(Choose(3));
+  tap->panning = Round(Uniform());
+}
+
+void RandomSlot(Slot* slot) {
+  // the fuller, the more expensive
+  slot->size = kMaxTaps - Choose(kMaxTaps / 2);
+  for (int i = 0; i < slot->size; i++) {
+    RandomTap(&slot->taps[i]);
+  }
+}
+
+// Events
+
+int EventsAt(const Candidate& c, uint32_t block) {
+  int n = 0;
+  for (int i = 0; i < c.num_events; i++) n += c.events[i].block == block;
+  return n;
+}
+
+bool AddEvent(Candidate* c, const ScriptEvent& e) {
+  if (c->num_events == kMaxEvents ||
+      EventsAt(*c, e.block) >= kMaxEventsPerBlock) {
+    return false;
+  }
+  // sorted by block, stable
+  int i = c->num_events++;
+  while (i > 0 && c->events[i - 1].block > e.block) {
+    c->events[i] = c->events[i - 1];
+    i--;
+  }
+  c->events[i] = e;
+  return true;
+}
+
+void RemoveEvent(Candidate* c, int index) {
+  for (int i = index; i < c->num_events - 1; i++) {
+    c->events[i] = c->events[i + 1];
+  }
+  c->num_events--;
+}
+
+ScriptEvent RandomEvent() {
+  ScriptEvent e;
+  // events at block 0 are the initial state
+  e.block = 1 + Choose(num_blocks - 1);
+  e.parameter = 0;
+  e.value = 0.0f;
+  int kind = Choose(16);
+  if (kind < 7) {
+    e.type = SCRIPT_PARAMETER;
+    e.parameter = Choose(kNumSearchParameters);
+    e.value = RandomValue(kSearchParameters[e.parameter]);
+  } else if (kind < 10) {
+    e.type = SCRIPT_TAP;
+    e.value = Round(Uniform());
+  } else if (kind < 12) {
+    e.type = SCRIPT_LOAD;
+    e.parameter = Choose(2);
+  } else if (kind < 13) {
+    e.type = SCRIPT_REPEAT;
+    e.value = Choose(2);
+  } else if (kind < 14) {
+    e.type = SCRIPT_SYNC;
+    e.value = Choose(2);
+  } else if (kind < 15) {
+    e.type = SCRIPT_CLOCK;
+  } else {
+    e.type = Choose(2) ? SCRIPT_CLEAR : SCRIPT_REMOVE;
+  }
+  return e;
+}
+
+void RandomCandidate(Candidate* c) {
+  RandomSlot(&c->slots[0]);
+  RandomSlot(&c->slots[1]);
+  c->num_events = 0;
+
+  ScriptEvent e;
+  e.block = 0;
+  e.type = SCRIPT_PARAMETER;
+  for (int i = 0; i < kNumSearchParameters; i++) {
+    e.parameter = i;
+    e.value = RandomValue(kSearchParameters[i]);
+    // the initial parameters do not count in the events per block
+    c->events[c->num_events++] = e;
+  }
+  e.type = SCRIPT_LOAD;
+  e.parameter = 0;
+  c->events[c->num_events++] = e;
+
+  int n = 8 + Choose(32);
+  while (n--) AddEvent(c, RandomEvent());
+}
+
+void Mutate(Candidate* c) {
+  int n = 1 + Choose(3);
+  while (n--) {
+    int op = Choose(6);
+    if (op == 0) {
+      AddEvent(c, RandomEvent());
+    } else if (op == 1 && c->num_events > 0) {
+      int i = Choose(c->num_events);
+      if (c->events[i].block) RemoveEvent(c, i);
+    } else if (op == 2 && c->num_events > 0) {
+      // move an event by a few blocks
+      int i = Choose(c->num_events);
+      ScriptEvent e = c->events[i];
+      if (!e.block) continue;
+      int32_t block = e.block + Choose(33) - 16;
+      if (block < 1 || block >= num_blocks) continue;
+      RemoveEvent(c, i);
+      e.block = block;
+      AddEvent(c, e);
+    } else if (op == 3 && c->num_events > 0) {
+      // new value for a parameter, initial ones included
+      int i = Choose(c->num_events);
+      ScriptEvent* e = &c->events[i];
+      if (e->type == SCRIPT_PARAMETER) {
+        e->value = RandomValue(kSearchParameters[e->parameter]);
+      } else if (e->type == SCRIPT_TAP) {
+        e->value = Round(Uniform());
+      }
+    } else if (op == 4) {
+      Slot* slot = &c->slots[Choose(2)];
+      RandomTap(&slot->taps[Choose(slot->size)]);
+    } else if (op == 5) {
+      Slot* slot = &c->slots[Choose(2)];
+      if (slot->size < kMaxTaps) {
+        RandomTap(&slot->taps[slot->size++]);
+      } else {
+        slot->size--;
+      }
+    }
+  }
+}
+
+// Rendering, as tapo_render does
+
+uint64_t Nanoseconds() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void Execute(Candidate* c, const ScriptEvent& e, Parameters* params,
+             uint32_t clock) {
+  CommandQueue* q = &delay.ui_commands_;
+  switch (e.type) {
+  case SCRIPT_PARAMETER: {
+    const SearchParameter& p = kSearchParameters[e.parameter];
+    char value[16];
+    FormatValue(p, e.value, value);
+    SetParameter(params, p.name, value);
+  } break;
+  case SCRIPT_TAP: {
+    Parameters p = *params;
+    p.velocity = e.value;
+    q->AddTap(&p, clock);
+  } break;
+  case SCRIPT_LOAD: q->Load(&c->slots[e.parameter]); break;
+  case SCRIPT_REPEAT: q->set_repeat(e.value > 0.5f); break;
+  case SCRIPT_SYNC: q->set_sync(e.value > 0.5f); break;
+  case SCRIPT_CLOCK: q->ClockTick(clock); break;
+  case SCRIPT_CLEAR: q->Clear(); break;
+  case SCRIPT_REMOVE: q->RemoveLastTap(); break;
+  default: break;
+  }
+}
+
+// Renders [c], timing each block; writes the output if [writer] is open
+void Render(Candidate* c, uint64_t* block_ns, WavWriter* output) {
+  Parameters params;
+  InitParameters(&params);
+  delay.Init(buffer, kBufferSize);
+
+  int next = 0;
+  for (int block = 0; block < num_blocks; block++) {
+    uint32_t clock = block * kBlockSize;
+    while (next < c->num_events &&
+           c->events[next].block == static_cast<uint32_t>(block)) {
+      Execute(c, c->events[next++], &params, clock);
+    }
+
+    ShortFrame out[kBlockSize];
+    Parameters block_params = params;
+    uint64_t start = Nanoseconds();
+    delay.Process(&block_params, &input[clock], out);
+    block_ns[block] = Nanoseconds() - start;
+
+    DelayEvent e;
+    while (delay.events_.Read(&e)) { }
+    if (output) output->Write(&out[0].l, kBlockSize);
+  }
+}
+
+Cost Measure(Candidate* c) {
+  static uint64_t best[kMaxBlocks];
+  static uint64_t run[kMaxBlocks];
+  Render(c, best, NULL);
+  for (int r = 1; r < kTimingRuns; r++) {
+    Render(c, run, NULL);
+    for (int b = 0; b < num_blocks; b++) best[b] = std::min(best[b], run[b]);
+  }
+  Cost cost = { 0, 0, 0.0 };
+  for (int b = 0; b < num_blocks; b++) {
+    if (best[b] > cost.worst_ns) {
+      cost.worst_ns = best[b];
+      cost.worst_block = b;
+    }
+    cost.mean_ns += best[b];
+  }
+  cost.mean_ns /= num_blocks;
+  return cost;
+}
+
+// The worst candidates so far, worst first
+
+struct Entry {
+  Candidate candidate;
+  Cost cost;
+  int iteration;
+};
+
+Entry top[kMaxTop];
+int num_top;
+int max_top = 5;
+
+void Insert(const Candidate& c, const Cost& cost, int iteration) {
+  int i = num_top < max_top ? num_top++ : max_top - 1;
+  if (i == max_top - 1 && num_top == max_top &&
+      top[i].cost.worst_ns >= cost.worst_ns) {
+    return;
+  }
+  while (i > 0 && top[i - 1].cost.worst_ns < cost.worst_ns) {
+    top[i] = top[i - 1];
+    i--;
+  }
+  top[i].candidate = c;
+  top[i].cost = cost;
+  top[i].iteration = iteration;
+}
+
+// Scripts
+
+void MakeInput() {
+  // plucks of noise, loud enough to feed the delay
+  float envelope = 0.0f;
+  for (uint32_t i = 0; i < num_blocks * kBlockSize; i++) {
+    if (i % (SAMPLE_RATE / 4) == 0) envelope = 1.0f;
+    envelope *= 0.9998f;
+    input[i].l = static_cast<short>(envelope * (Uniform() - 0.5f) * 32767.0f);
+    input[i].r = input[i].l;
+  }
+}
+
+bool WriteScripts(const char* dir, int rank, const Entry& e, float seconds) {
+  char path[512];
+  snprintf(path, sizeof(path), "%s/wcet-%02d-slots.txt", dir, rank);
+  FILE* fp = fopen(path, "w");
+  if (!fp) return false;
+  for (int s = 0; s < 2; s++) {
+    const Slot& slot = e.candidate.slots[s];
+    fprintf(fp, s ? "slot\n" : "# slot 0\n");
+    for (int i = 0; i < slot.size; i++) {
+      const TapParameters& t = slot.taps[i];
+      fprintf(fp, "%.4f %.6g %d %.6g\n",
+              SamplesToMs(static_cast<uint32_t>(t.time)),
+              t.velocity, t.velocity_type, t.panning);
+    }
+  }
+  fclose(fp);
+
+  snprintf(path, sizeof(path), "%s/wcet-%02d.txt", dir, rank);
+  fp = fopen(path, "w");
+  if (!fp) return false;
+  double budget = 1e9 * kBlockSize / SAMPLE_RATE;
+  fprintf(fp, "# worst block %u at %.4f ms: %llu ns (%.1f%% of the "
+          "block), mean %.0f ns\n", e.cost.worst_block,
+          SamplesToMs(e.cost.worst_block * kBlockSize),
+          static_cast<unsigned long long>(e.cost.worst_ns),
+          100.0 * e.cost.worst_ns / budget, e.cost.mean_ns);
+  fprintf(fp, "# found at iteration %d; replay with:\n", e.iteration);
+  fprintf(fp, "# tapo_render -s wcet-%02d-slots.txt -d %g "
+          "wcet-input.wav out.wav wcet-%02d.txt\n", rank, seconds, rank);
+  for (int i = 0; i < e.candidate.num_events; i++) {
+    const ScriptEvent& ev = e.candidate.events[i];
+    double ms = SamplesToMs(ev.block * kBlockSize);
+    switch (ev.type) {
+    case SCRIPT_PARAMETER: {
+      const SearchParameter& p = kSearchParameters[ev.parameter];
+      char value[16];
+      FormatValue(p, ev.value, value);
+      fprintf(fp, "%.4f %s %s\n", ms, p.name, value);
+    } break;
+    case SCRIPT_TAP: fprintf(fp, "%.4f tap %.6g\n", ms, ev.value); break;
+    case SCRIPT_LOAD: fprintf(fp, "%.4f load %d\n", ms, ev.parameter); break;
+    case SCRIPT_REPEAT:
+      fprintf(fp, "%.4f repeat %d\n", ms, ev.value > 0.5f);
+      break;
+    case SCRIPT_SYNC: fprintf(fp, "%.4f sync %d\n", ms, ev.value > 0.5f); break;
+    case SCRIPT_CLOCK: fprintf(fp, "%.4f clock\n", ms); break;
+    case SCRIPT_CLEAR: fprintf(fp, "%.4f clear\n", ms); break;
+    case SCRIPT_REMOVE: fprintf(fp, "%.4f remove\n", ms); break;
+    default: break;
+    }
+  }
+  fclose(fp);
+  return true;
+}
+
+void Report(const char* phase, int iteration, const Cost& cost) {
+  fprintf(stderr, "%s %4d: worst %7llu ns at block %4u, mean %6.0f ns\n",
+          phase, iteration, static_cast<unsigned long long>(cost.worst_ns),
+          cost.worst_block, cost.mean_ns);
+}
+
+int main(int argc, char* argv[]) {
+  float seconds = 2.0f;
+  int num_random = 50;
+  int num_climbs = 200;
+  uint32_t seed = kRandomDefaultSeed;
+  const char* dir = ".";
+
+  int opt;
+  while ((opt = getopt(argc, argv, "d:r:c:k:s:o:")) != -1) {
+    switch (opt) {
+    case 'd': seconds = atof(optarg); break;
+    case 'r': num_random = atoi(optarg); break;
+    case 'c': num_climbs = atoi(optarg); break;
+    case 'k': max_top = atoi(optarg); break;
+    case 's': seed = strtoul(optarg, NULL, 0); break;
+    case 'o': dir = optarg; break;
+    default:
+      fprintf(stderr, "usage: %s [-d seconds] [-r random] [-c climbs] "
+              "[-k top] [-s seed] [-o dir]\n", argv[0]);
+      return 1;
+    }
+  }
+  num_blocks = seconds * SAMPLE_RATE / kBlockSize;
+  CONSTRAIN(num_blocks, 2, kMaxBlocks);
+  seconds = static_cast<float>(num_blocks * kBlockSize) / SAMPLE_RATE;
+  CONSTRAIN(max_top, 1, kMaxTop);
+  search_random.Init(seed);
+  FlushDenormals();
+
+  MakeInput();
+  char path[512];
+  snprintf(path, sizeof(path), "%s/wcet-input.wav", dir);
+  if (!writer.Open(path, 2, SAMPLE_RATE)) {
+    fprintf(stderr, "cannot write %s\n", path);
+    return 1;
+  }
+  writer.Write(&input[0].l, num_blocks * kBlockSize);
+  writer.Close();
+
+  static Candidate c;
+  for (int i = 0; i < num_random; i++) {
+    RandomCandidate(&c);
+    Cost cost = Measure(&c);
+    Insert(c, cost, i);
+    if (cost.worst_ns == top[0].cost.worst_ns) Report("random", i, cost);
+  }
+
+  // climb from the worst, restarting from the next one when stuck
+  static Candidate current;
+  int start = 0;
+  current = top[start].candidate;
+  Cost current_cost = top[start].cost;
+  int stuck = 0;
+  for (int i = 0; i < num_climbs && num_top; i++) {
+    c = current;
+    Mutate(&c);
+    Cost cost = Measure(&c);
+    int iteration = num_random + i;
+    if (cost.worst_ns > current_cost.worst_ns) {
+      current = c;
+      current_cost = cost;
+      stuck = 0;
+      Insert(c, cost, iteration);
+      Report("climb ", iteration, cost);
+    } else if (++stuck == 40) {
+      start = (start + 1) % num_top;
+      current = top[start].candidate;
+      current_cost = top[start].cost;
+      stuck = 0;
+    }
+  }
+
+  for (int i = 0; i < num_top; i++) {
+    if (!WriteScripts(dir, i + 1, top[i], seconds)) {
+      fprintf(stderr, "cannot write the scripts to %s\n", dir);
+      return 1;
+    }
+    printf("wcet-%02d: %llu ns at block %u (%.1f%% of the block)\n", i + 1,
+           static_cast<unsigned long long>(top[i].cost.worst_ns),
+           top[i].cost.worst_block,
+           100.0 * top[i].cost.worst_ns * SAMPLE_RATE / (1e9 * kBlockSize));
+  }
+  return 0;
+}
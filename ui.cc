@@ -28,39 +28,42 @@
 // User interface.
 
 #include "ui.hh"
-#include "stmlib/utils/random.h"
 
 const int32_t kLongPressDuration = 400;
 const int32_t kVeryLongPressDuration = 1200;
+// pings older than this (e.g. after a flash write) are not displayed
+const uint32_t kMaxEventAge = SAMPLE_RATE / 20;
+
+// Init posts 4 commands, and DoEvents at most one to mute or unmute per
+// block; then each sequencer step and each event posts at most one,
+// and the queues hold the most that can pile up between two blocks
+static_assert(5 + kStepQueueSize + kUiEventQueueSize <= kCommandQueueSize,
+              "UI commands could overflow the command queue");
+
+// banks are selected within a group of 4; pressing the bank page
+// button again moves to the next group, shown by the item's color
+const int kBanksPerGroup = 4;
+const LedColor kBankGroupColors[kNumBanks / kBanksPerGroup] = {
+  COLOR_CYAN, COLOR_YELLOW, COLOR_BLUE, COLOR_WHITE
+};
 
 using namespace stmlib;
 
 Ui* Ui::instance_;
 
-void reset_observer() {
-    Ui::instance_->PingResetLed();
-}
-
-void tap_observer(TapType type, float velocity) {
-  Ui::instance_->PingMeter(type, velocity);
-}
-
-void slot_modified_observer() {
-  Ui::instance_->SlotModified();
-}
-
+// called from Control; the step itself is deferred to the main loop,
+// which is the only context allowed to post UI commands
 void step_observer(float morph_time) {
-  Ui::instance_->SequencerStep(morph_time);
+  Ui::instance_->QueueSequencerStep(morph_time);
 }
 
 void Ui::Init(MultitapDelay* delay, Parameters* parameters) {
   delay_ = delay;
   parameters_ = parameters;
   instance_ = this;
+  random_.Init();
+  steps_.Init();
 
-  delay_->reset_observable_.set_observer(&reset_observer);
-  delay_->tap_observable_.set_observer(&tap_observer);
-  delay_->slot_modified_observable_.set_observer(&slot_modified_observer);
   delay_->step_observable_.set_observer(&step_observer);
 
   leds_.Init();
@@ -72,6 +75,8 @@ void Ui::Init(MultitapDelay* delay, Parameters* parameters) {
 
   current_slot_ = -1;
   next_slot_ = -1;
+  slot_modifications_ = delay_->slot_modifications();
+  muting_ = false;
 
   ignore_releases_ = 0;
   velocity_meter_ = -1.0f;
@@ -81,8 +86,8 @@ void Ui::Init(MultitapDelay* delay, Parameters* parameters) {
   settings_item_[1] = persistent_.current_bank();
   settings_item_[2] = persistent_.panning_mode();
   settings_item_[3] = persistent_.sequencer_mode();
-  delay_->set_repeat(persistent_.repeat());
-  delay_->set_sync(persistent_.sync());
+  delay_->ui_commands_.set_repeat(persistent_.repeat());
+  delay_->ui_commands_.set_sync(persistent_.sync());
   ParseSettings();
 
   // load current slot or first slot of current bank on startup
@@ -111,7 +116,7 @@ void Ui::LoadSlot(uint8_t slot) {
   next_slot_ = slot;
   // if morph=0, we add 1 to correctly switch to next slot
   sample_counter_to_next_slot_ = parameters_->morph + 1;
-  delay_->Load(persistent_.mutable_slot(next_slot_));
+  delay_->ui_commands_.Load(persistent_.slot(next_slot_));
 }
 
 void Ui::SequencerStep(float morph_time) {
@@ -126,14 +131,18 @@ void Ui::SequencerStep(float morph_time) {
       parameters_->sequencer_direction == DIRECTION_FORWARD ?
       current + 1 :
       parameters_->sequencer_direction == DIRECTION_WALK ?
-      Random::GetWord() & 1 ? current + 1 : current - 1 :
+      random_.GetWord() & 1 ? current + 1 : current - 1 :
       parameters_->sequencer_direction == DIRECTION_RANDOM ?
-      Random::GetWord() : 0;
+      random_.GetWord() : 0;
     next = next % 6;
     LoadSlot(6 * bank_ + next);
   }
 }
 
+void Ui::QueueSequencerStep(float morph_time) {
+  steps_.Write(morph_time);
+}
+
 void Ui::PingGateLed() {
   if (ping_gate_led_counter_ == 0)
     ping_gate_led_counter_ = 8;
@@ -149,6 +158,11 @@ void Ui::PingSaveLed() {
     ping_save_led_counter_ = 512;
 }
 
+void Ui::PingSaveFailedLed() {
+  if (ping_save_failed_counter_ == 0)
+    ping_save_failed_counter_ = 512;
+}
+
 void Ui::SlotModified() {
   current_slot_ = -1;
   next_slot_ = -1;
@@ -175,7 +189,33 @@ void Ui::PingMeter(TapType type, float velocity)
   }
 }
 
+void Ui::ProcessDelayEvents() {
+  uint32_t modifications = delay_->slot_modifications();
+  if (modifications != slot_modifications_) {
+    slot_modifications_ = modifications;
+    SlotModified();
+  }
+
+  DelayEvent e;
+  while (delay_->events_.Read(&e)) {
+    bool stale = delay_->clock() - e.timestamp > kMaxEventAge;
+    switch (e.type) {
+    case EVENT_RESET:
+      if (!stale) PingResetLed();
+      break;
+    case EVENT_TAP:
+      if (!stale) PingMeter(e.tap_type, e.velocity);
+      break;
+    case EVENT_TAP_MODULO:
+      if (!stale) PingGateLed();
+      break;
+    }
+  }
+}
+
 void Ui::Poll() {
+  ProcessDelayEvents();
+
   buttons_.Debounce();
   switches_.Read();
   
@@ -325,6 +365,13 @@ inline void Ui::PaintLeds() {
         leds_.set_rgb(slot, COLOR_RED);
       }
     }
+
+    // a save could not be written
+    if (ping_save_failed_counter_ > 0) {
+      for (int i=0; i<6; i++) {
+        leds_.set_rgb(i, blink ? COLOR_RED : COLOR_BLACK);
+      }
+    }
   }
   break;
 
@@ -333,10 +380,15 @@ inline void Ui::PaintLeds() {
     for (int i=0; i<6; i++) {
       int page = settings_page_;
       int item = settings_item_[settings_page_];
+      LedColor color = COLOR_CYAN;
+      if (page == PAGE_BANK) {
+        color = kBankGroupColors[item / kBanksPerGroup];
+        item %= kBanksPerGroup;
+      }
       if (i == settings_page_) {
         leds_.set_rgb(i, COLOR_MAGENTA);
       } else if (i == page + item + 1) {
-        leds_.set_rgb(i, COLOR_CYAN);
+        leds_.set_rgb(i, color);
       } else {
         leds_.set_rgb(i, COLOR_BLACK);
       }
@@ -372,6 +424,9 @@ inline void Ui::PaintLeds() {
   if (ping_save_led_counter_ > 0)
     ping_save_led_counter_--;
 
+  if (ping_save_failed_counter_ > 0)
+    ping_save_failed_counter_--;
+
   if (velocity_meter_ > 0.0f) {
     velocity_meter_ -= 0.005f;
   }
@@ -399,7 +454,7 @@ void Ui::ParseSettingsCurrentPage() {
   } break;
   case PAGE_PANNING_MODE: {
     parameters_->panning_mode = static_cast<PanningMode>(p);
-    delay_->RepanTaps(parameters_->panning_mode);
+    delay_->ui_commands_.RepanTaps(parameters_->panning_mode);
   } break;
   case PAGE_SEQUENCER: {
     sequencer_mode_ = p;
@@ -407,6 +462,15 @@ void Ui::ParseSettingsCurrentPage() {
   }
 }
 
+void Ui::SelectSettingsItem(int item) {
+  if (settings_page_ == PAGE_BANK) {
+    // stay in the current group of banks
+    item += settings_item_[PAGE_BANK] / kBanksPerGroup * kBanksPerGroup;
+  }
+  settings_item_[settings_page_] = item;
+  ParseSettingsCurrentPage();
+}
+
 void Ui::SaveSettings()
 {
   persistent_.mutable_data()->velocity_parameter = settings_item_[0];
@@ -414,8 +478,7 @@ void Ui::SaveSettings()
   persistent_.mutable_data()->panning_mode = settings_item_[2];
   persistent_.mutable_data()->sequencer_mode = sequencer_mode_;
   persistent_.mutable_data()->current_slot = current_slot_;
-  persistent_.mutable_data()->repeat = delay_->repeat() > 0.0f;
-  persistent_.mutable_data()->sync = delay_->sync();
+  persistent_.mutable_data()->repeat = delay_->repeat_on();
   persistent_.SaveData();
 }
 
@@ -433,8 +496,7 @@ void Ui::OnButtonPressed(const Event& e) {
       settings_changed_ = true;
       ignore_releases_ = 2;
       settings_page_ = pressed;
-      settings_item_[pressed] = e.control_id - pressed - 1;
-      ParseSettingsCurrentPage();
+      SelectSettingsItem(e.control_id - pressed - 1);
     }
   }
 
@@ -460,9 +522,9 @@ void Ui::OnButtonReleased(const Event& e) {
 
   if (mode_ == UI_MODE_CONFIRM_SAVE) {
     if (e.control_id + 6 * bank_ == save_candidate_slot_) {
-        PingSaveLed();
-        delay_->Save(persistent_.mutable_slot(save_candidate_slot_));
-        persistent_.SaveSlot(save_candidate_slot_);
+        Slot slot;
+        delay_->Save(&slot);
+        persistent_.SaveSlot(save_candidate_slot_, &slot);
         current_slot_ = save_candidate_slot_;
         SaveSettings(); // while we're at it, save the settings too
     }
@@ -480,13 +542,17 @@ void Ui::OnButtonReleased(const Event& e) {
       else if (e.data >= kLongPressDuration && e.control_id <= BUTTON_4) {
         // long press -> change page
         settings_page_ = e.control_id;
+      } else if (e.control_id == PAGE_BANK && settings_page_ == PAGE_BANK) {
+        // short press on the bank page -> next group of banks
+        settings_item_[PAGE_BANK] =
+          (settings_item_[PAGE_BANK] + kBanksPerGroup) % kNumBanks;
+        ParseSettingsCurrentPage();
       } else if (e.control_id <= settings_page_) {
         // short press on the left -> change page
         settings_page_ = e.control_id;
       } else {
         // short press on the right -> change setting
-        settings_item_[settings_page_] = e.control_id - settings_page_ - 1;
-        ParseSettingsCurrentPage();
+        SelectSettingsItem(e.control_id - settings_page_ - 1);
       }
     } else {
       // Delete and Repeat exit settings mode
@@ -499,19 +565,21 @@ void Ui::OnButtonReleased(const Event& e) {
     switch (e.control_id) {
     case BUTTON_DELETE:
       if (e.data >= kLongPressDuration) {
-        delay_->set_sync(!delay_->sync());
+        // the UI owns the sync state: the delay may not have
+        // executed the previous toggle yet
+        persistent_.mutable_data()->sync = !persistent_.sync();
+        delay_->ui_commands_.set_sync(persistent_.sync());
       } else {
-        delay_->RemoveLastTap();
+        delay_->ui_commands_.RemoveLastTap();
       }
       break;
     case BUTTON_REPEAT:
       if (e.data >= kLongPressDuration) {
         if (!sequencer_mode_) {
-          delay_->Clear();
+          delay_->ui_commands_.Clear();
         }
       } else {
-        bool repeat = delay_->repeat() > 0.0f;
-        delay_->set_repeat(!repeat);
+        delay_->ui_commands_.ToggleRepeat();
       }
       break;
     case BUTTON_1:
@@ -550,6 +618,31 @@ void Ui::OnSwitchSwitched(const stmlib::Event& e) {
 }
 
 void Ui::DoEvents() {
+  // the save LED pings once the slot is actually in flash
+  switch (persistent_.Poll()) {
+  case SAVE_DONE: PingSaveLed(); break;
+  case SAVE_FAILED: PingSaveFailedLed(); break;
+  default: break;
+  }
+
+  // an erase stalls the codec interrupt for about a second, during
+  // which the codec repeats the last block: it must be silent
+  if (muting_) {
+    if (delay_->muted()) {
+      persistent_.Erase();
+      delay_->ui_commands_.set_mute(false);
+      muting_ = false;
+    }
+  } else if (persistent_.erase_pending()) {
+    delay_->ui_commands_.set_mute(true);
+    muting_ = true;
+  }
+
+  float morph_time;
+  while (steps_.Read(&morph_time)) {
+    SequencerStep(morph_time);
+  }
+
   while (queue_.available()) {
     Event e = queue_.PullEvent();
     if (e.control_type == CONTROL_SWITCH) {
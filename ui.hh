@@ -40,6 +40,13 @@
 #include "multitap_delay.hh"
 #include "control.hh"
 #include "persistent.hh"
+#include "random_generator.hh"
+#include "spsc_queue.hh"
+
+// sequencer steps not yet executed by the main loop
+const size_t kStepQueueSize = 4;
+// button and switch events not yet handled by the main loop
+const size_t kUiEventQueueSize = 16;
 
 enum UiMode {
   UI_MODE_SPLASH,
@@ -66,8 +73,8 @@ class Ui {
   void DoEvents();
   void Panic();
 
-  void ReadParameters() {
-    control_.Read(parameters_, sequencer_mode_);
+  void ReadParameters(CvStream* stream) {
+    control_.Read(parameters_, stream, sequencer_mode_);
 
     // this function also counts the blocks processed, so:
     if (sample_counter_to_next_slot_ > 0.0f) {
@@ -83,12 +90,14 @@ class Ui {
   }
 
   void PingSaveLed();
+  void PingSaveFailedLed();
   void PingGateLed();
   void PingResetLed();
   void PingMeter(TapType tap_type, float velocity);
   void SlotModified();
 
   void SequencerStep(float morph_time);
+  void QueueSequencerStep(float morph_time);
 
   static Ui* instance_;
 
@@ -96,15 +105,18 @@ class Ui {
   void OnButtonPressed(const stmlib::Event& e);
   void OnButtonReleased(const stmlib::Event& e);
   void OnSwitchSwitched(const stmlib::Event& e);
+  void ProcessDelayEvents();
   void ParseSettings();
   void ParseSettingsCurrentPage();
+  void SelectSettingsItem(int item);
   void SaveSettings();
   void PaintLeds();
   void LoadSlot(uint8_t slot);
 
-  stmlib::EventQueue<16> queue_;
+  stmlib::EventQueue<kUiEventQueueSize> queue_;
 
   Persistent persistent_;
+  RandomGenerator random_;
   Control control_;
   MultitapDelay* delay_;
   Parameters* parameters_;
@@ -128,6 +140,7 @@ class Ui {
 
   uint16_t ping_gate_led_counter_;
   uint16_t ping_save_led_counter_;
+  uint16_t ping_save_failed_counter_;
   uint16_t ping_reset_counter_;
 
   float velocity_meter_;
@@ -135,6 +148,12 @@ class Ui {
 
   bool sequencer_mode_;
   bool settings_changed_;
+  bool muting_;                 // for a flash erase
+
+  uint32_t slot_modifications_; // last seen from the delay
+
+  // posted by Control, executed by the main loop
+  SpscQueue<float, kStepQueueSize> steps_;
 };
 
 #endif